@@ -0,0 +1,71 @@
+/* bitset.c - Fixed size set of bits
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include "bitset.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bitset *Bitset_new(int size) {
+	assert(size >= 0);
+	const int word_count = (size + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+	struct bitset *result = (struct bitset*)
+		calloc(1, sizeof(struct bitset)
+		       + word_count * sizeof(bitset_word_t));
+	result->size = size;
+	result->word_count = word_count;
+	return result;
+}
+
+void Bitset_delete(struct bitset *set) {
+	free(set);
+}
+
+void Bitset_set(struct bitset *set, int bit) {
+	assert(bit >= 0 && bit < set->size);
+	set->words[bit / BITSET_WORD_BITS]
+		|= (bitset_word_t)1 << (bit % BITSET_WORD_BITS);
+}
+
+void Bitset_clear_all(struct bitset *set) {
+	memset(set->words, 0, set->word_count * sizeof(bitset_word_t));
+}
+
+int Bitset_next(const struct bitset *set, int from) {
+	if (from < 0)
+		from = 0;
+	if (from >= set->size)
+		return -1;
+	int w = from / BITSET_WORD_BITS;
+	// Mask out the bits below 'from' in the first word.
+	bitset_word_t word = set->words[w]
+		& (~(bitset_word_t)0 << (from % BITSET_WORD_BITS));
+	for (;;) {
+		if (word)
+			return w * BITSET_WORD_BITS + __builtin_ctzl(word);
+		if (++w >= set->word_count)
+			return -1;
+		word = set->words[w];
+	}
+}
@@ -0,0 +1,65 @@
+/* bitset.h - Fixed size set of bits
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * A set of bits sized at runtime, e.g. one bit per state variable of a
+ * service. Used for the masks of variables not to event, of variables
+ * changed in a transaction and of those a client of the state-events
+ * stream asked for. Finding the next set bit works a machine word at a
+ * time.
+ */
+
+#ifndef _BITSET_H
+#define _BITSET_H
+
+#include <limits.h>
+
+typedef unsigned long bitset_word_t;
+#define BITSET_WORD_BITS ((int)(sizeof(bitset_word_t) * CHAR_BIT))
+
+struct bitset {
+	int size;        // Number of bits.
+	int word_count;
+	bitset_word_t words[];
+};
+
+// Create a set of "size" bits, all cleared.
+struct bitset *Bitset_new(int size);
+void Bitset_delete(struct bitset *set);
+
+void Bitset_set(struct bitset *set, int bit);
+void Bitset_clear_all(struct bitset *set);
+
+// Returns the first set bit at position "from" or later, -1 if there is none.
+// Iterate with for (i = Bitset_next(s, 0); i >= 0; i = Bitset_next(s, i+1))
+int Bitset_next(const struct bitset *set, int from);
+
+// Tested for every variable change, so keep it inline. Bits outside the
+// set are never set.
+static inline int Bitset_test(const struct bitset *set, int bit) {
+	if (bit < 0 || bit >= set->size)
+		return 0;
+	return (set->words[bit / BITSET_WORD_BITS]
+		>> (bit % BITSET_WORD_BITS)) & 1;
+}
+
+#endif /* _BITSET_H */
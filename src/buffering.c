@@ -0,0 +1,189 @@
+/* buffering.c - Adaptive network buffering controller
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "buffering.h"
+
+// Weight of a new sample in the moving average of the input rate.
+#define RATE_SMOOTHING 0.1
+
+// Relative input rate deviation above which we consider the link jittery,
+// and below which it is stable.
+#define JITTER_HIGH 0.5
+#define JITTER_LOW 0.15
+
+#define GROW_AFTER_REBUFFER 1.5
+#define GROW_ON_JITTER 1.25
+#define SHRINK_WHEN_STABLE 0.8
+
+struct buffering {
+	struct buffering_config config;
+	double duration;
+	int fill_percent;
+	int holding;
+	int playing;            // Have we started the current stream ?
+	int filled;             // Buffer was full once in this stream.
+	int start_percent;      // Start watermark of the current stream.
+	int stream_rebuffers;   // Rebuffer events in the current stream.
+	unsigned rebuffer_count;
+	unsigned stream_count;
+	double rate_mean;
+	double rate_deviation;
+};
+
+static double clamp_duration(const struct buffering *b, double d) {
+	if (d < b->config.min_duration) d = b->config.min_duration;
+	if (d > b->config.max_duration) d = b->config.max_duration;
+	return d;
+}
+
+static double jitter(const struct buffering *b) {
+	return b->rate_mean > 0 ? b->rate_deviation / b->rate_mean : 0;
+}
+
+// While still filling up after a fast start, the buffer is expected to be
+// low; only rebuffer if it gets critical.
+static int low_watermark(const struct buffering *b) {
+	if (!b->filled && b->start_percent < b->config.start_percent) {
+		const int critical = b->start_percent / 2;
+		return critical < b->config.low_percent
+			? critical : b->config.low_percent;
+	}
+	return b->config.low_percent;
+}
+
+struct buffering *Buffering_new(const struct buffering_config *config,
+				double initial_duration) {
+	struct buffering *b = (struct buffering*) calloc(1, sizeof(*b));
+	b->config = *config;
+	if (b->config.max_duration < b->config.min_duration)
+		b->config.max_duration = b->config.min_duration;
+	b->duration = clamp_duration(b, initial_duration);
+	return b;
+}
+
+void Buffering_delete(struct buffering *b) {
+	free(b);
+}
+
+double Buffering_stream_start(struct buffering *b) {
+	if (b->stream_count > 0) {
+		// Adapt based on how the previous stream went.
+		const double previous = b->duration;
+		if (b->stream_rebuffers > 0) {
+			b->duration *= GROW_AFTER_REBUFFER;
+		} else if (jitter(b) > JITTER_HIGH) {
+			b->duration *= GROW_ON_JITTER;
+		} else if (b->rate_mean > 0 && jitter(b) < JITTER_LOW) {
+			b->duration *= SHRINK_WHEN_STABLE;
+		}
+		b->duration = clamp_duration(b, b->duration);
+		if (b->duration != previous) {
+			Log_info("buffering", "Buffer duration %.1fs -> %.1fs "
+				 "(%d rebuffers, jitter %.2f)", previous,
+				 b->duration, b->stream_rebuffers, jitter(b));
+		}
+	}
+	b->stream_count++;
+	b->stream_rebuffers = 0;
+	b->playing = 0;
+	b->filled = 0;
+	b->holding = 0;
+	b->fill_percent = 0;
+	b->start_percent = b->config.start_percent;
+	if (b->config.fast_start_duration > 0) {
+		const int fast_percent = (int) ceil(
+			100 * b->config.fast_start_duration / b->duration);
+		if (fast_percent < b->start_percent)
+			b->start_percent = fast_percent;
+	}
+	return b->duration;
+}
+
+enum buffering_action Buffering_update(struct buffering *b, int percent,
+				       int avg_in) {
+	b->fill_percent = percent;
+	if (avg_in > 0) {
+		if (b->rate_mean <= 0) {
+			b->rate_mean = avg_in;
+		} else {
+			const double deviation = fabs(avg_in - b->rate_mean);
+			b->rate_mean += RATE_SMOOTHING * (avg_in - b->rate_mean);
+			b->rate_deviation += RATE_SMOOTHING
+				* (deviation - b->rate_deviation);
+		}
+	}
+	if (percent >= b->config.resume_percent) {
+		b->filled = 1;
+	}
+
+	if (!b->playing) {
+		// Start-up.
+		if (percent >= b->start_percent) {
+			b->playing = 1;
+			b->holding = 0;
+			return BUFFERING_RELEASE;
+		}
+		if (!b->holding) {
+			b->holding = 1;
+			return BUFFERING_HOLD;
+		}
+		return BUFFERING_NO_CHANGE;
+	}
+
+	if (b->holding) {
+		if (percent >= b->config.resume_percent) {
+			Log_info("buffering", "Rebuffered; resume at %d%%",
+				 percent);
+			b->holding = 0;
+			return BUFFERING_RELEASE;
+		}
+	} else if (percent < low_watermark(b)) {
+		b->holding = 1;
+		b->rebuffer_count++;
+		b->stream_rebuffers++;
+		Log_info("buffering", "Buffer at %d%%, rebuffering (#%u)",
+			 percent, b->rebuffer_count);
+		return BUFFERING_HOLD;
+	}
+	return BUFFERING_NO_CHANGE;
+}
+
+void Buffering_get_stats(const struct buffering *b,
+			 struct buffering_stats *stats) {
+	stats->fill_percent = b->fill_percent;
+	stats->duration = b->duration;
+	stats->is_holding = b->holding;
+	stats->rebuffer_count = b->rebuffer_count;
+	stats->stream_count = b->stream_count;
+	stats->input_rate = b->rate_mean;
+	stats->jitter = jitter(b);
+}
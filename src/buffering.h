@@ -0,0 +1,90 @@
+/* buffering.h - Adaptive network buffering controller
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * Decides when to hold playback while the network buffer fills, and how
+ * large the buffer should be.
+ *
+ * The fill level is given in percent of the current target duration, as
+ * reported by GStreamer buffering messages. A new stream starts playing
+ * once the fill reaches the start watermark; while playing, it is paused
+ * only if the fill drops below the low watermark, and then resumes at the
+ * resume watermark. With fast-start, playback begins as soon as a few
+ * seconds are buffered and the buffer keeps filling while playing. The
+ * target duration adapts between a minimum and
+ * maximum: it grows after each rebuffering and if the input rate is
+ * jittery, and slowly shrinks again on stable links to keep start-up fast.
+ * New durations only take effect for the next stream.
+ */
+
+#ifndef _BUFFERING_H
+#define _BUFFERING_H
+
+struct buffering_config {
+	double min_duration;  // seconds
+	double max_duration;  // seconds
+	int start_percent;    // Start new stream once filled that much.
+	int low_percent;      // Pause to rebuffer below this while playing.
+	int resume_percent;   // Continue after rebuffering.
+	// Fast-start: if > 0, start a new stream as soon as this many
+	// seconds are buffered. Until the buffer is filled the first time,
+	// rebuffering only happens below half of that.
+	double fast_start_duration;
+};
+
+enum buffering_action {
+	BUFFERING_NO_CHANGE,
+	BUFFERING_HOLD,       // Pause the pipeline, not enough data.
+	BUFFERING_RELEASE,    // Enough data, go (back) to playing.
+};
+
+struct buffering_stats {
+	int fill_percent;
+	double duration;       // Current target duration in seconds.
+	int is_holding;
+	unsigned rebuffer_count;
+	unsigned stream_count;
+	double input_rate;     // Average input bytes/second.
+	double jitter;         // Relative deviation of input rate.
+};
+
+struct buffering;
+
+// Create a controller, starting with the given target duration
+// (clamped to the configured range).
+struct buffering *Buffering_new(const struct buffering_config *config,
+				double initial_duration);
+void Buffering_delete(struct buffering *buffering);
+
+// A new stream is about to be set up. Returns the target duration in
+// seconds it should use.
+double Buffering_stream_start(struct buffering *buffering);
+
+// Feed a buffering message: fill level and, if known (> 0), the average
+// input byte rate. Returns what to do with the pipeline.
+enum buffering_action Buffering_update(struct buffering *buffering,
+				       int percent, int avg_in);
+
+void Buffering_get_stats(const struct buffering *buffering,
+			 struct buffering_stats *stats);
+
+#endif /* _BUFFERING_H */
@@ -0,0 +1,538 @@
+/* didl.c - Edit DIDL-Lite meta data documents
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xmlescape.h"
+#include "didl.h"
+
+#define NS_DIDL "urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/"
+#define NS_DC   "http://purl.org/dc/elements/1.1/"
+#define NS_UPNP "urn:schemas-upnp-org:metadata-1-0/upnp/"
+
+// Namespace declarations deeper than this are ignored.
+#define MAX_NS_BINDINGS 32
+// Attributes after this many in one element are ignored.
+#define MAX_ATTRIBUTES 16
+
+// Fields are either the content of an element within the item, or an
+// attribute of the item itself (element NULL) or of such an element.
+static const struct {
+	const char *ns;
+	const char *element;
+	const char *attribute;
+} kFields[DIDL_FIELD_COUNT] = {
+	[DIDL_ID]      = { NULL, NULL, "id" },
+	[DIDL_TITLE]   = { NS_DC, "title", NULL },
+	[DIDL_ARTIST]  = { NS_UPNP, "artist", NULL },
+	[DIDL_ALBUM]   = { NS_UPNP, "album", NULL },
+	[DIDL_GENRE]   = { NS_UPNP, "genre", NULL },
+	[DIDL_CREATOR] = { NS_UPNP, "creator", NULL },
+	[DIDL_RES_BITRATE]          = { NS_DIDL, "res", "bitrate" },
+	[DIDL_RES_SAMPLE_FREQUENCY] = { NS_DIDL, "res", "sampleFrequency" },
+	[DIDL_RES_DURATION]         = { NS_DIDL, "res", "duration" },
+};
+
+// Location of a field in the original document.
+struct didl_range {
+	int start;          // Offset of the content; -1 if not present.
+	int end;
+	// An empty element <x/>: the range covers the '/', which needs to be
+	// replaced by ">content</x" to fill it.
+	int self_closing;
+	int qname;          // Offset and length of the element name.
+	int qname_len;
+	// An attribute that is not there yet: start = end is where to
+	// insert it.
+	int insert;
+};
+
+struct didl {
+	char *xml;
+	int len;
+	struct didl_range range[DIDL_FIELD_COUNT];
+	char *value[DIDL_FIELD_COUNT];  // xml escaped; NULL if unchanged.
+};
+
+struct ns_binding {
+	const char *prefix;  // Points into the document.
+	int prefix_len;
+	const char *uri;
+	int uri_len;
+	int depth;           // Of the element declaring it.
+};
+
+struct ns_scope {
+	struct ns_binding binding[MAX_NS_BINDINGS];
+	int count;
+};
+
+struct attribute {
+	const char *name;
+	int name_len;
+	const char *value;   // Without the quotes.
+	const char *value_end;
+};
+
+static void ns_pop(struct ns_scope *scope, int depth) {
+	while (scope->count > 0
+	       && scope->binding[scope->count - 1].depth >= depth) {
+		scope->count--;
+	}
+}
+
+// Returns the namespace URI of the given prefix in *uri. Prefixes that are
+// not declared get the namespace they conventionally stand for; some
+// control points don't bother to declare them.
+static int ns_resolve(const struct ns_scope *scope,
+		      const char *prefix, int prefix_len, const char **uri) {
+	for (int i = scope->count - 1; i >= 0; --i) {
+		const struct ns_binding *b = &scope->binding[i];
+		if (b->prefix_len == prefix_len
+		    && strncmp(b->prefix, prefix, prefix_len) == 0) {
+			*uri = b->uri;
+			return b->uri_len;
+		}
+	}
+	if (prefix_len == 0)
+		*uri = NS_DIDL;
+	else if (prefix_len == 2 && strncmp(prefix, "dc", 2) == 0)
+		*uri = NS_DC;
+	else if (prefix_len == 4 && strncmp(prefix, "upnp", 4) == 0)
+		*uri = NS_UPNP;
+	else
+		*uri = "";
+	return strlen(*uri);
+}
+
+// Check if qualified name "qname" is element "name" in namespace "ns".
+static int is_element(const struct ns_scope *scope,
+		      const char *qname, int qname_len,
+		      const char *ns, const char *name) {
+	const char *colon = memchr(qname, ':', qname_len);
+	const char *local = colon ? colon + 1 : qname;
+	const int local_len = qname_len - (local - qname);
+	if (local_len != (int) strlen(name)
+	    || strncmp(local, name, local_len) != 0)
+		return 0;
+	const char *uri;
+	const int uri_len = ns_resolve(scope, qname,
+				       colon ? colon - qname : 0, &uri);
+	return uri_len == (int) strlen(ns) && strncmp(uri, ns, uri_len) == 0;
+}
+
+static const char *skip_space(const char *p) {
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+	return p;
+}
+
+// Parse the attributes of a start tag, starting after the element name,
+// into "attr" and declare the namespaces. Returns pointer to the closing
+// '/' or '>' or NULL if malformed.
+static const char *parse_attributes(const char *p, int depth,
+				    struct ns_scope *scope,
+				    struct attribute *attr, int *attr_count) {
+	*attr_count = 0;
+	for (;;) {
+		p = skip_space(p);
+		if (*p == '/' || *p == '>')
+			return p;
+		const char *name = p;
+		p += strcspn(p, "= \t\r\n/>");
+		const int name_len = p - name;
+		p = skip_space(p);
+		if (name_len == 0 || *p != '=')
+			return NULL;
+		p = skip_space(p + 1);
+		if (*p != '"' && *p != '\'')
+			return NULL;
+		const char *value = p + 1;
+		const char *value_end = strchr(value, *p);
+		if (value_end == NULL)
+			return NULL;
+		p = value_end + 1;
+
+		if (strncmp(name, "xmlns", 5) == 0
+		    && (name_len == 5 || name[5] == ':')) {
+			if (scope->count == MAX_NS_BINDINGS)
+				continue;
+			struct ns_binding *b = &scope->binding[scope->count++];
+			b->prefix = name_len == 5 ? name : name + 6;
+			b->prefix_len = name_len == 5 ? 0 : name_len - 6;
+			b->uri = value;
+			b->uri_len = value_end - value;
+			b->depth = depth;
+		} else if (*attr_count < MAX_ATTRIBUTES) {
+			struct attribute *a = &attr[(*attr_count)++];
+			a->name = name;
+			a->name_len = name_len;
+			a->value = value;
+			a->value_end = value_end;
+		}
+	}
+}
+
+// Set range of attribute field "f" in the element with the given
+// attributes, ending at tag_end.
+static void find_attribute(struct didl *didl, int f,
+			   const struct attribute *attr, int attr_count,
+			   const char *tag_end) {
+	struct didl_range *r = &didl->range[f];
+	const char *name = kFields[f].attribute;
+	const int name_len = strlen(name);
+	for (int i = 0; i < attr_count; ++i) {
+		if (attr[i].name_len == name_len
+		    && strncmp(attr[i].name, name, name_len) == 0) {
+			r->start = attr[i].value - didl->xml;
+			r->end = attr[i].value_end - didl->xml;
+			return;
+		}
+	}
+	r->start = r->end = tag_end - didl->xml;
+	r->insert = 1;
+}
+
+struct didl *Didl_parse(const char *xml) {
+	if (xml == NULL)
+		return NULL;
+	struct didl *didl = calloc(1, sizeof(*didl));
+	didl->len = strlen(xml);
+	didl->xml = malloc(didl->len + 1);
+	memcpy(didl->xml, xml, didl->len + 1);
+	for (int f = 0; f < DIDL_FIELD_COUNT; ++f)
+		didl->range[f].start = -1;
+
+	struct ns_scope scope;
+	scope.count = 0;
+	int depth = 0;
+	int seen_didl = 0;
+	int item_depth = -1;     // Depth of the item we're in.
+	int seen_item = 0;
+	int open_field = -1;     // Field whose content we're in.
+	int ok = 1;
+
+	const char *const start = didl->xml;
+	const char *p = start;
+	while (ok && (p = strchr(p, '<')) != NULL) {
+		if (strncmp(p, "<!--", 4) == 0) {
+			p = strstr(p + 4, "-->");
+			ok = (p != NULL);
+			p = ok ? p + 3 : p;
+			continue;
+		}
+		if (strncmp(p, "<![CDATA[", 9) == 0) {
+			p = strstr(p + 9, "]]>");
+			ok = (p != NULL);
+			p = ok ? p + 3 : p;
+			continue;
+		}
+		if (p[1] == '?' || p[1] == '!') {
+			p = strchr(p, '>');
+			ok = (p != NULL);
+			p = ok ? p + 1 : p;
+			continue;
+		}
+		if (p[1] == '/') {
+			const char *close = strchr(p, '>');
+			if (close == NULL || depth == 0) {
+				ok = 0;
+				break;
+			}
+			if (open_field >= 0 && depth == item_depth + 1) {
+				didl->range[open_field].end = p - start;
+				open_field = -1;
+			}
+			if (depth == item_depth)
+				item_depth = -1;
+			ns_pop(&scope, depth);
+			depth--;
+			p = close + 1;
+			continue;
+		}
+
+		// Start tag.
+		const char *name = p + 1;
+		const int name_len = strcspn(name, " \t\r\n/>");
+		struct attribute attr[MAX_ATTRIBUTES];
+		int attr_count;
+		depth++;
+		const char *tag_end = parse_attributes(name + name_len, depth,
+						       &scope, attr,
+						       &attr_count);
+		const char *close = tag_end ? strchr(tag_end, '>') : NULL;
+		if (name_len == 0 || close == NULL) {
+			ok = 0;
+			break;
+		}
+		const int self_closing = (*tag_end == '/');
+
+		if (!seen_didl) {
+			ok = (depth == 1 && is_element(&scope, name, name_len,
+						       NS_DIDL, "DIDL-Lite"));
+			seen_didl = 1;
+		} else if (depth == 2 && !seen_item
+			   && (is_element(&scope, name, name_len,
+					  NS_DIDL, "item")
+			       || is_element(&scope, name, name_len,
+					     NS_DIDL, "container"))) {
+			seen_item = 1;
+			item_depth = self_closing ? -1 : depth;
+			find_attribute(didl, DIDL_ID, attr, attr_count,
+				       tag_end);
+			if (didl->range[DIDL_ID].insert) {
+				// Not ours to add.
+				didl->range[DIDL_ID].start = -1;
+				didl->range[DIDL_ID].insert = 0;
+			}
+		} else if (depth == item_depth + 1 && open_field < 0) {
+			for (int f = DIDL_ID + 1; f < DIDL_FIELD_COUNT; ++f) {
+				struct didl_range *r = &didl->range[f];
+				if (r->start >= 0
+				    || !is_element(&scope, name, name_len,
+						   kFields[f].ns,
+						   kFields[f].element))
+					continue;
+				if (kFields[f].attribute != NULL) {
+					find_attribute(didl, f, attr,
+						       attr_count, tag_end);
+					continue;
+				}
+				r->qname = name - start;
+				r->qname_len = name_len;
+				r->self_closing = self_closing;
+				if (self_closing) {
+					r->start = tag_end - start;
+					r->end = r->start + 1;
+				} else {
+					r->start = close + 1 - start;
+					open_field = f;
+				}
+				break;
+			}
+		}
+		if (self_closing) {
+			ns_pop(&scope, depth);
+			depth--;
+		}
+		p = close + 1;
+	}
+	if (open_field >= 0)
+		didl->range[open_field].start = -1;  // Never closed.
+
+	if (!ok || !seen_item) {
+		Didl_delete(didl);
+		return NULL;
+	}
+	return didl;
+}
+
+void Didl_delete(struct didl *didl) {
+	if (didl == NULL)
+		return;
+	for (int f = 0; f < DIDL_FIELD_COUNT; ++f)
+		free(didl->value[f]);
+	free(didl->xml);
+	free(didl);
+}
+
+// Append the UTF-8 encoding of the given code point.
+static char *append_utf8(char *out, uint32_t c) {
+	if (c < 0x80) {
+		*out++ = c;
+	} else if (c < 0x800) {
+		*out++ = 0xc0 | (c >> 6);
+		*out++ = 0x80 | (c & 0x3f);
+	} else if (c < 0x10000) {
+		*out++ = 0xe0 | (c >> 12);
+		*out++ = 0x80 | ((c >> 6) & 0x3f);
+		*out++ = 0x80 | (c & 0x3f);
+	} else if (c < 0x110000) {
+		*out++ = 0xf0 | (c >> 18);
+		*out++ = 0x80 | ((c >> 12) & 0x3f);
+		*out++ = 0x80 | ((c >> 6) & 0x3f);
+		*out++ = 0x80 | (c & 0x3f);
+	}
+	return out;
+}
+
+// Returns newly allocated text content with entities and CDATA sections
+// resolved. Unknown entities are kept as they are.
+static char *xml_unescape(const char *in, int len) {
+#define ENTITY_COUNT 5
+	static const struct { const char *entity; char c; } kEntities[] = {
+		{ "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' },
+		{ "&quot;", '"' }, { "&apos;", '\'' },
+	};
+	const char *const end = in + len;
+	char *result = malloc(len + 1);
+	char *out = result;
+	while (in < end) {
+		if (*in == '<' && end - in >= 12
+		    && strncmp(in, "<![CDATA[", 9) == 0) {
+			const char *cdata_end = strstr(in + 9, "]]>");
+			if (cdata_end == NULL || cdata_end >= end)
+				cdata_end = end;
+			memcpy(out, in + 9, cdata_end - in - 9);
+			out += cdata_end - in - 9;
+			in = cdata_end + 3;
+			continue;
+		}
+		if (*in != '&') {
+			*out++ = *in++;
+			continue;
+		}
+		const char *semicolon = memchr(in, ';', end - in);
+		int resolved = 0;
+		if (semicolon != NULL && in[1] == '#') {
+			char *num_end;
+			const unsigned long c = (in[2] == 'x' || in[2] == 'X')
+				? strtoul(in + 3, &num_end, 16)
+				: strtoul(in + 2, &num_end, 10);
+			if (num_end == semicolon && c > 0 && c < 0x110000) {
+				out = append_utf8(out, c);
+				resolved = 1;
+			}
+		} else if (semicolon != NULL) {
+			for (int i = 0; i < ENTITY_COUNT; ++i) {
+				const int n = strlen(kEntities[i].entity);
+				if (semicolon + 1 - in == n
+				    && strncmp(in, kEntities[i].entity, n) == 0) {
+					*out++ = kEntities[i].c;
+					resolved = 1;
+					break;
+				}
+			}
+		}
+		if (resolved) {
+			in = semicolon + 1;
+		} else {
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+	return result;
+}
+
+char *Didl_get(const struct didl *didl, enum didl_field field) {
+	const struct didl_range *r = &didl->range[field];
+	if (r->start < 0)
+		return NULL;
+	if (didl->value[field] != NULL)
+		return xml_unescape(didl->value[field],
+				    strlen(didl->value[field]));
+	if (r->insert)
+		return NULL;
+	if (r->self_closing)
+		return strdup("");
+	return xml_unescape(didl->xml + r->start, r->end - r->start);
+}
+
+int Didl_set(struct didl *didl, enum didl_field field, const char *value) {
+	const struct didl_range *r = &didl->range[field];
+	if (r->start < 0 || value == NULL)
+		return 0;
+	char *escaped = xmlescape(value, kFields[field].attribute != NULL);
+	const int len = strlen(escaped);
+	int same;
+	if (didl->value[field] != NULL) {
+		same = (strcmp(escaped, didl->value[field]) == 0);
+	} else if (r->insert) {
+		same = 0;
+	} else if (r->self_closing) {
+		same = (len == 0);
+	} else {
+		same = (len == r->end - r->start
+			&& strncmp(escaped, didl->xml + r->start, len) == 0);
+	}
+	if (same) {
+		free(escaped);
+		return 0;
+	}
+	free(didl->value[field]);
+	didl->value[field] = escaped;
+	return 1;
+}
+
+char *Didl_serialize(const struct didl *didl) {
+	// Changed fields in document order.
+	int order[DIDL_FIELD_COUNT];
+	int count = 0;
+	int total = didl->len;
+	for (int f = 0; f < DIDL_FIELD_COUNT; ++f) {
+		const struct didl_range *r = &didl->range[f];
+		if (didl->value[f] == NULL)
+			continue;
+		int i = count++;
+		for (/**/; i > 0 && didl->range[order[i-1]].start > r->start; --i)
+			order[i] = order[i-1];
+		order[i] = f;
+		total += strlen(didl->value[f]) - (r->end - r->start);
+		if (r->self_closing)
+			total += strlen("></") + r->qname_len;
+		if (r->insert)
+			total += strlen(" =\"\"")
+				+ strlen(kFields[f].attribute);
+	}
+
+	char *result = malloc(total + 1);
+	char *out = result;
+	int pos = 0;
+	for (int i = 0; i < count; ++i) {
+		const struct didl_range *r = &didl->range[order[i]];
+		const char *value = didl->value[order[i]];
+		memcpy(out, didl->xml + pos, r->start - pos);
+		out += r->start - pos;
+		if (r->self_closing)
+			*out++ = '>';
+		if (r->insert) {
+			const char *name = kFields[order[i]].attribute;
+			*out++ = ' ';
+			memcpy(out, name, strlen(name));
+			out += strlen(name);
+			memcpy(out, "=\"", 2);
+			out += 2;
+		}
+		const int len = strlen(value);
+		memcpy(out, value, len);
+		out += len;
+		if (r->self_closing) {
+			memcpy(out, "</", 2);
+			memcpy(out + 2, didl->xml + r->qname, r->qname_len);
+			out += 2 + r->qname_len;
+		}
+		if (r->insert)
+			*out++ = '"';
+		pos = r->end;
+	}
+	memcpy(out, didl->xml + pos, didl->len - pos);
+	out += didl->len - pos;
+	*out = '\0';
+	return result;
+}
@@ -0,0 +1,71 @@
+/* didl.h - Edit DIDL-Lite meta data documents
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ * -----------------
+ *
+ * A DIDL-Lite document, scanned once into a table with the location of
+ * the fields we care about. Fields are matched by namespace, not by the
+ * conventional "dc:" and "upnp:" prefixes (which are only assumed if a
+ * sloppy controller does not declare them). Changing a field only records
+ * the new value; the document is re-assembled in a single pass when
+ * serialized, so everything else stays exactly as the control point sent
+ * it.
+ */
+
+#ifndef _DIDL_H
+#define _DIDL_H
+
+enum didl_field {
+	DIDL_ID,          // id attribute of the item (or container).
+	DIDL_TITLE,       // dc:title
+	DIDL_ARTIST,      // upnp:artist
+	DIDL_ALBUM,       // upnp:album
+	DIDL_GENRE,       // upnp:genre
+	DIDL_CREATOR,     // upnp:creator
+	// Attributes of the first <res>; added if not there yet.
+	DIDL_RES_BITRATE,
+	DIDL_RES_SAMPLE_FREQUENCY,
+	DIDL_RES_DURATION,
+	DIDL_FIELD_COUNT
+};
+
+struct didl;
+
+// Parse the first item of the given DIDL-Lite document; for playlists,
+// this is a container instead. Returns NULL if this is not a DIDL-Lite
+// document with an item or container.
+struct didl *Didl_parse(const char *xml);
+void Didl_delete(struct didl *didl);
+
+// Returns a newly allocated, unescaped copy of the field value or NULL if
+// the document does not have this field.
+char *Didl_get(const struct didl *didl, enum didl_field field);
+
+// Set field to the given (unescaped) value. Elements that are not in the
+// document are not added, <res> attributes are. Returns 1 if this changed
+// the document.
+int Didl_set(struct didl *didl, enum didl_field field, const char *value);
+
+// Returns newly allocated xml of the document with all changes applied.
+char *Didl_serialize(const struct didl *didl);
+
+#endif /* _DIDL_H */
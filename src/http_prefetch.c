@@ -0,0 +1,491 @@
+/* http_prefetch.c - Fetch HTTP resources over parallel range requests
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "http_prefetch.h"
+
+// Size of a single range request. Large enough that the request round-trip
+// is small compared to the transfer, small enough to get going quickly.
+#define CHUNK_SIZE (256 * 1024)
+
+// Number of chunks we fetch ahead of the reader, per connection.
+#define CHUNKS_PER_CONNECTION 4
+
+#define MAX_CONNECTIONS 8
+
+static const int kHttpTimeoutSec = 10;
+
+// A failed range request is retried that many times, with an increasing
+// delay, before the reader gets an error.
+static const int kFetchRetries = 3;
+static const int kRetryDelayMs = 500;
+
+enum chunk_state {
+	CHUNK_EMPTY,
+	CHUNK_FETCHING,
+	CHUNK_READY,
+	CHUNK_FAILED,
+};
+
+// A slot in the reorder window. Chunk n lives in slot n % window.
+struct chunk {
+	enum chunk_state state;
+	int64_t index;           // Chunk number this slot holds or fetches.
+	char *data;
+	size_t len;
+};
+
+struct http_prefetch {
+	char *uri;
+	int64_t length;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;     // Signalled on every state change.
+
+	int window;
+	struct chunk *chunks;
+
+	int64_t read_pos;        // Byte offset of the next read.
+	int64_t next_fetch;      // Next chunk to hand out to a worker.
+	unsigned generation;     // Incremented on each seek.
+	int cancelled;
+	int stop;
+
+	int worker_count;
+	pthread_t workers[MAX_CONNECTIONS];
+};
+
+static int64_t chunk_end(const struct http_prefetch *p, int64_t index) {
+	const int64_t end = (index + 1) * CHUNK_SIZE;
+	return end < p->length ? end : p->length;
+}
+
+// Split "http://host[:port]/path" into its parts. The authority is
+// "host[:port]" as in the URI, for the Host header.
+static int split_http_uri(const char *uri, char *authority, size_t auth_size,
+			  char *host, size_t host_size,
+			  char *port, size_t port_size, const char **path) {
+	const char *start = uri + strlen("http://");
+	const char *end = strchr(start, '/');
+	*path = end ? end : "/";
+	const size_t auth_len = end ? (size_t)(end - start) : strlen(start);
+	if (auth_len == 0 || auth_len >= auth_size)
+		return 0;
+	memcpy(authority, start, auth_len);
+	authority[auth_len] = '\0';
+
+	const char *host_start = authority;
+	const char *host_end;
+	const char *colon;
+	if (authority[0] == '[') {  // IPv6 literal.
+		++host_start;
+		host_end = strchr(authority, ']');
+		if (host_end == NULL)
+			return 0;
+		colon = (host_end[1] == ':') ? host_end + 1 : NULL;
+	} else {
+		colon = strrchr(authority, ':');
+		host_end = colon ? colon : authority + auth_len;
+	}
+	if ((size_t)(host_end - host_start) >= host_size)
+		return 0;
+	memcpy(host, host_start, host_end - host_start);
+	host[host_end - host_start] = '\0';
+	snprintf(port, port_size, "%s", colon ? colon + 1 : "80");
+	return 1;
+}
+
+static int connect_to(const char *host, const char *port) {
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addrs = NULL;
+	if (getaddrinfo(host, port, &hints, &addrs) != 0)
+		return -1;
+	int fd = -1;
+	for (struct addrinfo *ai = addrs; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		// Also limits connect() on Linux.
+		struct timeval timeout = { kHttpTimeoutSec, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO,
+			   &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO,
+			   &timeout, sizeof(timeout));
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addrs);
+	return fd;
+}
+
+// The response header of a range request, and the first bytes of the
+// body that were read along with it.
+struct range_response {
+	int fd;
+	char buffer[4096];
+	size_t header_len;
+	size_t len;
+};
+
+// Request bytes [from, to] of the resource and read the response header.
+// We don't go through libupnp here, as its HTTP client only handles int
+// offsets and lengths, which overflow for files larger than 2GB. Returns
+// the connection, positioned in the body, or -1 if the server didn't
+// answer with a plain 206 Partial Content for the range we asked for.
+static int open_range(const char *uri, int64_t from, int64_t to,
+		      struct range_response *r) {
+	char authority[256], host[256], port[8];
+	const char *path;
+	if (!split_http_uri(uri, authority, sizeof(authority),
+			    host, sizeof(host), port, sizeof(port), &path))
+		return -1;
+	r->fd = connect_to(host, port);
+	if (r->fd < 0)
+		return -1;
+
+	char *request = NULL;
+	const int request_len = asprintf(&request,
+					 "GET %s HTTP/1.1\r\n"
+					 "Host: %s\r\n"
+					 "Range: bytes=%lld-%lld\r\n"
+					 "Connection: close\r\n\r\n",
+					 path, authority,
+					 (long long) from, (long long) to);
+	int ok = (request_len > 0
+		  && write(r->fd, request, request_len) == request_len);
+	free(request);
+
+	const char *header_end = NULL;
+	r->len = 0;
+	while (ok && header_end == NULL && r->len < sizeof(r->buffer) - 1) {
+		const ssize_t got = read(r->fd, r->buffer + r->len,
+					 sizeof(r->buffer) - 1 - r->len);
+		if (got <= 0)
+			break;
+		r->len += got;
+		r->buffer[r->len] = '\0';
+		header_end = strstr(r->buffer, "\r\n\r\n");
+	}
+	if (header_end == NULL) {
+		close(r->fd);
+		return -1;
+	}
+	r->header_len = header_end + 4 - r->buffer;
+	// Keep the last line break, so that all header lines start with one.
+	r->buffer[r->header_len - 2] = '\0';
+
+	int http_status = 0;
+	const char *range = strcasestr(r->buffer, "\r\nContent-Range:");
+	long long first = -1;
+	if (sscanf(r->buffer, "HTTP/%*d.%*d %d", &http_status) != 1
+	    || http_status != 206
+	    || range == NULL
+	    || sscanf(range + strlen("\r\nContent-Range:"),
+		      " bytes %lld-", &first) != 1
+	    || first != from
+	    || strcasestr(r->buffer, "\r\nTransfer-Encoding:") != NULL) {
+		close(r->fd);
+		return -1;
+	}
+	return r->fd;
+}
+
+// Get length of the resource and check that the server supports ranges,
+// with a single request for the first byte: a 206 response has the total
+// length in its Content-Range header.
+static int64_t probe_length(const char *uri) {
+	struct range_response r;
+	if (open_range(uri, 0, 0, &r) < 0)
+		return -1;
+	close(r.fd);
+	const char *range = strcasestr(r.buffer, "\r\nContent-Range:");
+	long long length = -1;
+	if (sscanf(range + strlen("\r\nContent-Range:"),
+		   " bytes %*d-%*d/%lld", &length) != 1)
+		return -1;
+	return length > 0 ? length : -1;
+}
+
+// Fetch bytes [from, to) into a newly allocated buffer. Returns number of
+// bytes fetched or -1 on error.
+static int fetch_range(const char *uri, int64_t from, int64_t to,
+		       char **result) {
+	struct range_response r;
+	if (open_range(uri, from, to - 1, &r) < 0) {
+		Log_error("prefetch", "Range %lld-%lld of '%s' failed",
+			  (long long) from, (long long) to - 1, uri);
+		return -1;
+	}
+	const size_t want = to - from;
+	char *buffer = malloc(want);
+	size_t got = r.len - r.header_len;
+	if (got > want)
+		got = want;
+	memcpy(buffer, r.buffer + r.header_len, got);
+	while (got < want) {
+		const ssize_t len = read(r.fd, buffer + got, want - got);
+		if (len <= 0)
+			break;
+		got += len;
+	}
+	close(r.fd);
+	if (got < want) {
+		Log_error("prefetch", "Short read in range %lld-%lld of '%s' "
+			  "(%zu of %zu bytes)", (long long) from,
+			  (long long) to - 1, uri, got, want);
+		free(buffer);
+		return -1;
+	}
+	*result = buffer;
+	return got;
+}
+
+// Find the next chunk within the window that nobody has fetched yet and
+// claim it. Returns the chunk index or -1 if there is nothing to do.
+// Called with mutex held.
+static int64_t claim_chunk(struct http_prefetch *p) {
+	const int64_t first = p->read_pos / CHUNK_SIZE;
+	if (p->next_fetch < first)
+		p->next_fetch = first;
+	struct chunk *c;
+	for (;;) {
+		if (p->next_fetch >= first + p->window
+		    || p->next_fetch * CHUNK_SIZE >= p->length)
+			return -1;
+		c = &p->chunks[p->next_fetch % p->window];
+		if (c->state != CHUNK_READY || c->index != p->next_fetch)
+			break;
+		p->next_fetch++;  // Kept across a seek.
+	}
+	if (c->state == CHUNK_FETCHING)
+		return -1;  // Still busy with a chunk from before a seek.
+	free(c->data);
+	c->data = NULL;
+	c->len = 0;
+	c->state = CHUNK_FETCHING;
+	c->index = p->next_fetch;
+	return p->next_fetch++;
+}
+
+static void *fetch_worker(void *arg) {
+	struct http_prefetch *p = arg;
+	pthread_mutex_lock(&p->mutex);
+	while (!p->stop) {
+		const int64_t index = claim_chunk(p);
+		if (index < 0) {
+			pthread_cond_wait(&p->cond, &p->mutex);
+			continue;
+		}
+		const unsigned generation = p->generation;
+		pthread_mutex_unlock(&p->mutex);
+
+		char *data = NULL;
+		int len = fetch_range(p->uri, index * CHUNK_SIZE,
+				      chunk_end(p, index), &data);
+		for (int retry = 1; len < 0 && retry <= kFetchRetries;
+		     ++retry) {
+			usleep(retry * kRetryDelayMs * 1000);
+			pthread_mutex_lock(&p->mutex);
+			const int wanted = (!p->stop
+					    && generation == p->generation);
+			pthread_mutex_unlock(&p->mutex);
+			if (!wanted)
+				break;
+			Log_info("prefetch", "Retrying chunk %lld of '%s' (%d/%d)",
+				 (long long) index, p->uri, retry,
+				 kFetchRetries);
+			len = fetch_range(p->uri, index * CHUNK_SIZE,
+					  chunk_end(p, index), &data);
+		}
+
+		pthread_mutex_lock(&p->mutex);
+		struct chunk *c = &p->chunks[index % p->window];
+		if (generation == p->generation) {
+			c->data = data;
+			c->len = len < 0 ? 0 : len;
+			c->state = len < 0 ? CHUNK_FAILED : CHUNK_READY;
+		} else {
+			// Seeked away while fetching; nobody wants this.
+			free(data);
+			c->state = CHUNK_EMPTY;
+		}
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+struct http_prefetch *HttpPrefetch_open(const char *uri, int connections) {
+	if (strncmp(uri, "http://", strlen("http://")) != 0)
+		return NULL;
+	const int64_t length = probe_length(uri);
+	if (length < 0) {
+		Log_info("prefetch", "'%s' does not support range requests; "
+			 "not prefetching.", uri);
+		return NULL;
+	}
+	if (connections > MAX_CONNECTIONS)
+		connections = MAX_CONNECTIONS;
+
+	struct http_prefetch *p = calloc(1, sizeof(*p));
+	p->uri = strdup(uri);
+	p->length = length;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	p->window = connections * CHUNKS_PER_CONNECTION;
+	p->chunks = calloc(p->window, sizeof(*p->chunks));
+	for (int i = 0; i < p->window; ++i)
+		p->chunks[i].index = -1;
+	for (int i = 0; i < connections; ++i) {
+		if (pthread_create(&p->workers[i], NULL, fetch_worker, p) != 0)
+			break;
+		p->worker_count++;
+	}
+	if (p->worker_count == 0) {
+		HttpPrefetch_delete(p);
+		return NULL;
+	}
+	Log_info("prefetch", "Fetching '%s' (%lld bytes) with %d connections",
+		 uri, (long long) length, p->worker_count);
+	return p;
+}
+
+void HttpPrefetch_delete(struct http_prefetch *p) {
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	p->cancelled = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	for (int i = 0; i < p->worker_count; ++i)
+		pthread_join(p->workers[i], NULL);
+
+	for (int i = 0; i < p->window; ++i)
+		free(p->chunks[i].data);
+	free(p->chunks);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p->uri);
+	free(p);
+}
+
+int64_t HttpPrefetch_length(const struct http_prefetch *p) {
+	return p->length;
+}
+
+int HttpPrefetch_read(struct http_prefetch *p,
+		      char *buffer, size_t len, int64_t *offset) {
+	int result = -1;
+	pthread_mutex_lock(&p->mutex);
+	while (!p->cancelled) {
+		if (p->read_pos >= p->length) {
+			*offset = p->read_pos;
+			result = 0;
+			break;
+		}
+		const int64_t index = p->read_pos / CHUNK_SIZE;
+		struct chunk *c = &p->chunks[index % p->window];
+		if (c->index != index || c->state == CHUNK_FETCHING
+		    || c->state == CHUNK_EMPTY) {
+			pthread_cond_wait(&p->cond, &p->mutex);
+			continue;
+		}
+		if (c->state == CHUNK_FAILED) {
+			Log_error("prefetch", "Giving up on '%s' at %lld",
+				  p->uri, (long long) p->read_pos);
+			break;
+		}
+		const size_t pos = p->read_pos - index * CHUNK_SIZE;
+		if (len > c->len - pos)
+			len = c->len - pos;
+		memcpy(buffer, c->data + pos, len);
+		*offset = p->read_pos;
+		p->read_pos += len;
+		if (pos + len == c->len) {
+			// Done with this chunk: make room for the next one.
+			free(c->data);
+			c->data = NULL;
+			c->state = CHUNK_EMPTY;
+			pthread_cond_broadcast(&p->cond);
+		}
+		result = len;
+		break;
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return result;
+}
+
+void HttpPrefetch_seek(struct http_prefetch *p, int64_t offset) {
+	pthread_mutex_lock(&p->mutex);
+	if (offset > p->length)
+		offset = p->length;
+	const int64_t first = offset / CHUNK_SIZE;
+	p->read_pos = offset;
+	p->next_fetch = first;
+	p->generation++;  // Requests in flight are dropped when they finish.
+	for (int i = 0; i < p->window; ++i) {
+		struct chunk *c = &p->chunks[i];
+		if (c->state == CHUNK_FETCHING)
+			continue;
+		if (c->state == CHUNK_READY
+		    && c->index >= first && c->index < first + p->window)
+			continue;  // Still useful at the new position.
+		free(c->data);
+		c->data = NULL;
+		c->state = CHUNK_EMPTY;
+		c->index = -1;
+	}
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+void HttpPrefetch_cancel(struct http_prefetch *p) {
+	pthread_mutex_lock(&p->mutex);
+	p->cancelled = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
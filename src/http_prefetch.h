@@ -0,0 +1,67 @@
+/* http_prefetch.h - Fetch HTTP resources over parallel range requests
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * On links with a high round-trip time, a single TCP connection can't
+ * keep up with hi-res audio. This fetches the upcoming chunks of a file
+ * with several connections in parallel, each requesting a byte range,
+ * and hands them out in order from a small reorder window.
+ *
+ * Only works for resources with known length on servers that support
+ * range requests; live streams are left to the regular source.
+ */
+
+#ifndef _HTTP_PREFETCH_H
+#define _HTTP_PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct http_prefetch;
+
+// Open the given http:// URI with the given number of parallel
+// connections. Returns NULL if the resource can't be fetched in ranges.
+struct http_prefetch *HttpPrefetch_open(const char *uri, int connections);
+
+// Stops all fetching and frees the object. Must not be called while
+// another thread is still in HttpPrefetch_read().
+void HttpPrefetch_delete(struct http_prefetch *prefetch);
+
+// Total length of the resource in bytes.
+int64_t HttpPrefetch_length(const struct http_prefetch *prefetch);
+
+// Read the next bytes at the current position, blocking until they are
+// available. Stores the offset of the returned data in *offset. Returns
+// number of bytes read, 0 at the end and -1 on error (a chunk still
+// failed after a few retries) or if cancelled.
+int HttpPrefetch_read(struct http_prefetch *prefetch,
+		      char *buffer, size_t len, int64_t *offset);
+
+// Continue reading at the given offset. Can be called from another thread
+// while a read is blocked; that read then returns data from the new
+// position.
+void HttpPrefetch_seek(struct http_prefetch *prefetch, int64_t offset);
+
+// Make blocked and future reads return -1.
+void HttpPrefetch_cancel(struct http_prefetch *prefetch);
+
+#endif /* _HTTP_PREFETCH_H */
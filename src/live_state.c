@@ -0,0 +1,371 @@
+/* live_state.c - JSON state of the renderer and stream of changes over HTTP
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "bitset.h"
+#include "live_state.h"
+#include "logging.h"
+#include "upnp_control.h"
+#include "upnp_service.h"
+#include "upnp_transport.h"
+#include "variable-container.h"
+#include "webserver.h"
+
+#define STATE_PATH "/upnp/state.json"
+#define EVENTS_PATH "/upnp/state-events"
+
+// Number of recent changes kept for clients that are a bit behind. Clients
+// further behind get a new snapshot instead.
+#define HISTORY_SIZE 64
+
+// Each connected stream blocks one of the libupnp worker threads, so only
+// allow a few of them.
+#define MAX_STREAMS 4
+
+// If nothing changes, send a comment in this interval so that we notice
+// when the client went away.
+#define KEEPALIVE_SEC 15
+
+// Time in milliseconds clients should wait before reconnecting.
+#define RECONNECT_MS 2000
+
+#define MAX_SERVICES 2
+
+struct state_service {
+	const char *name;
+	int var_count;
+	const char **var_names;   // NULL for variables we don't publish.
+	char **values;
+};
+
+struct change {
+	unsigned long seq;
+	int service;              // Index in services_.
+	int var_num;
+	char *event;              // Formatted Server-Sent Event.
+};
+
+struct stream {
+	unsigned long seq;        // Last change sent to this client.
+	GString *pending;         // Output not yet read.
+	size_t pending_pos;
+	// Variables per service the client asked for with ?vars=...; NULL if
+	// it wants all.
+	struct bitset **vars;
+};
+
+static pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed_ = PTHREAD_COND_INITIALIZER;
+static struct state_service services_[MAX_SERVICES];
+static int service_count_ = 0;
+static struct change history_[HISTORY_SIZE];
+static unsigned long last_seq_ = 0;
+static int open_streams_ = 0;
+
+static void append_json_string(GString *out, const char *str) {
+	g_string_append_c(out, '"');
+	for (const unsigned char *p = (const unsigned char*) str; *p; ++p) {
+		switch (*p) {
+		case '"':  g_string_append(out, "\\\""); break;
+		case '\\': g_string_append(out, "\\\\"); break;
+		case '\n': g_string_append(out, "\\n"); break;
+		case '\r': g_string_append(out, "\\r"); break;
+		case '\t': g_string_append(out, "\\t"); break;
+		default:
+			if (*p < 0x20)
+				g_string_append_printf(out, "\\u%04x", *p);
+			else
+				g_string_append_c(out, *p);
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+static int is_wanted(struct bitset **vars, int service, int var_num) {
+	return vars == NULL || Bitset_test(vars[service], var_num);
+}
+
+// Append the state of all services as JSON object, limited to the given
+// variables (see struct stream). Needs mutex_ held.
+static void append_snapshot(GString *out, struct bitset **vars) {
+	g_string_append_c(out, '{');
+	for (int s = 0; s < service_count_; ++s) {
+		const struct state_service *service = &services_[s];
+		if (s > 0) g_string_append_c(out, ',');
+		append_json_string(out, service->name);
+		g_string_append(out, ":{");
+		int first = 1;
+		for (int i = 0; i < service->var_count; ++i) {
+			if (service->var_names[i] == NULL
+			    || !is_wanted(vars, s, i))
+				continue;
+			if (!first) g_string_append_c(out, ',');
+			first = 0;
+			append_json_string(out, service->var_names[i]);
+			g_string_append_c(out, ':');
+			append_json_string(out, service->values[i]);
+		}
+		g_string_append_c(out, '}');
+	}
+	g_string_append_c(out, '}');
+}
+
+static void variable_changed(void *userdata,
+			     int var_num, const char *var_name,
+			     const char *old_value, const char *new_value) {
+	(void)old_value;
+	struct state_service *service = (struct state_service*) userdata;
+	if (var_num < 0 || var_num >= service->var_count
+	    || service->var_names[var_num] == NULL)
+		return;
+
+	pthread_mutex_lock(&mutex_);
+	free(service->values[var_num]);
+	service->values[var_num] = strdup(new_value);
+
+	++last_seq_;
+	GString *event = g_string_new(NULL);
+	g_string_append_printf(event, "id: %lu\nevent: %s\ndata: {",
+			       last_seq_, service->name);
+	append_json_string(event, var_name);
+	g_string_append_c(event, ':');
+	append_json_string(event, new_value);
+	g_string_append(event, "}\n\n");
+
+	struct change *change = &history_[last_seq_ % HISTORY_SIZE];
+	g_free(change->event);
+	change->seq = last_seq_;
+	change->service = service - services_;
+	change->var_num = var_num;
+	change->event = g_string_free(event, FALSE);
+	pthread_cond_broadcast(&changed_);
+	pthread_mutex_unlock(&mutex_);
+}
+
+static void add_service(const char *name, struct service *srv) {
+	struct state_service *service = &services_[service_count_++];
+	variable_container_t *container = srv->variable_container;
+
+	ithread_mutex_lock(srv->service_mutex);
+	service->name = name;
+	service->var_count = VariableContainer_get_num_vars(container);
+	service->var_names = (const char**)
+		calloc(service->var_count, sizeof(const char*));
+	service->values = (char**) calloc(service->var_count, sizeof(char*));
+	for (int i = 0; i < service->var_count; ++i) {
+		const char *var_name;
+		const char *value = VariableContainer_get(container, i,
+							  &var_name);
+		// LastChange only repeats the others; A_ARG_TYPE variables
+		// have no state.
+		if (value == NULL || strcmp(var_name, "LastChange") == 0
+		    || strncmp(var_name, "A_ARG_TYPE_",
+			       strlen("A_ARG_TYPE_")) == 0)
+			continue;
+		service->var_names[i] = var_name;
+		service->values[i] = strdup(value);
+	}
+	// Registering while holding the service lock, so we don't miss any
+	// change.
+	VariableContainer_register_callback(container, variable_changed,
+					    service);
+	ithread_mutex_unlock(srv->service_mutex);
+}
+
+static char *generate_state(void) {
+	GString *json = g_string_new(NULL);
+	pthread_mutex_lock(&mutex_);
+	append_snapshot(json, NULL);
+	pthread_mutex_unlock(&mutex_);
+	g_string_append_c(json, '\n');
+	char *result = strdup(json->str);
+	g_string_free(json, TRUE);
+	return result;
+}
+
+// Needs mutex_ held.
+static void append_snapshot_event(struct stream *stream) {
+	g_string_append_printf(stream->pending,
+			       "id: %lu\nevent: snapshot\ndata: ", last_seq_);
+	append_snapshot(stream->pending, stream->vars);
+	g_string_append(stream->pending, "\n\n");
+	stream->seq = last_seq_;
+}
+
+// Parse "vars=Name1,Name2" out of the query into a set of variables per
+// service. Returns NULL if there is no such parameter. The services don't
+// change after live_state_init(), so this needs no lock.
+static struct bitset **parse_vars(const char *query) {
+	if (query == NULL)
+		return NULL;
+	gchar **params = g_strsplit(query, "&", -1);
+	struct bitset **vars = NULL;
+	for (gchar **param = params; *param; ++param) {
+		if (strncmp(*param, "vars=", strlen("vars=")) != 0)
+			continue;
+		if (vars == NULL) {
+			vars = (struct bitset**)
+				calloc(service_count_, sizeof(*vars));
+			for (int s = 0; s < service_count_; ++s)
+				vars[s] = Bitset_new(services_[s].var_count);
+		}
+		gchar **names = g_strsplit(*param + strlen("vars="), ",", -1);
+		for (gchar **name = names; *name; ++name) {
+			int found = 0;
+			for (int s = 0; s < service_count_; ++s) {
+				const struct state_service *service =
+					&services_[s];
+				for (int i = 0; i < service->var_count; ++i) {
+					if (service->var_names[i] != NULL
+					    && strcmp(service->var_names[i],
+						      *name) == 0) {
+						Bitset_set(vars[s], i);
+						found = 1;
+					}
+				}
+			}
+			if (!found && **name) {
+				Log_error("live-state", "%s: unknown state "
+					  "variable '%s'", EVENTS_PATH, *name);
+			}
+		}
+		g_strfreev(names);
+	}
+	g_strfreev(params);
+	return vars;
+}
+
+static void free_vars(struct bitset **vars) {
+	if (vars == NULL)
+		return;
+	for (int s = 0; s < service_count_; ++s)
+		Bitset_delete(vars[s]);
+	free(vars);
+}
+
+static void *stream_open(void *userdata, const char *query) {
+	(void)userdata;
+	struct bitset **vars = parse_vars(query);
+	pthread_mutex_lock(&mutex_);
+	if (open_streams_ >= MAX_STREAMS) {
+		pthread_mutex_unlock(&mutex_);
+		Log_error("live-state", "Too many clients on %s (max %d).",
+			  EVENTS_PATH, MAX_STREAMS);
+		free_vars(vars);
+		return NULL;
+	}
+	++open_streams_;
+	struct stream *stream = (struct stream*) malloc(sizeof(*stream));
+	stream->pending = g_string_new(NULL);
+	stream->pending_pos = 0;
+	stream->vars = vars;
+	g_string_append_printf(stream->pending, "retry: %d\n", RECONNECT_MS);
+	append_snapshot_event(stream);
+	pthread_mutex_unlock(&mutex_);
+	return stream;
+}
+
+// Wait for changes the client is interested in and format them into the
+// pending output.
+static void fill_pending(struct stream *stream) {
+	g_string_truncate(stream->pending, 0);
+	stream->pending_pos = 0;
+
+	pthread_mutex_lock(&mutex_);
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += KEEPALIVE_SEC;
+	while (stream->pending->len == 0) {
+		if (stream->seq == last_seq_) {
+			if (pthread_cond_timedwait(&changed_, &mutex_,
+						   &deadline) == ETIMEDOUT
+			    && stream->seq == last_seq_) {
+				g_string_append(stream->pending,
+						": keep-alive\n\n");
+			}
+			continue;
+		}
+		if (last_seq_ - stream->seq > HISTORY_SIZE) {
+			append_snapshot_event(stream);  // Too far behind.
+			continue;
+		}
+		for (unsigned long seq = stream->seq + 1; seq <= last_seq_;
+		     ++seq) {
+			const struct change *change =
+				&history_[seq % HISTORY_SIZE];
+			if (is_wanted(stream->vars, change->service,
+				      change->var_num))
+				g_string_append(stream->pending,
+						change->event);
+		}
+		stream->seq = last_seq_;
+	}
+	pthread_mutex_unlock(&mutex_);
+}
+
+static int stream_read(void *handle, char *buf, size_t len) {
+	struct stream *stream = (struct stream*) handle;
+	if (stream->pending_pos >= stream->pending->len)
+		fill_pending(stream);
+	size_t available = stream->pending->len - stream->pending_pos;
+	if (len > available)
+		len = available;
+	memcpy(buf, stream->pending->str + stream->pending_pos, len);
+	stream->pending_pos += len;
+	return len;
+}
+
+static void stream_close(void *handle) {
+	struct stream *stream = (struct stream*) handle;
+	g_string_free(stream->pending, TRUE);
+	free_vars(stream->vars);
+	free(stream);
+	pthread_mutex_lock(&mutex_);
+	--open_streams_;
+	pthread_mutex_unlock(&mutex_);
+}
+
+static const struct webserver_handler stream_handler = {
+	stream_open,
+	stream_read,
+	stream_close,
+};
+
+void live_state_init(void) {
+	add_service("transport", upnp_transport_get_service());
+	add_service("control", upnp_control_get_service());
+	webserver_register_generator(STATE_PATH, "application/json",
+				     generate_state);
+	webserver_register_handler(EVENTS_PATH, "text/event-stream",
+				   &stream_handler, NULL);
+}
@@ -0,0 +1,45 @@
+/* live_state.h - JSON state of the renderer and stream of changes over HTTP
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * Home automation and dashboards often poll the renderer with SOAP
+ * requests such as GetPositionInfo to follow its state, which is expensive
+ * on both sides. Instead, they can fetch the state variables of the
+ * AVTransport and RenderingControl services as one JSON document from
+ *   /upnp/state.json
+ * and follow changes as Server-Sent Events (EventSource in browsers) from
+ *   /upnp/state-events
+ * which first sends a "snapshot" event with the whole state, followed by
+ * one small JSON object per change, e.g.
+ *   id: 42
+ *   event: transport
+ *   data: {"TransportState":"PLAYING"}
+ */
+
+#ifndef _LIVE_STATE_H
+#define _LIVE_STATE_H
+
+// Start tracking the state variables and register the resources in the
+// webserver. Needs to be called after the services are initialized.
+void live_state_init(void);
+
+#endif /* _LIVE_STATE_H */
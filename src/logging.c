@@ -26,6 +26,8 @@
 #endif
 
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,8 +43,84 @@
 #include "config.h"
 #include "git-version.h"
 
+// Log records are not written by the calling thread - these are libupnp
+// workers and the GStreamer bus callback, which should not stall on a slow
+// log file. Callers format their message into a preallocated record of a
+// bounded lock-free multi-producer/single-consumer ring; a writer thread
+// picks up the records in order and writes them in batches with one writev().
+//
+// Each ring slot carries a sequence number telling whose turn it is: a
+// producer owns slot (pos % size) once it has claimed 'pos' and the slot's
+// sequence equals pos; it publishes the record by setting the sequence to
+// pos + 1. The writer hands the slot back by advancing the sequence to
+// pos + size. If the ring is full, the record is dropped and counted.
+// Sequence numbers are stored relative to the slot index, so that the
+// zero-initialized ring is ready to use before anyone ran any init code.
+#define LOG_RING_SIZE   512   // Power of two.
+#define LOG_INLINE_TEXT 200   // Longer messages are malloc()'ed.
+#define LOG_BATCH       64    // Records per writev().
+#define LOG_CATEGORY    24
+
+enum log_level {
+	LOG_LEVEL_OFF,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_INFO,
+};
+
+enum log_format {
+	LOG_FORMAT_TEXT,
+	LOG_FORMAT_JSON,   // One JSON object per line.
+};
+
+struct log_record {
+	unsigned long sequence;
+	int fd;
+	enum log_level level;
+	struct timeval time;
+	char category[LOG_CATEGORY];
+	size_t len;
+	char *long_text;   // NULL if message fits in 'text'.
+	char text[LOG_INLINE_TEXT];
+};
+
+enum writer_state {
+	WRITER_NONE,       // Not started (yet or again, after fork()).
+	WRITER_STARTING,
+	WRITER_RUNNING,
+	WRITER_STOPPED,    // Exiting or no thread: callers write themselves.
+};
+
+static struct log_record ring_[LOG_RING_SIZE];
+static unsigned long enqueue_pos_;
+static unsigned long dequeue_pos_;  // Only advanced by the writer.
+static unsigned long dropped_;
+
+static int writer_state_ = WRITER_NONE;
+static int writer_waiting_;
+static int writer_stop_;
+static int wake_pipe_[2] = { -1, -1 };
+static pthread_t writer_thread_;
+
 static int log_fd = -1;
 static int enable_color = 0;
+static enum log_format log_format_ = LOG_FORMAT_TEXT;
+
+// Rotation. The size is only looked at by whoever writes the records.
+static char *log_filename_ = NULL;  // NULL if not a regular file.
+static off_t log_size_ = 0;
+static off_t log_max_size_ = 0;     // 0: don't rotate.
+
+// Per-category levels. Set up once before any threads are started, so
+// reading them needs no locking.
+#define MAX_CATEGORY_LEVELS 32
+struct category_level {
+	char name[LOG_CATEGORY];
+	enum log_level level;
+};
+static struct category_level category_levels_[MAX_CATEGORY_LEVELS];
+static int category_level_count_ = 0;
+static enum log_level default_level_ = LOG_LEVEL_INFO;
+static enum log_level max_level_ = LOG_LEVEL_INFO;
 
 static const char *const kInfoHighlight  = "\033[1mINFO  ";
 static const char *const kErrorHighlight = "\033[1m\033[31mERROR ";
@@ -62,13 +140,19 @@ void Log_init(const char *filename) {
 		log_fd = 2;
 	} else {
 		log_fd = open(filename, O_CREAT|O_APPEND|O_WRONLY, 0644);
+		struct stat st;
+		if (log_fd >= 0 && fstat(log_fd, &st) == 0
+		    && S_ISREG(st.st_mode)) {
+			log_filename_ = strdup(filename);
+			log_size_ = st.st_size;
+		}
 	}
 
 	if (log_fd < 0) {
 		perror("Cannot open logfile");
 		return;
 	}
-	enable_color = isatty(log_fd);
+	enable_color = (log_format_ == LOG_FORMAT_TEXT) && isatty(log_fd);
 	if (enable_color) {
 		info_markup_start_ = kInfoHighlight;
 		error_markup_start_ = kErrorHighlight;
@@ -76,50 +160,522 @@ void Log_init(const char *filename) {
 	}
 }
 
+static int parse_level(const char *name, enum log_level *level) {
+	if (strcmp(name, "off") == 0) {
+		*level = LOG_LEVEL_OFF;
+	} else if (strcmp(name, "error") == 0) {
+		*level = LOG_LEVEL_ERROR;
+	} else if (strcmp(name, "info") == 0) {
+		*level = LOG_LEVEL_INFO;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+int Log_set_levels(const char *spec) {
+	char *copy = strdup(spec);
+	char *saveptr = NULL;
+	int ok = 1;
+	for (char *item = strtok_r(copy, ",", &saveptr); item && ok;
+	     item = strtok_r(NULL, ",", &saveptr)) {
+		char *equal = strchr(item, '=');
+		enum log_level level;
+		if (equal == NULL) {
+			ok = parse_level(item, &default_level_);
+			continue;
+		}
+		*equal = '\0';
+		ok = (equal - item) < LOG_CATEGORY
+			&& category_level_count_ < MAX_CATEGORY_LEVELS
+			&& parse_level(equal + 1, &level);
+		if (ok) {
+			struct category_level *entry
+				= &category_levels_[category_level_count_++];
+			strcpy(entry->name, item);
+			entry->level = level;
+		}
+	}
+	free(copy);
+
+	max_level_ = default_level_;
+	for (int i = 0; i < category_level_count_; ++i) {
+		if (category_levels_[i].level > max_level_)
+			max_level_ = category_levels_[i].level;
+	}
+	return ok;
+}
+
+int Log_set_format(const char *name) {
+	if (strcmp(name, "text") == 0) {
+		log_format_ = LOG_FORMAT_TEXT;
+	} else if (strcmp(name, "json") == 0) {
+		log_format_ = LOG_FORMAT_JSON;
+		enable_color = 0;
+		info_markup_start_ = "INFO  ";
+		error_markup_start_ = "ERROR ";
+		markup_end_ = "";
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+void Log_set_max_size(long bytes) { log_max_size_ = bytes; }
+
+static enum log_level category_level(const char *category) {
+	// Later entries override earlier ones.
+	for (int i = category_level_count_ - 1; i >= 0; --i) {
+		if (strcmp(category_levels_[i].name, category) == 0)
+			return category_levels_[i].level;
+	}
+	return default_level_;
+}
+
 int Log_color_allowed(void) { return enable_color; }
-int Log_info_enabled(void) { return log_fd >= 0; }
+int Log_info_enabled(void) {
+	return log_fd >= 0 && max_level_ >= LOG_LEVEL_INFO;
+}
+int Log_info_enabled_for(const char *category) {
+	return log_fd >= 0 && category_level(category) >= LOG_LEVEL_INFO;
+}
 int Log_error_enabled(void) { return 1; }
 
-static void Log_internal(int fd, const char *markup_start,
+// Format the "[date time.usec | category] " prefix of a record. Only the
+// writer calls this (or a caller writing directly, with its own cache), so
+// localtime_r()/strftime() only happen once per second.
+struct time_cache {
+	time_t second;
+	char formatted[32];
+};
+
+static int format_prefix(struct time_cache *cache, char *buf, size_t size,
+			 enum log_level level, const struct timeval *time,
+			 const char *category) {
+	if (time->tv_sec != cache->second) {
+		struct tm time_breakdown;
+		localtime_r(&time->tv_sec, &time_breakdown);
+		strftime(cache->formatted, sizeof(cache->formatted),
+			 "%F %T", &time_breakdown);
+		cache->second = time->tv_sec;
+	}
+	int len = snprintf(buf, size, "%s[%s.%06ld | %s]%s ",
+			   (level == LOG_LEVEL_ERROR
+			    ? error_markup_start_ : info_markup_start_),
+			   cache->formatted, (long) time->tv_usec,
+			   category, markup_end_);
+	return (len < (int) size) ? len : (int) size - 1;
+}
+
+static const char *record_text(const struct log_record *record) {
+	return record->long_text ? record->long_text : record->text;
+}
+
+// Append 'len' bytes of 'str' as JSON string contents.
+static char *json_escape(char *out, const char *str, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+	for (size_t i = 0; i < len; ++i) {
+		const unsigned char c = str[i];
+		switch (c) {
+		case '"':  *out++ = '\\'; *out++ = '"'; break;
+		case '\\': *out++ = '\\'; *out++ = '\\'; break;
+		case '\n': *out++ = '\\'; *out++ = 'n'; break;
+		case '\t': *out++ = '\\'; *out++ = 't'; break;
+		default:
+			if (c < 0x20) {
+				*out++ = '\\'; *out++ = 'u';
+				*out++ = '0'; *out++ = '0';
+				*out++ = hex[c >> 4]; *out++ = hex[c & 0xf];
+			} else {
+				*out++ = c;
+			}
+		}
+	}
+	return out;
+}
+
+// Append the record as one line of JSON. 'out' needs to have room for
+// json_line_size() bytes.
+static size_t json_line_size(const struct log_record *record) {
+	return 6 * (record->len + strlen(record->category)) + 128;
+}
+
+static char *json_line(char *out, const struct log_record *record) {
+	const char *text = record_text(record);
+	size_t len = record->len;
+	if (len > 0 && text[len - 1] == '\n')
+		--len;
+	out += sprintf(out, "{\"time\":%ld.%06ld,\"level\":\"%s\","
+		       "\"category\":\"",
+		       (long) record->time.tv_sec, (long) record->time.tv_usec,
+		       record->level == LOG_LEVEL_ERROR ? "error" : "info");
+	out = json_escape(out, record->category, strlen(record->category));
+	out += sprintf(out, "\",\"message\":\"");
+	out = json_escape(out, text, len);
+	out += sprintf(out, "\"}\n");
+	return out;
+}
+
+// Format the records in the configured format and write them with a
+// single writev(). At most LOG_BATCH + 1 records. Returns the number of
+// bytes written.
+static ssize_t write_records(int fd, const struct log_record *const *records,
+			     int count, struct time_cache *cache) {
+	struct iovec parts[3 * (LOG_BATCH + 1)];
+	char prefix[LOG_BATCH + 1][128];
+	int iov_count = 0;
+	char *json = NULL;
+
+	if (log_format_ == LOG_FORMAT_JSON) {
+		size_t size = 0;
+		for (int i = 0; i < count; ++i)
+			size += json_line_size(records[i]);
+		json = malloc(size);
+		if (json == NULL)
+			return -1;
+		char *end = json;
+		for (int i = 0; i < count; ++i)
+			end = json_line(end, records[i]);
+		parts[0].iov_base = json;
+		parts[0].iov_len = end - json;
+		iov_count = 1;
+	} else {
+		for (int i = 0; i < count; ++i) {
+			const struct log_record *record = records[i];
+			parts[iov_count].iov_base = prefix[i];
+			parts[iov_count].iov_len
+				= format_prefix(cache, prefix[i],
+						sizeof(prefix[i]),
+						record->level, &record->time,
+						record->category);
+			++iov_count;
+			const char *text = record_text(record);
+			parts[iov_count].iov_base = (void*) text;
+			parts[iov_count].iov_len = record->len;
+			++iov_count;
+			if (record->len == 0 || text[record->len - 1] != '\n') {
+				parts[iov_count].iov_base = (void*) "\n";
+				parts[iov_count].iov_len = 1;
+				++iov_count;
+			}
+		}
+	}
+
+	ssize_t written = writev(fd, parts, iov_count);
+	// Logging trouble is ignored.
+	free(json);
+	return written;
+}
+
+// Start a new log file once the current one exceeds the configured size.
+// The previous one is kept with a ".1" suffix.
+static void rotate_if_needed(void) {
+	if (log_max_size_ <= 0 || log_filename_ == NULL
+	    || log_size_ < log_max_size_)
+		return;
+	char *old_name = NULL;
+	if (asprintf(&old_name, "%s.1", log_filename_) < 0)
+		return;
+	if (rename(log_filename_, old_name) == 0) {
+		int fd = open(log_filename_, O_CREAT|O_APPEND|O_WRONLY, 0644);
+		if (fd >= 0) {
+			// Keep the fd number: queued records refer to it.
+			dup2(fd, log_fd);
+			close(fd);
+		}
+	}
+	free(old_name);
+	log_size_ = 0;  // Don't try again on every write if that failed.
+}
+
+static unsigned long load_sequence(unsigned long pos) {
+	const unsigned long slot = pos & (LOG_RING_SIZE - 1);
+	return __atomic_load_n(&ring_[slot].sequence, __ATOMIC_ACQUIRE) + slot;
+}
+
+static void store_sequence(unsigned long pos, unsigned long sequence) {
+	const unsigned long slot = pos & (LOG_RING_SIZE - 1);
+	__atomic_store_n(&ring_[slot].sequence, sequence - slot,
+			 __ATOMIC_SEQ_CST);
+}
+
+static int record_ready(unsigned long pos) {
+	return load_sequence(pos) == pos + 1;
+}
+
+// Write out the next batch of ready records, all going to the same fd.
+// Returns the number of records written. Only one thread at a time may
+// call this.
+static int write_batch(struct time_cache *cache) {
+	const struct log_record *batch[LOG_BATCH + 1];
+	unsigned long pos = dequeue_pos_;
+	int fd = -1;
+	int count = 0;
+	while (count < LOG_BATCH && record_ready(pos + count)) {
+		const struct log_record *record
+			= &ring_[(pos + count) & (LOG_RING_SIZE - 1)];
+		if (fd >= 0 && record->fd != fd)
+			break;
+		fd = record->fd;
+		batch[count++] = record;
+	}
+
+	unsigned long dropped = __atomic_exchange_n(&dropped_, 0,
+						    __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		// Report along with the batch, as if it was just logged.
+		static struct log_record dropped_record;
+		gettimeofday(&dropped_record.time, NULL);
+		dropped_record.level = LOG_LEVEL_ERROR;
+		strcpy(dropped_record.category, "logging");
+		dropped_record.len
+			= snprintf(dropped_record.text,
+				   sizeof(dropped_record.text),
+				   "%lu log messages dropped (log writer too "
+				   "slow)", dropped);
+		batch[count] = &dropped_record;
+		if (fd < 0)
+			fd = (log_fd < 0) ? STDERR_FILENO : log_fd;
+	}
+
+	if (count > 0 || dropped > 0) {
+		const ssize_t written = write_records(fd, batch,
+						      count + (dropped > 0),
+						      cache);
+		if (fd == log_fd && written > 0) {
+			log_size_ += written;
+			rotate_if_needed();
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		struct log_record *record
+			= &ring_[(pos + i) & (LOG_RING_SIZE - 1)];
+		free(record->long_text);
+		record->long_text = NULL;
+		store_sequence(pos + i, pos + i + LOG_RING_SIZE);
+	}
+	__atomic_store_n(&dequeue_pos_, pos + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+static void wait_for_records(void) {
+	// Announce that we're going to sleep, then check again: a producer
+	// either sees the flag and wakes us up, or we see its record.
+	__atomic_store_n(&writer_waiting_, 1, __ATOMIC_SEQ_CST);
+	if (!record_ready(dequeue_pos_)
+	    && !__atomic_load_n(&writer_stop_, __ATOMIC_SEQ_CST)) {
+		struct pollfd pfd = { wake_pipe_[0], POLLIN, 0 };
+		poll(&pfd, 1, 1000);
+	}
+	__atomic_store_n(&writer_waiting_, 0, __ATOMIC_SEQ_CST);
+	char buf[64];
+	while (read(wake_pipe_[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+static void *writer_loop(void *userdata) {
+	struct time_cache cache = { -1, "" };
+	for (;;) {
+		if (write_batch(&cache) > 0)
+			continue;
+		if (__atomic_load_n(&writer_stop_, __ATOMIC_SEQ_CST)
+		    && !record_ready(dequeue_pos_))
+			break;
+		wait_for_records();
+	}
+	return NULL;
+}
+
+static void wake_writer(int force) {
+	if ((force || __atomic_load_n(&writer_waiting_, __ATOMIC_SEQ_CST))
+	    && write(wake_pipe_[1], "", 1) < 0) {
+		// Pipe full: writer is woken up anyway.
+	}
+}
+
+// Write all remaining records on this thread. Only to be called if there is
+// no writer thread.
+static void write_remaining(void) {
+	struct time_cache cache = { -1, "" };
+	while (write_batch(&cache) > 0)
+		;
+}
+
+// Wait until the writer has caught up with everything queued so far.
+static void drain_queue(void) {
+	unsigned long until = __atomic_load_n(&enqueue_pos_, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < 1000; ++i) {
+		if ((long) (__atomic_load_n(&dequeue_pos_, __ATOMIC_ACQUIRE)
+			    - until) >= 0)
+			return;
+		wake_writer(1);
+		usleep(1000);
+	}
+}
+
+static void stop_writer(void) {
+	if (__atomic_load_n(&writer_state_, __ATOMIC_ACQUIRE) != WRITER_RUNNING)
+		return;
+	__atomic_store_n(&writer_stop_, 1, __ATOMIC_SEQ_CST);
+	wake_writer(1);
+	pthread_join(writer_thread_, NULL);
+	__atomic_store_n(&writer_state_, WRITER_STOPPED, __ATOMIC_RELEASE);
+	// Whatever was queued in the meantime: we're the writer now.
+	write_remaining();
+}
+
+// Fork handlers: threads don't survive fork(), and daemon() forks after
+// we already logged. Flush before, so that neither parent nor child repeat
+// records, and have the child start its own writer on the next message.
+static void before_fork(void) {
+	if (__atomic_load_n(&writer_state_, __ATOMIC_ACQUIRE) == WRITER_RUNNING)
+		drain_queue();
+}
+
+static void after_fork_child(void) {
+	if (writer_state_ == WRITER_RUNNING || writer_state_ == WRITER_STARTING)
+		writer_state_ = WRITER_NONE;
+	writer_waiting_ = 0;
+}
+
+static void start_writer(void) {
+	static int handlers_installed = 0;
+	if (!handlers_installed) {
+		handlers_installed = 1;
+		if (pipe2(wake_pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+			__atomic_store_n(&writer_state_, WRITER_STOPPED,
+					 __ATOMIC_RELEASE);
+			write_remaining();
+			return;
+		}
+		pthread_atfork(before_fork, NULL, after_fork_child);
+		atexit(stop_writer);
+	}
+	if (pthread_create(&writer_thread_, NULL, writer_loop, NULL) != 0) {
+		__atomic_store_n(&writer_state_, WRITER_STOPPED,
+				 __ATOMIC_RELEASE);
+		write_remaining();
+		return;
+	}
+	__atomic_store_n(&writer_state_, WRITER_RUNNING, __ATOMIC_RELEASE);
+}
+
+static void fill_record(struct log_record *record, int fd,
+			enum log_level level, const char *category,
+			const char *format, va_list ap) {
+	gettimeofday(&record->time, NULL);
+	record->fd = fd;
+	record->level = level;
+	strncpy(record->category, category, sizeof(record->category) - 1);
+	record->category[sizeof(record->category) - 1] = '\0';
+
+	va_list ap_copy;
+	va_copy(ap_copy, ap);
+	int len = vsnprintf(record->text, sizeof(record->text), format, ap);
+	if (len < 0) {
+		len = 0;
+		record->text[0] = '\0';
+	} else if (len >= (int) sizeof(record->text)) {
+		record->long_text = malloc(len + 1);
+		if (record->long_text != NULL) {
+			vsnprintf(record->long_text, len + 1, format, ap_copy);
+		} else {
+			len = sizeof(record->text) - 1;  // Truncated.
+		}
+	}
+	va_end(ap_copy);
+	record->len = len;
+}
+
+// The old-fashioned way: format and write on the caller's thread. Used if
+// there is no writer thread (anymore) and for errors that don't fit into
+// the ring.
+static void write_direct(int fd, enum log_level level, const char *category,
+			 const char *format, va_list ap) {
+	struct time_cache cache = { -1, "" };
+	struct log_record record;
+	record.long_text = NULL;
+	fill_record(&record, fd, level, category, format, ap);
+	const struct log_record *records[] = { &record };
+	write_records(fd, records, 1, &cache);
+	free(record.long_text);
+}
+
+// Claim a ring slot. Returns NULL if the ring is full.
+static struct log_record *claim_record(unsigned long *pos_out) {
+	unsigned long pos = __atomic_load_n(&enqueue_pos_, __ATOMIC_RELAXED);
+	for (;;) {
+		struct log_record *record = &ring_[pos & (LOG_RING_SIZE - 1)];
+		long diff = (long) (load_sequence(pos) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&enqueue_pos_, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				*pos_out = pos;
+				return record;
+			}
+			// 'pos' got updated by the failed exchange.
+		} else if (diff < 0) {
+			return NULL;  // Writer hasn't freed this slot yet.
+		} else {
+			pos = __atomic_load_n(&enqueue_pos_, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void Log_internal(int fd, enum log_level level,
 			 const char *category, const char *format,
 			 va_list ap) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	struct tm time_breakdown;
-	localtime_r(&now.tv_sec, &time_breakdown);
-	char fmt_buf[128];
-	strftime(fmt_buf, sizeof(fmt_buf), "%F %T", &time_breakdown);
-	struct iovec parts[3];
-	parts[0].iov_len = asprintf((char**) &parts[0].iov_base,
-				    "%s[%s.%06ld | %s]%s ",
-				    markup_start, fmt_buf, now.tv_usec,
-				    category, markup_end_);
-	parts[1].iov_len = vasprintf((char**) &parts[1].iov_base, format, ap);
-	parts[2].iov_base = (void*) "\n";
-	parts[2].iov_len = 1;
-	int already_newline
-		= (parts[1].iov_len > 0 &&
-		   ((const char*)parts[1].iov_base)[parts[1].iov_len-1] == '\n');
-	if (writev(fd, parts, already_newline ? 2 : 3) < 0) {
-		// Logging trouble. Ignore.
-	}
-
-	free(parts[0].iov_base);
-	free(parts[1].iov_base);
+	int state = __atomic_load_n(&writer_state_, __ATOMIC_ACQUIRE);
+	if (state == WRITER_NONE) {
+		int expected = WRITER_NONE;
+		if (__atomic_compare_exchange_n(&writer_state_, &expected,
+						WRITER_STARTING, 0,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			start_writer();
+		}
+		state = __atomic_load_n(&writer_state_, __ATOMIC_ACQUIRE);
+	}
+	if (state == WRITER_STOPPED) {
+		write_direct(fd, level, category, format, ap);
+		return;
+	}
+
+	unsigned long pos;
+	struct log_record *record = claim_record(&pos);
+	if (record == NULL) {
+		if (level == LOG_LEVEL_ERROR) {
+			// Errors are too important to lose.
+			write_direct(fd, level, category, format, ap);
+		} else {
+			__atomic_add_fetch(&dropped_, 1, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	fill_record(record, fd, level, category, format, ap);
+	store_sequence(pos, pos + 1);
+	wake_writer(0);
 }
 
+// The level is checked before anything is formatted, so disabled categories
+// cost not much more than a few string compares.
 void Log_info(const char *category, const char *format, ...) {
-	if (log_fd < 0) return;
+	if (log_fd < 0 || category_level(category) < LOG_LEVEL_INFO) return;
 	va_list ap;
 	va_start(ap, format);
-	Log_internal(log_fd, info_markup_start_, category, format, ap);
+	Log_internal(log_fd, LOG_LEVEL_INFO, category, format, ap);
 	va_end(ap);
 }
 
 void Log_error(const char *category, const char *format, ...) {
+	if (category_level(category) < LOG_LEVEL_ERROR) return;
 	va_list ap;
 	va_start(ap, format);
 	Log_internal(log_fd < 0 ? STDERR_FILENO : log_fd,
-		     error_markup_start_, category, format, ap);
+		     LOG_LEVEL_ERROR, category, format, ap);
 	va_end(ap);
 }
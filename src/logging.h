@@ -31,8 +31,23 @@
 // With filename given, logs info and error to that file. If filename is NULL,
 // nothing is logged (TODO: log error to syslog).
 void Log_init(const char *filename);
+
+// Set levels from a comma separated list of "[category=]level" with level
+// being one of "off", "error" or "info". Without category, sets the default
+// for all categories. Returns 0 if the spec could not be parsed.
+int Log_set_levels(const char *spec);
+
+// Output format: "text" (default) or "json" (one object per line).
+// Returns 0 for an unknown format.
+int Log_set_format(const char *name);
+
+// Rotate the log file once it is larger than the given number of bytes;
+// the previous one is kept with a ".1" suffix. 0 never rotates.
+void Log_set_max_size(long bytes);
+
 int Log_color_allowed(void);  // Returns if we're allowed to use terminal color.
-int Log_info_enabled(void);
+int Log_info_enabled(void);   // Info logged for any category.
+int Log_info_enabled_for(const char *category);
 int Log_error_enabled(void);
 
 void Log_info(const char *category, const char *format, ...)
@@ -52,8 +52,11 @@
 #endif
 
 #include "git-version.h"
+#include "live_state.h"
 #include "logging.h"
+#include "metrics.h"
 #include "output.h"
+#include "trace.h"
 #include "upnp_service.h"
 #include "upnp_control.h"
 #include "upnp_device.h"
@@ -84,8 +87,12 @@ static const gchar *uuid = "GMediaRender-1_0-000-000-002";
 #endif
 static const gchar *friendly_name = PACKAGE_NAME;
 static const gchar *output = NULL;
+static const gchar *mixer = NULL;
 static const gchar *pid_file = NULL;
 static const gchar *log_file = NULL;
+static const gchar *log_level = NULL;
+static const gchar *log_format = NULL;
+static gint log_max_size_kb = 0;
 static const gchar *mime_filter = NULL;
 
 /* Generic GMediaRender options */
@@ -106,6 +113,10 @@ static GOptionEntry option_entries[] = {
 	  "Friendly name to advertise.", NULL },
 	{ "output", 'o', 0, G_OPTION_ARG_STRING, &output,
 	  "Output module to use.", NULL },
+	{ "mixer", 0, 0, G_OPTION_ARG_STRING, &mixer,
+	  "Mixer used for volume control: 'software' (default) attenuates "
+	  "in the output, hardware mixers (e.g. 'alsa') leave the samples "
+	  "untouched. See --list-outputs.", NULL },
 	{ "pid-file", 'P', 0, G_OPTION_ARG_STRING, &pid_file,
 	  "File the process ID should be written to.", NULL },
 	{ "daemon", 'd', 0, G_OPTION_ARG_NONE, &daemon_mode,
@@ -115,8 +126,17 @@ static GOptionEntry option_entries[] = {
 		"e.g. Audio only: '--mime-filter audio'. Disable FLAC: '--mime-filter -audio/x-flac'.", NULL },
 	{ "logfile", 0, 0, G_OPTION_ARG_STRING, &log_file,
 	  "Debug log filename. Use 'stdout' or 'stderr' to log to console.", NULL },
+	{ "log-level", 0, 0, G_OPTION_ARG_STRING, &log_level,
+	  "Comma separated log levels (off, error, info), optionally per "
+	  "category, e.g. 'error,gstreamer=info'. Default: info.", NULL },
+	{ "log-format", 0, 0, G_OPTION_ARG_STRING, &log_format,
+	  "Log format: 'text' (default) or 'json' (one object per line).",
+	  NULL },
+	{ "log-max-size", 0, 0, G_OPTION_ARG_INT, &log_max_size_kb,
+	  "Rotate the logfile when it gets larger than this many kilobytes; "
+	  "the previous one is kept as <logfile>.1", NULL },
 	{ "list-outputs", 0, 0, G_OPTION_ARG_NONE, &show_outputs,
-	  "List available output modules and exit", NULL },
+	  "List available output modules and mixers and exit", NULL },
 	{ "dump-devicedesc", 0, 0, G_OPTION_ARG_NONE, &show_devicedesc,
 	  "Dump device descriptor XML and exit.", NULL },
 	{ "dump-connmgr-scpd", 0, 0, G_OPTION_ARG_NONE, &show_connmgr_scpd,
@@ -200,10 +220,20 @@ static void log_variable_change(void *userdata, int var_num,
 		 variable_value, needs_newline ? "\n" : "");
 }
 
-static void init_logging(const char *log_file) {
+static int init_logging(const char *log_file) {
 	char version[1024];
 	GetVersionInfo(version, sizeof(version));
 
+	if (log_level != NULL && !Log_set_levels(log_level)) {
+		fprintf(stderr, "Invalid --log-level '%s'\n", log_level);
+		return 0;
+	}
+	if (log_format != NULL && !Log_set_format(log_format)) {
+		fprintf(stderr, "Invalid --log-format '%s'\n", log_format);
+		return 0;
+	}
+	Log_set_max_size(log_max_size_kb * 1024L);
+
 	if (log_file != NULL) {
 		Log_init(log_file);
 		Log_info("main", "%s log started [ %s ]",
@@ -215,6 +245,7 @@ static void init_logging(const char *log_file) {
 			"(or --logfile=stdout for console)\n",
 			PACKAGE_STRING, version);
 	}
+	return 1;
 }
 
 int main(int argc, char **argv)
@@ -252,7 +283,9 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
-	init_logging(log_file);
+	if (!init_logging(log_file)) {
+		return EXIT_FAILURE;
+	}
 
 	// Now we're going to start threads etc, which means we need
 	// to become a daemon before that.
@@ -280,7 +313,7 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	rc = output_init(output);
+	rc = output_init(output, mixer);
 	if (rc != 0) {
 		Log_error("main",
 			  "ERROR: Failed to initialize Output subsystem");
@@ -308,6 +341,10 @@ int main(int argc, char **argv)
 	upnp_transport_init(device);
 	upnp_control_init(device);
 
+	live_state_init();
+	metrics_init();
+	trace_init();
+
 	if (show_devicedesc) {
 		// This can only be run after all services have been
 		// initialized.
@@ -317,9 +354,13 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
-	if (Log_info_enabled()) {
+	// Variable changes can be large (e.g. meta data), so don't even
+	// listen to them if nobody wants to see them.
+	if (Log_info_enabled_for("transport")) {
 		upnp_transport_register_variable_listener(log_variable_change,
 							  (void*) "transport");
+	}
+	if (Log_info_enabled_for("control")) {
 		upnp_control_register_variable_listener(log_variable_change,
 							(void*) "control");
 	}
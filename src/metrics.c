@@ -0,0 +1,334 @@
+/* metrics.c - Counters and histograms exported in Prometheus format
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "metrics.h"
+#include "output.h"
+#include "webserver.h"
+
+#define METRICS_PATH "/upnp/metrics"
+
+// Number of values each thread can count. A counter takes one, a histogram
+// one per bucket plus the sum.
+#define MAX_SLOTS 2048
+
+// Upper bounds of the histogram buckets in microseconds; there is an
+// implicit +Inf bucket at the end.
+static const int64_t bucket_bounds_[] = {
+	100, 500, 1000, 5000, 10000, 50000,
+	100000, 500000, 1000000, 5000000, 10000000, 30000000, 60000000,
+};
+#define BUCKET_COUNT ((int)(sizeof(bucket_bounds_) / sizeof(bucket_bounds_[0])))
+#define HISTOGRAM_SLOTS (BUCKET_COUNT + 2)  // buckets, +Inf, sum.
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_HISTOGRAM,
+};
+
+struct metric {
+	enum metric_type type;
+	const char *name;
+	const char *help;
+	char *labels;             // NULL if none.
+	int slot;                 // First of our slots in each shard.
+	struct metric *next;
+};
+
+// The values counted by one thread.
+struct shard {
+	uint64_t slots[MAX_SLOTS];
+	struct shard *next;
+};
+
+// Only the owning thread writes to its shard, so updates don't need an
+// atomic read-modify-write; relaxed loads and stores are enough to make the
+// concurrent reads of the metrics page well-defined. Where 64 bit atomics
+// would need a lock (some 32 bit ARMs), we use plain accesses; a read might
+// then see a torn value, which is acceptable for statistics.
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#  define slot_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#  define slot_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#  define slot_load(p) (*(p))
+#  define slot_store(p, v) (*(p) = (v))
+#endif
+
+// Protects creation of metrics and the list of shards; never taken when
+// counting, only when a thread counts for the first time or exits.
+static pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static struct metric *metrics_ = NULL;
+static struct metric *last_metric_ = NULL;
+static int used_slots_ = 0;
+static struct shard *shards_ = NULL;
+static struct shard retired_;     // Sum of the shards of exited threads.
+
+static pthread_key_t shard_key_;
+static pthread_once_t shard_key_once_ = PTHREAD_ONCE_INIT;
+static __thread struct shard *thread_shard_ = NULL;
+
+static void retire_shard(void *data) {
+	struct shard *shard = (struct shard*) data;
+	pthread_mutex_lock(&mutex_);
+	for (struct shard **it = &shards_; *it; it = &(*it)->next) {
+		if (*it == shard) {
+			*it = shard->next;
+			break;
+		}
+	}
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		retired_.slots[i] += shard->slots[i];
+	}
+	pthread_mutex_unlock(&mutex_);
+	free(shard);
+}
+
+static void create_shard_key(void) {
+	pthread_key_create(&shard_key_, retire_shard);
+}
+
+static struct shard *get_shard(void) {
+	if (thread_shard_ != NULL)
+		return thread_shard_;
+	struct shard *shard = (struct shard*) calloc(1, sizeof(struct shard));
+	pthread_once(&shard_key_once_, create_shard_key);
+	pthread_setspecific(shard_key_, shard);
+	pthread_mutex_lock(&mutex_);
+	shard->next = shards_;
+	shards_ = shard;
+	pthread_mutex_unlock(&mutex_);
+	thread_shard_ = shard;
+	return shard;
+}
+
+static struct metric *create_metric(enum metric_type type, const char *name,
+				    const char *help, const char *labels) {
+	const int slots = (type == METRIC_HISTOGRAM) ? HISTOGRAM_SLOTS : 1;
+	pthread_mutex_lock(&mutex_);
+	if (used_slots_ + slots > MAX_SLOTS) {
+		pthread_mutex_unlock(&mutex_);
+		Log_error("metrics", "No space left for metric %s{%s}",
+			  name, labels ? labels : "");
+		return NULL;
+	}
+	struct metric *metric = (struct metric*) malloc(sizeof(*metric));
+	metric->type = type;
+	metric->name = name;
+	metric->help = help;
+	metric->labels = labels ? strdup(labels) : NULL;
+	metric->slot = used_slots_;
+	metric->next = NULL;
+	used_slots_ += slots;
+	// Keep creation order, so that the page is stable.
+	if (last_metric_)
+		last_metric_->next = metric;
+	else
+		metrics_ = metric;
+	last_metric_ = metric;
+	pthread_mutex_unlock(&mutex_);
+	return metric;
+}
+
+struct metric *metrics_counter(const char *name, const char *help,
+			       const char *labels) {
+	return create_metric(METRIC_COUNTER, name, help, labels);
+}
+
+struct metric *metrics_histogram(const char *name, const char *help,
+				 const char *labels) {
+	return create_metric(METRIC_HISTOGRAM, name, help, labels);
+}
+
+void metrics_add(struct metric *metric, uint64_t value) {
+	if (metric == NULL)
+		return;
+	uint64_t *slot = &get_shard()->slots[metric->slot];
+	slot_store(slot, *slot + value);
+}
+
+void metrics_observe_usec(struct metric *metric, int64_t usec) {
+	if (metric == NULL)
+		return;
+	if (usec < 0)
+		usec = 0;
+	uint64_t *slots = &get_shard()->slots[metric->slot];
+	int bucket = 0;
+	while (bucket < BUCKET_COUNT && usec > bucket_bounds_[bucket])
+		++bucket;
+	slot_store(&slots[bucket], slots[bucket] + 1);
+	slot_store(&slots[BUCKET_COUNT + 1], slots[BUCKET_COUNT + 1] + usec);
+}
+
+int64_t metrics_now_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sum of the given slot over all threads. Needs mutex_ held.
+static uint64_t sum_slot(int slot) {
+	uint64_t result = retired_.slots[slot];
+	for (struct shard *shard = shards_; shard; shard = shard->next) {
+		result += slot_load(&shard->slots[slot]);
+	}
+	return result;
+}
+
+// Print name with labels, plus an optional extra label.
+static void print_series(FILE *out, const char *name, const char *suffix,
+			 const char *labels, const char *extra_label) {
+	fprintf(out, "%s%s", name, suffix);
+	if (labels == NULL && extra_label == NULL)
+		return;
+	fprintf(out, "{%s%s%s}", labels ? labels : "",
+		(labels && extra_label) ? "," : "",
+		extra_label ? extra_label : "");
+}
+
+static void print_metric(FILE *out, const struct metric *metric) {
+	if (metric->type == METRIC_COUNTER) {
+		print_series(out, metric->name, "", metric->labels, NULL);
+		fprintf(out, " %" PRIu64 "\n", sum_slot(metric->slot));
+		return;
+	}
+	uint64_t count = 0;
+	char le[32];
+	for (int i = 0; i <= BUCKET_COUNT; ++i) {
+		count += sum_slot(metric->slot + i);  // Buckets are cumulative.
+		if (i < BUCKET_COUNT) {
+			snprintf(le, sizeof(le), "le=\"%g\"",
+				 bucket_bounds_[i] / 1e6);
+		} else {
+			snprintf(le, sizeof(le), "le=\"+Inf\"");
+		}
+		print_series(out, metric->name, "_bucket", metric->labels, le);
+		fprintf(out, " %" PRIu64 "\n", count);
+	}
+	print_series(out, metric->name, "_sum", metric->labels, NULL);
+	fprintf(out, " %.6f\n", sum_slot(metric->slot + BUCKET_COUNT + 1) / 1e6);
+	print_series(out, metric->name, "_count", metric->labels, NULL);
+	fprintf(out, " %" PRIu64 "\n", count);
+}
+
+static void print_gauge(FILE *out, const char *name, const char *help,
+			double value) {
+	fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %g\n",
+		name, help, name, name, value);
+}
+
+// Values the output keeps track of itself.
+static void print_output_metrics(FILE *out) {
+	struct buffering_stats buffering;
+	if (output_get_buffering_stats(&buffering) == 0) {
+		print_gauge(out, "gmrender_buffer_fill_percent",
+			    "Fill level of the network buffer.",
+			    buffering.fill_percent);
+		print_gauge(out, "gmrender_buffer_target_seconds",
+			    "Current target duration of the network buffer.",
+			    buffering.duration);
+		print_gauge(out, "gmrender_buffer_holding",
+			    "1 while playback waits for the buffer to fill.",
+			    buffering.is_holding);
+		fprintf(out, "# HELP gmrender_underruns_total Times playback "
+			"had to pause to rebuffer.\n"
+			"# TYPE gmrender_underruns_total counter\n"
+			"gmrender_underruns_total %u\n",
+			buffering.rebuffer_count);
+		fprintf(out, "# HELP gmrender_streams_total Network streams "
+			"started.\n"
+			"# TYPE gmrender_streams_total counter\n"
+			"gmrender_streams_total %u\n",
+			buffering.stream_count);
+		print_gauge(out, "gmrender_input_bytes_per_second",
+			    "Average input rate of the current stream.",
+			    buffering.input_rate);
+		print_gauge(out, "gmrender_input_jitter",
+			    "Relative deviation of the input rate.",
+			    buffering.jitter);
+	}
+	struct track_stats track;
+	if (output_get_track_stats(&track) == 0) {
+		print_gauge(out, "gmrender_track_bitrate_bits",
+			    "Bitrate of the current track in bits/second.",
+			    track.bitrate);
+		print_gauge(out, "gmrender_track_sample_rate_hz",
+			    "Sample rate of the current track.",
+			    track.sample_rate);
+		print_gauge(out, "gmrender_track_duration_seconds",
+			    "Duration of the current track.",
+			    track.duration_ms / 1000.0);
+		print_gauge(out, "gmrender_track_tag_messages",
+			    "Tag messages received for the current track.",
+			    track.tag_messages);
+	}
+}
+
+static char *generate_metrics(void) {
+	char *result = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&result, &len);
+	if (out == NULL)
+		return NULL;
+	pthread_mutex_lock(&mutex_);
+	for (const struct metric *m = metrics_; m; m = m->next) {
+		// Families are printed together, at the first of their members.
+		const struct metric *first = metrics_;
+		while (strcmp(first->name, m->name) != 0)
+			first = first->next;
+		if (first != m)
+			continue;
+		fprintf(out, "# HELP %s %s\n# TYPE %s %s\n",
+			m->name, m->help, m->name,
+			m->type == METRIC_HISTOGRAM ? "histogram" : "counter");
+		for (const struct metric *member = m; member;
+		     member = member->next) {
+			if (strcmp(member->name, m->name) == 0)
+				print_metric(out, member);
+		}
+	}
+	pthread_mutex_unlock(&mutex_);
+	print_output_metrics(out);
+	fclose(out);
+	return result;
+}
+
+void metrics_init(void) {
+	webserver_register_generator(METRICS_PATH,
+				     "text/plain; version=0.0.4",
+				     generate_metrics);
+}
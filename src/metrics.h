@@ -0,0 +1,60 @@
+/* metrics.h - Counters and histograms exported in Prometheus format
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * Metrics are created once at startup and then updated from wherever
+ * something interesting happens - including hot paths such as action
+ * handling or taking the service locks. Updates don't take a lock: each
+ * thread counts into its own shard, and the shards are only summed up
+ * when the metrics page at /upnp/metrics is requested.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+struct metric;
+
+// Create a counter. Metrics with the same name form one family and are
+// distinguished by "labels", given in Prometheus syntax without braces
+// (e.g. "action=\"Play\"") or NULL. Name and help are not copied.
+// Returns NULL if there is no space for more metrics; all update functions
+// accept NULL and do nothing then.
+struct metric *metrics_counter(const char *name, const char *help,
+			       const char *labels);
+
+// Create a histogram of durations. Values are given in microseconds and
+// exported in seconds, with buckets from 100us to 60s.
+struct metric *metrics_histogram(const char *name, const char *help,
+				 const char *labels);
+
+void metrics_add(struct metric *metric, uint64_t value);
+void metrics_observe_usec(struct metric *metric, int64_t usec);
+
+// Monotonic time in microseconds, to measure durations.
+int64_t metrics_now_usec(void);
+
+// Register the metrics page in the webserver.
+void metrics_init(void);
+
+#endif /* _METRICS_H */
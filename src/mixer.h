@@ -0,0 +1,57 @@
+/* mixer.h - Volume control backends
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * Volume and mute requests from the RenderingControl go through a mixer.
+ * The default "software" mixer lets the output module attenuate the
+ * samples; hardware mixers (e.g. ALSA) change the level in the sound
+ * device, so that the output can pass samples through unchanged.
+ */
+
+#ifndef _MIXER_H
+#define _MIXER_H
+
+#include <glib.h>
+#include "output.h"
+
+struct mixer_module {
+	const char *shortname;
+	const char *description;
+	int (*add_options)(GOptionContext *ctx);
+
+	// Returns 0 on success. The output module is already selected but
+	// not initialized yet when this is called.
+	int (*init)(void);
+
+	// Volume as fraction 0..1.
+	int (*get_volume)(float *);
+	int (*set_volume)(float);
+	int (*get_mute)(int *);
+	int (*set_mute)(int);
+	int (*get_channel_volume)(enum output_channel, float *);
+	int (*set_channel_volume)(enum output_channel, float);
+
+	// If set, the output should not do any software volume scaling.
+	int is_hardware;
+};
+
+#endif /* _MIXER_H */
@@ -0,0 +1,227 @@
+/* mixer_alsa.c - Volume control using the ALSA hardware mixer
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include <glib.h>
+
+#include "logging.h"
+#include "mixer.h"
+#include "mixer_alsa.h"
+
+static gchar *mixer_device = NULL;
+static gchar *mixer_control = NULL;
+
+static GOptionEntry option_entries[] = {
+	{ "alsamixer-device", 0, 0, G_OPTION_ARG_STRING, &mixer_device,
+	  "ALSA mixer device, e.g. hw:0 (default: 'default')", NULL },
+	{ "alsamixer-control", 0, 0, G_OPTION_ARG_STRING, &mixer_control,
+	  "ALSA simple mixer control to use for volume (default: 'Master'). "
+	  "See amixer scontrols for available ones.", NULL },
+	{ NULL }
+};
+
+static snd_mixer_t *mixer_ = NULL;
+static snd_mixer_elem_t *elem_ = NULL;
+static int has_db_ = 0;
+static long min_value_, max_value_;  // dB * 100 or raw, see has_db_.
+
+// We keep our own notion of the volumes, as the hardware only has one
+// level per channel and quantizes.
+static float master_volume_ = 1.0;
+static float channel_volume_[OUTPUT_CHANNEL_COUNT] = { 1.0, 1.0 };
+
+static const snd_mixer_selem_channel_id_t alsa_channel_[] = {
+	SND_MIXER_SCHN_FRONT_LEFT,
+	SND_MIXER_SCHN_FRONT_RIGHT,
+};
+
+static int mixer_alsa_add_options(GOptionContext *ctx) {
+	GOptionGroup *option_group;
+	option_group = g_option_group_new("alsamixer", "ALSA Mixer Options",
+	                                  "Show ALSA Mixer Options",
+	                                  NULL, NULL);
+	g_option_group_add_entries(option_group, option_entries);
+	g_option_context_add_group(ctx, option_group);
+	return 0;
+}
+
+static long fraction_to_value(float fraction) {
+	long value;
+	if (fraction <= 0) {
+		return min_value_;
+	}
+	if (has_db_) {
+		value = lround(2000 * log10(fraction));  // 1/100 dB
+	} else {
+		value = min_value_ + lround(fraction * (max_value_ - min_value_));
+	}
+	if (value < min_value_) value = min_value_;
+	if (value > max_value_) value = max_value_;
+	return value;
+}
+
+static float value_to_fraction(long value) {
+	if (value <= min_value_) {
+		return 0.0;
+	}
+	if (has_db_) {
+		return pow(10, value / 2000.0);
+	}
+	return (float) (value - min_value_) / (max_value_ - min_value_);
+}
+
+static int apply_volume(void) {
+	for (int i = 0; i < OUTPUT_CHANNEL_COUNT; ++i) {
+		const long value = fraction_to_value(master_volume_
+						     * channel_volume_[i]);
+		const int err = has_db_
+			? snd_mixer_selem_set_playback_dB(elem_,
+							  alsa_channel_[i],
+							  value, -1)
+			: snd_mixer_selem_set_playback_volume(elem_,
+							      alsa_channel_[i],
+							      value);
+		if (err < 0) {
+			Log_error("alsamixer", "Setting volume failed: %s",
+				  snd_strerror(err));
+			return -1;
+		}
+		if (snd_mixer_selem_is_playback_mono(elem_))
+			break;
+	}
+	return 0;
+}
+
+static int mixer_alsa_init(void) {
+	const char *device = mixer_device ? mixer_device : "default";
+	const char *control = mixer_control ? mixer_control : "Master";
+	int err;
+	if ((err = snd_mixer_open(&mixer_, 0)) < 0
+	    || (err = snd_mixer_attach(mixer_, device)) < 0
+	    || (err = snd_mixer_selem_register(mixer_, NULL, NULL)) < 0
+	    || (err = snd_mixer_load(mixer_)) < 0) {
+		Log_error("alsamixer", "Can't open mixer '%s': %s",
+			  device, snd_strerror(err));
+		return -1;
+	}
+
+	snd_mixer_selem_id_t *sid;
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_index(sid, 0);
+	snd_mixer_selem_id_set_name(sid, control);
+	elem_ = snd_mixer_find_selem(mixer_, sid);
+	if (elem_ == NULL || !snd_mixer_selem_has_playback_volume(elem_)) {
+		Log_error("alsamixer", "No playback volume control '%s' on "
+			  "'%s' (see --alsamixer-control)", control, device);
+		return -1;
+	}
+
+	has_db_ = (snd_mixer_selem_get_playback_dB_range(
+			   elem_, &min_value_, &max_value_) == 0
+		   && min_value_ < max_value_);
+	if (!has_db_) {
+		snd_mixer_selem_get_playback_volume_range(elem_, &min_value_,
+							  &max_value_);
+	}
+
+	long value;
+	err = has_db_
+		? snd_mixer_selem_get_playback_dB(elem_,
+						  SND_MIXER_SCHN_FRONT_LEFT,
+						  &value)
+		: snd_mixer_selem_get_playback_volume(elem_,
+						      SND_MIXER_SCHN_FRONT_LEFT,
+						      &value);
+	if (err == 0) {
+		master_volume_ = value_to_fraction(value);
+	}
+	Log_info("alsamixer", "Using control '%s' on '%s'; range %ld..%ld%s; "
+		 "current volume fraction %f", control, device,
+		 min_value_, max_value_, has_db_ ? " (1/100 dB)" : "",
+		 master_volume_);
+	return 0;
+}
+
+static int mixer_alsa_get_volume(float *v) {
+	*v = master_volume_;
+	return 0;
+}
+
+static int mixer_alsa_set_volume(float value) {
+	Log_info("alsamixer", "Set volume fraction to %f", value);
+	master_volume_ = value;
+	return apply_volume();
+}
+
+static int mixer_alsa_get_mute(int *m) {
+	if (!snd_mixer_selem_has_playback_switch(elem_))
+		return -1;
+	int on = 1;
+	snd_mixer_handle_events(mixer_);
+	snd_mixer_selem_get_playback_switch(elem_, SND_MIXER_SCHN_FRONT_LEFT,
+					    &on);
+	*m = !on;
+	return 0;
+}
+
+static int mixer_alsa_set_mute(int m) {
+	if (!snd_mixer_selem_has_playback_switch(elem_))
+		return -1;
+	Log_info("alsamixer", "Set mute to %s", m ? "on" : "off");
+	return snd_mixer_selem_set_playback_switch_all(elem_, !m) < 0 ? -1 : 0;
+}
+
+static int mixer_alsa_get_channel_volume(enum output_channel channel,
+					 float *v) {
+	if (snd_mixer_selem_is_playback_mono(elem_))
+		return -1;
+	*v = channel_volume_[channel];
+	return 0;
+}
+
+static int mixer_alsa_set_channel_volume(enum output_channel channel,
+					 float value) {
+	if (snd_mixer_selem_is_playback_mono(elem_))
+		return -1;
+	channel_volume_[channel] = value;
+	return apply_volume();
+}
+
+struct mixer_module alsa_mixer = {
+	.shortname   = "alsa",
+	.description = "ALSA hardware mixer",
+	.add_options = mixer_alsa_add_options,
+	.init        = mixer_alsa_init,
+	.get_volume  = mixer_alsa_get_volume,
+	.set_volume  = mixer_alsa_set_volume,
+	.get_mute    = mixer_alsa_get_mute,
+	.set_mute    = mixer_alsa_set_mute,
+	.get_channel_volume = mixer_alsa_get_channel_volume,
+	.set_channel_volume = mixer_alsa_set_channel_volume,
+	.is_hardware = 1,
+};
@@ -37,9 +37,13 @@
 
 #include "logging.h"
 #include "output_module.h"
+#include "mixer.h"
 #ifdef HAVE_GST
 #include "output_gstreamer.h"
 #endif
+#ifdef HAVE_ALSA
+#include "mixer_alsa.h"
+#endif
 #include "output.h"
 
 static struct output_module *modules[] = {
@@ -54,6 +58,67 @@ static struct output_module *modules[] = {
 
 static struct output_module *output_module = NULL;
 
+// The software mixer just passes volume changes to the output module.
+static int software_get_volume(float *value) {
+	if (output_module->get_volume) {
+		return output_module->get_volume(value);
+	}
+	return -1;
+}
+static int software_set_volume(float value) {
+	if (output_module->set_volume) {
+		return output_module->set_volume(value);
+	}
+	return -1;
+}
+static int software_get_mute(int *value) {
+	if (output_module->get_mute) {
+		return output_module->get_mute(value);
+	}
+	return -1;
+}
+static int software_set_mute(int value) {
+	if (output_module->set_mute) {
+		return output_module->set_mute(value);
+	}
+	return -1;
+}
+static int software_get_channel_volume(enum output_channel channel,
+				       float *value) {
+	if (output_module->get_channel_volume) {
+		return output_module->get_channel_volume(channel, value);
+	}
+	return -1;
+}
+static int software_set_channel_volume(enum output_channel channel,
+				       float value) {
+	if (output_module->set_channel_volume) {
+		return output_module->set_channel_volume(channel, value);
+	}
+	return -1;
+}
+
+static struct mixer_module software_mixer = {
+	.shortname   = "software",
+	.description = "Attenuate in the output module",
+	.get_volume  = software_get_volume,
+	.set_volume  = software_set_volume,
+	.get_mute    = software_get_mute,
+	.set_mute    = software_set_mute,
+	.get_channel_volume = software_get_channel_volume,
+	.set_channel_volume = software_set_channel_volume,
+	.is_hardware = 0,
+};
+
+static struct mixer_module *mixers[] = {
+	&software_mixer,
+#ifdef HAVE_ALSA
+	&alsa_mixer,
+#endif
+};
+
+static struct mixer_module *mixer = NULL;
+
 void output_dump_modules(void)
 {
 	int count;
@@ -70,9 +135,42 @@ void output_dump_modules(void)
 			       (i==0) ? " (default)" : "");
 		}
 	}
+	count = sizeof(mixers) / sizeof(struct mixer_module *);
+	for (int i = 0; i < count; i++) {
+		printf("Available mixer: %s\t%s%s\n",
+		       mixers[i]->shortname,
+		       mixers[i]->description,
+		       (i==0) ? " (default)" : "");
+	}
+}
+
+static int init_mixer(const char *shortname)
+{
+	const int count = sizeof(mixers) / sizeof(struct mixer_module *);
+	mixer = NULL;
+	if (shortname == NULL) {
+		mixer = mixers[0];
+	} else {
+		for (int i = 0; i < count; i++) {
+			if (strcmp(mixers[i]->shortname, shortname) == 0) {
+				mixer = mixers[i];
+				break;
+			}
+		}
+	}
+	if (mixer == NULL) {
+		Log_error("error", "ERROR: No such mixer: '%s'", shortname);
+		return -1;
+	}
+	Log_info("output", "Using mixer: %s (%s)",
+		 mixer->shortname, mixer->description);
+	if (mixer->init) {
+		return mixer->init();
+	}
+	return 0;
 }
 
-int output_init(const char *shortname)
+int output_init(const char *shortname, const char *mixer_name)
 {
 	int count;
 
@@ -102,6 +200,14 @@ int output_init(const char *shortname)
 	Log_info("output", "Using output module: %s (%s)",
 		 output_module->shortname, output_module->description);
 
+	if (init_mixer(mixer_name) != 0) {
+		return -1;
+	}
+	if (mixer->is_hardware && output_module->disable_volume) {
+		// Hardware takes care of it, no need to touch the samples.
+		output_module->disable_volume();
+	}
+
 	if (output_module->init) {
 		return output_module->init();
 	}
@@ -143,6 +249,15 @@ int output_add_options(GOptionContext *ctx)
 			}
 		}
 	}
+	count = sizeof(mixers) / sizeof(struct mixer_module *);
+	for (i = 0; i < count; ++i) {
+		if (mixers[i]->add_options) {
+			int result = mixers[i]->add_options(ctx);
+			if (result != 0) {
+				return result;
+			}
+		}
+	}
 
 	return 0;
 }
@@ -194,26 +309,67 @@ int output_get_position(gint64 *track_dur, gint64 *track_pos) {
 }
 
 int output_get_volume(float *value) {
-	if (output_module && output_module->get_volume) {
-		return output_module->get_volume(value);
+	if (mixer && mixer->get_volume) {
+		return mixer->get_volume(value);
 	}
 	return -1;
 }
 int output_set_volume(float value) {
-	if (output_module && output_module->set_volume) {
-		return output_module->set_volume(value);
+	if (mixer && mixer->set_volume) {
+		return mixer->set_volume(value);
 	}
 	return -1;
 }
 int output_get_mute(int *value) {
-	if (output_module && output_module->get_mute) {
-		return output_module->get_mute(value);
+	if (mixer && mixer->get_mute) {
+		return mixer->get_mute(value);
 	}
 	return -1;
 }
 int output_set_mute(int value) {
-	if (output_module && output_module->set_mute) {
-		return output_module->set_mute(value);
+	if (mixer && mixer->set_mute) {
+		return mixer->set_mute(value);
+	}
+	return -1;
+}
+int output_get_channel_volume(enum output_channel channel, float *value) {
+	if (mixer && mixer->get_channel_volume) {
+		return mixer->get_channel_volume(channel, value);
+	}
+	return -1;
+}
+int output_set_channel_volume(enum output_channel channel, float value) {
+	if (mixer && mixer->set_channel_volume) {
+		return mixer->set_channel_volume(channel, value);
+	}
+	return -1;
+}
+void output_set_format_callback(output_format_cb_t cb) {
+	if (output_module && output_module->set_format_callback) {
+		output_module->set_format_callback(cb);
+	}
+}
+int output_get_buffering_stats(struct buffering_stats *stats) {
+	if (output_module && output_module->get_buffering_stats) {
+		return output_module->get_buffering_stats(stats);
+	}
+	return -1;
+}
+int output_get_track_stats(struct track_stats *stats) {
+	if (output_module && output_module->get_track_stats) {
+		return output_module->get_track_stats(stats);
+	}
+	return -1;
+}
+int output_get_loudness(int *value) {
+	if (output_module && output_module->get_loudness) {
+		return output_module->get_loudness(value);
+	}
+	return -1;
+}
+int output_set_loudness(int value) {
+	if (output_module && output_module->set_loudness) {
+		return output_module->set_loudness(value);
 	}
 	return -1;
 }
@@ -26,6 +26,7 @@
 
 #include <glib.h>
 #include "song-meta-data.h"
+#include "buffering.h"
 
 // Feedback for the controlling part what is happening with the
 // output.
@@ -35,11 +36,38 @@ enum PlayFeedback {
 };
 typedef void (*output_transition_cb_t)(enum PlayFeedback);
 
+// Channels that can have their own volume in addition to the overall one.
+enum output_channel {
+	OUTPUT_CHANNEL_LEFT,
+	OUTPUT_CHANNEL_RIGHT,
+	OUTPUT_CHANNEL_COUNT
+};
+
 // In case the stream gets to know details about the song, this is a
 // callback with changes we send back to the controlling layer.
 typedef void (*output_update_meta_cb_t)(const struct SongMetaData *);
 
-int output_init(const char *shortname);
+// Human readable description of the audio format of the stream and
+// what is actually sent to the sound device, e.g.
+// "stream 44100Hz S16LE 2ch; output 44100Hz S16LE 2ch (bit-perfect)".
+typedef void (*output_format_cb_t)(const char *format);
+
+// Technical details of the current track, for monitoring.
+struct track_stats {
+	char codec[32];
+	int bitrate;             // Nominal, or first reported; bits/second.
+	int min_bitrate;         // Range of bitrates reported while playing;
+	int max_bitrate;         // varies with VBR streams.
+	int sample_rate;
+	gint64 duration_ms;
+	gint64 start_time;       // g_get_monotonic_time() at stream start.
+	unsigned tag_messages;   // Tag messages received.
+	unsigned meta_updates;   // Meta data changes sent on.
+};
+
+// Initialize output module and mixer with the given names; NULL selects
+// the default.
+int output_init(const char *shortname, const char *mixer_name);
 int output_add_options(GOptionContext *ctx);
 void output_dump_modules(void);
 
@@ -58,5 +86,14 @@ int output_get_volume(float *v);
 int output_set_volume(float v);
 int output_get_mute(int *m);
 int output_set_mute(int m);
+int output_get_channel_volume(enum output_channel channel, float *v);
+int output_set_channel_volume(enum output_channel channel, float v);
+void output_set_format_callback(output_format_cb_t cb);
+// Current network buffering state; returns -1 if not buffering.
+int output_get_buffering_stats(struct buffering_stats *stats);
+// Details of the track playing right now; returns -1 if not available.
+int output_get_track_stats(struct track_stats *stats);
+int output_get_loudness(int *l);
+int output_set_loudness(int l);
 
 #endif /* _OUTPUT_H */
@@ -30,19 +30,65 @@
 
 #include <assert.h>
 #include <gst/gst.h>
+#if (GST_VERSION_MAJOR >= 1)
+#include <gst/controller/gstinterpolationcontrolsource.h>
+#include <gst/controller/gstdirectcontrolbinding.h>
+#endif
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 
+#include "buffering.h"
+#include "http_prefetch.h"
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
 #include "upnp_connmgr.h"
 #include "output_module.h"
 #include "output_gstreamer.h"
 
 static double buffer_duration = 0.0; /* Buffer disbled by default, see #182 */
+static gboolean bitperfect = FALSE;  // see --gstout-bitperfect
+static gboolean warm_pipeline = FALSE;  // see --gstout-warm-pipeline
+static double buffer_min_duration = 0.0;
+static double buffer_max_duration = 0.0;
+static int buffer_start_percent = 100;
+static int buffer_low_percent = 10;
+static int buffer_resume_percent = 100;
+static double buffer_fast_start = 0.0;
+static int http_connections = 0;  // see --gstout-http-connections
+
+// Network buffering; NULL if disabled. Buffering only pauses and resumes
+// playback if the user actually wants to play. Gapless transitions start
+// the next stream from the streaming thread, so its state is locked.
+static struct buffering *buffering_ = NULL;
+static GMutex buffering_mutex_;
+static int want_playing_ = 0;
+// Set at about-to-finish until the stream-start of the next stream reaches
+// the audio sink. Meanwhile the previous stream is still playing out, so
+// the (low) buffer of the incoming stream must not pause the pipeline.
+static gint incoming_stream_ = 0;
+// URI of that stream; its track is traced from the stream-start on, so that
+// time-to-first-audio doesn't include the rest of the previous track.
+// Allocated, atomic access only.
+static gchar *incoming_uri_ = NULL;
+
+// Metrics. The times are metrics_now_usec(); 0 if nothing is pending.
+static struct metric *buffering_messages_metric_ = NULL;
+static struct metric *rebuffer_metric_ = NULL;
+static struct metric *track_start_metric_ = NULL;
+// Waiting for the first audio of the URI since then. Set in the main loop,
+// taken by the first buffer in the streaming thread; atomic access only.
+static int64_t uri_set_time_ = 0;
+static int64_t hold_start_ = 0;     // Holding playback for buffering.
+static int track_playing_ = 0;      // Current URI reached playing state.
+// Cleared by the stream-start of each new stream at the audio sink, set by
+// its first buffer. Only accessed from the streaming thread.
+static gint first_buffer_seen_ = 1;
 
 static void scan_caps(const GstCaps * caps)
 {
@@ -157,6 +203,82 @@ static struct SongMetaData song_meta_;
 
 static output_transition_cb_t play_trans_callback_ = NULL;
 static output_update_meta_cb_t meta_update_callback_ = NULL;
+static output_format_cb_t format_callback_ = NULL;
+
+// Internet radio sends tag messages all the time, mostly repeating what
+// we already know. Tag lists are hashed to skip these right away, and
+// actual changes are collected for a little while before we tell
+// the transport, which re-creates the DIDL-Lite and sends out events.
+#define META_UPDATE_DELAY_MS 250
+static guint last_tags_hash_ = 0;
+static guint meta_update_id_ = 0;
+// Written in the main loop; the webserver reads it through
+// output_gstreamer_get_track_stats(), so writes and that copy are done
+// under track_stats_mutex_.
+static struct track_stats track_stats_;
+static GMutex track_stats_mutex_;
+
+// Optional ReplayGain stage, set as the playbin audio-filter. NULL if
+// disabled with --gstout-replaygain=off.
+static GstElement *replaygain_filter_ = NULL;
+static int loudness_enabled_ = 0;
+// Gain decisions (from stream tags or our own analysis) per track URI,
+// so that repeated plays of the same track don't need to be analyzed
+// again and start with the right level right away.
+struct replaygain_info {
+	double gain;
+	double peak;
+};
+static GHashTable *replaygain_cache_ = NULL;
+#define MAX_REPLAYGAIN_CACHE_ENTRIES 4096
+// The URI of the stream that is actually playing right now. Unlike gsuri_,
+// this only changes when the next stream starts, not already at
+// about-to-finish time.
+static char *stream_uri_ = NULL;
+
+// Volume stage in front of the audio sink: "volume ! audiopanorama".
+// The volume element gets the master volume times the level of the
+// louder channel, the panorama attenuates the other one. Both
+// properties can be changed while playing. If this stage is not
+// available, the master volume is set on playbin directly.
+static GstElement *volume_ = NULL;
+static int software_volume_ = 1;  // Off if a hardware mixer is used.
+
+// playbin flags we manipulate.
+#define PLAY_FLAG_SOFT_VOLUME  (1 << 4)
+#define PLAY_FLAG_NATIVE_AUDIO (1 << 5)
+
+// In bit-perfect mode, playbin is restricted to native audio formats, i.e.
+// it does not insert converters or resamplers. Each new stream starts
+// like that; only if the sink can't handle the format, we fall back to
+// conversion for that stream.
+static int native_audio_fallback_ = 0;
+// The element we set as audio sink and the format we have last reported.
+static GstElement *audio_sink_element_ = NULL;
+static int format_report_pending_ = 0;
+static char *last_format_report_ = NULL;
+#if (GST_VERSION_MAJOR >= 1)
+// The sink pad whose caps we watch and our handler on it; see
+// watch_sink_caps(). Only touched in the main loop.
+static GstPad *caps_watch_pad_ = NULL;
+static gulong caps_watch_handler_ = 0;
+#endif
+static GstElement *balance_panorama_ = NULL;
+static float master_volume_ = 1.0;
+static float channel_volume_[OUTPUT_CHANNEL_COUNT] = { 1.0, 1.0 };
+
+// Volume changes are applied as short ramps (see --gstout-volume-ramp-ms)
+// through a control source on the volume element. The ramp starts at the
+// stream time of the last buffer that went through the volume element,
+// which is tracked by a pad probe in the streaming thread.
+#define MAX_ELEMENT_VOLUME 10.0  // Range of the "volume" property.
+#define VOLUME_BATCH_MS 20       // Collect bursts of changes into one ramp.
+static GstControlSource *volume_ramp_ = NULL;
+static GMutex volume_mutex_;     // Protects the three below.
+static GstSegment volume_segment_;
+static GstClockTime volume_stream_time_ = GST_CLOCK_TIME_NONE;
+static int volume_update_pending_ = 0;
+static guint volume_ramp_finish_id_ = 0;
 
 struct track_time_info {
 	gint64 duration;
@@ -171,10 +293,484 @@ static GstState get_current_player_state() {
 	return state;
 }
 
+// Switch one of the playbin PLAY_FLAG_* on or off.
+static void set_playbin_flag(guint flag, int enable) {
+	guint flags;
+	g_object_get(G_OBJECT(player_), "flags", &flags, NULL);
+	flags = enable ? (flags | flag) : (flags & ~flag);
+	g_object_set(G_OBJECT(player_), "flags", flags, NULL);
+}
+
+// (Re-)attach the ReplayGain filter depending on the loudness switch. This
+// is only picked up by playbin when it sets up a new stream, so call this
+// while in READY.
+static void apply_replaygain_filter(void) {
+	if (replaygain_filter_ == NULL)
+		return;
+	g_object_set(G_OBJECT(player_), "audio-filter",
+		     loudness_enabled_ ? replaygain_filter_ : NULL, NULL);
+}
+
+// Reset the per-stream buffering state and size the buffer of the stream
+// playbin is about to set up.
+static void start_stream_buffering(void) {
+	if (buffering_ == NULL)
+		return;
+	g_mutex_lock(&buffering_mutex_);
+	const double duration = Buffering_stream_start(buffering_);
+	g_mutex_unlock(&buffering_mutex_);
+	g_object_set(G_OBJECT(player_), "buffer-duration",
+		     (gint64) round(duration * 1.0e9), NULL);
+}
+
+// Set up things that playbin only picks up for a new stream. To be called
+// while in READY.
+static void prepare_new_stream(void) {
+	g_atomic_int_set(&incoming_stream_, 0);
+	g_free(__atomic_exchange_n(&incoming_uri_, NULL, __ATOMIC_SEQ_CST));
+	apply_replaygain_filter();
+	start_stream_buffering();
+	if (bitperfect && native_audio_fallback_) {
+		native_audio_fallback_ = 0;
+		set_playbin_flag(PLAY_FLAG_NATIVE_AUDIO, 1);
+	}
+}
+
+// Set when the audio sink was kept running during a stream switch; it is
+// unlocked once the pipeline is playing again, or if the new stream fails.
+static int warm_switch_pending_ = 0;
+static void finish_warm_switch(void);
+
+// With --gstout-http-connections, http:// resources are fetched with
+// several parallel range requests (see http_prefetch.h) and fed into
+// playbin through an appsrc. Opening a prefetch takes a couple of round
+// trips, so it is started in the background as soon as the (next) URI is
+// known; when the URI is handed to playbin, the prefetch goes to
+// pending_prefetch_, from where the appsrc picks it up in the source-setup
+// callback. If a stream is to be started from the main loop while its
+// prefetch is still being opened, that start is deferred until the open
+// completes, or at most PREFETCH_WAIT_MS.
+#define PREFETCH_FEED_BYTES (64 * 1024)
+#define PREFETCH_WAIT_MS 2000
+struct prefetch_request {
+	char *uri;
+	struct http_prefetch *prefetch;  // Once done; NULL if not possible.
+	int done;
+	int abandoned;           // Nobody waits; the opener cleans up.
+};
+// Protects all prefetch state below. Used from the main loop, and from
+// the streaming threads in about-to-finish and source-setup.
+static GMutex prefetch_mutex_;
+static struct prefetch_request *current_request_ = NULL;  // For gsuri_
+static struct prefetch_request *next_request_ = NULL;     // gs_next_uri_
+static struct http_prefetch *pending_prefetch_ = NULL;
+// The deferred start of gsuri_ waits for this request; see
+// start_current_stream(). The pointers are only touched in the main loop.
+static struct prefetch_request *deferred_request_ = NULL;
+static guint deferred_timeout_id_ = 0;
+static gboolean prefetch_opened(gpointer user_data);
+
+// Pushes data from the prefetch into its appsrc. Lives as long as the
+// appsrc, to which it is attached as object data.
+struct prefetch_feeder {
+	struct http_prefetch *prefetch;
+	GstElement *appsrc;      // Not ref'ed: we're owned by it.
+	GThread *thread;
+	GMutex mutex;            // Protects the fields below.
+	GCond cond;
+	gint64 position;         // Offset of the next byte appsrc expects.
+	int waiting;             // Until appsrc asks for data.
+	int stop;
+};
+
+#if (GST_VERSION_MAJOR >= 1)
+static gpointer feed_appsrc(gpointer data) {
+	struct prefetch_feeder *feeder = data;
+	char *chunk = malloc(PREFETCH_FEED_BYTES);
+	g_mutex_lock(&feeder->mutex);
+	while (!feeder->stop) {
+		if (feeder->waiting) {
+			g_cond_wait(&feeder->cond, &feeder->mutex);
+			continue;
+		}
+		g_mutex_unlock(&feeder->mutex);
+		int64_t offset = 0;
+		const int len = HttpPrefetch_read(feeder->prefetch, chunk,
+						  PREFETCH_FEED_BYTES, &offset);
+		g_mutex_lock(&feeder->mutex);
+		if (feeder->stop)
+			break;
+		GstFlowReturn ret = GST_FLOW_OK;
+		if (len > 0 && offset != feeder->position)
+			continue;  // Read from before a seek.
+		if (len == 0) {
+			g_signal_emit_by_name(feeder->appsrc, "end-of-stream",
+					      &ret);
+			feeder->waiting = 1;
+			continue;
+		}
+		if (len < 0) {
+			// Fail the stream rather than let the track end
+			// early as if it was complete.
+			GST_ELEMENT_ERROR(feeder->appsrc, RESOURCE, READ,
+					  ("Prefetching the stream failed."),
+					  (NULL));
+			break;
+		}
+		GstBuffer *buffer = gst_buffer_new_allocate(NULL, len, NULL);
+		gst_buffer_fill(buffer, 0, chunk, len);
+		GST_BUFFER_OFFSET(buffer) = offset;
+		// Blocks while appsrc is full. A seek first flushes, which
+		// makes this return, and only then calls seek_prefetch().
+		// Until then, we don't push anything.
+		g_signal_emit_by_name(feeder->appsrc, "push-buffer", buffer,
+				      &ret);
+		gst_buffer_unref(buffer);
+		feeder->position += len;
+		if (ret != GST_FLOW_OK)
+			feeder->waiting = 1;
+	}
+	g_mutex_unlock(&feeder->mutex);
+	free(chunk);
+	return NULL;
+}
+
+static void prefetch_need_data(GstElement *appsrc, guint length,
+			       gpointer userdata) {
+	(void)appsrc;
+	(void)length;
+	struct prefetch_feeder *feeder = userdata;
+	g_mutex_lock(&feeder->mutex);
+	feeder->waiting = 0;
+	g_cond_signal(&feeder->cond);
+	g_mutex_unlock(&feeder->mutex);
+}
+
+static gboolean seek_prefetch(GstElement *appsrc, guint64 offset,
+			      gpointer userdata) {
+	(void)appsrc;
+	struct prefetch_feeder *feeder = userdata;
+	g_mutex_lock(&feeder->mutex);
+	feeder->position = offset;
+	HttpPrefetch_seek(feeder->prefetch, offset);
+	g_cond_signal(&feeder->cond);
+	g_mutex_unlock(&feeder->mutex);
+	return TRUE;
+}
+
+static void free_prefetch_feeder(gpointer data) {
+	struct prefetch_feeder *feeder = data;
+	g_mutex_lock(&feeder->mutex);
+	feeder->stop = 1;
+	g_cond_signal(&feeder->cond);
+	g_mutex_unlock(&feeder->mutex);
+	HttpPrefetch_cancel(feeder->prefetch);
+	g_thread_join(feeder->thread);
+	HttpPrefetch_delete(feeder->prefetch);
+	g_mutex_clear(&feeder->mutex);
+	g_cond_clear(&feeder->cond);
+	free(feeder);
+}
+
+static void setup_source(GstElement *playbin, GstElement *source,
+			 gpointer userdata) {
+	(void)playbin;
+	(void)userdata;
+	if (strcmp(G_OBJECT_TYPE_NAME(source), "GstAppSrc") != 0)
+		return;
+	g_mutex_lock(&prefetch_mutex_);
+	struct http_prefetch *prefetch = pending_prefetch_;
+	pending_prefetch_ = NULL;
+	g_mutex_unlock(&prefetch_mutex_);
+	if (prefetch == NULL)
+		return;
+	struct prefetch_feeder *feeder = calloc(1, sizeof(*feeder));
+	feeder->prefetch = prefetch;
+	feeder->appsrc = source;
+	feeder->waiting = 1;
+	g_mutex_init(&feeder->mutex);
+	g_cond_init(&feeder->cond);
+
+	g_object_set(G_OBJECT(source),
+		     "size", (gint64) HttpPrefetch_length(feeder->prefetch),
+		     "stream-type", 1,  // GST_APP_STREAM_TYPE_SEEKABLE
+		     "format", GST_FORMAT_BYTES,
+		     "block", TRUE,
+		     "max-bytes", (guint64) 4 * PREFETCH_FEED_BYTES,
+		     NULL);
+	g_signal_connect(G_OBJECT(source), "need-data",
+			 G_CALLBACK(prefetch_need_data), feeder);
+	g_signal_connect(G_OBJECT(source), "seek-data",
+			 G_CALLBACK(seek_prefetch), feeder);
+	g_object_set_data_full(G_OBJECT(source), "gmrender-prefetch",
+			       feeder, free_prefetch_feeder);
+	feeder->thread = g_thread_new("prefetch-feed", feed_appsrc, feeder);
+}
+#endif
+
+static gpointer discard_prefetch_thread(gpointer data) {
+	HttpPrefetch_delete(data);
+	return NULL;
+}
+
+// Deleting waits for the fetches in flight, which can take up to the HTTP
+// timeout; don't do that on the main loop or a streaming thread.
+static void discard_prefetch(struct http_prefetch *prefetch) {
+	if (prefetch == NULL)
+		return;
+	g_thread_unref(g_thread_new("prefetch-discard",
+				    discard_prefetch_thread, prefetch));
+}
+
+static gpointer open_prefetch_thread(gpointer data) {
+	struct prefetch_request *request = data;
+	struct http_prefetch *prefetch =
+		HttpPrefetch_open(request->uri, http_connections);
+	g_mutex_lock(&prefetch_mutex_);
+	const int abandoned = request->abandoned;
+	request->prefetch = prefetch;
+	request->done = 1;
+	g_mutex_unlock(&prefetch_mutex_);
+	if (!abandoned) {
+		g_idle_add(prefetch_opened, NULL);
+	} else {
+		HttpPrefetch_delete(prefetch);
+		free(request->uri);
+		free(request);
+	}
+	return NULL;
+}
+
+// Start opening a prefetch for the uri in the background. Returns NULL if
+// prefetching does not apply.
+static struct prefetch_request *start_prefetch(const char *uri) {
+	if (http_connections <= 1 || uri == NULL
+	    || strncmp(uri, "http://", strlen("http://")) != 0)
+		return NULL;
+	struct prefetch_request *request = calloc(1, sizeof(*request));
+	request->uri = strdup(uri);
+	g_thread_unref(g_thread_new("prefetch-open", open_prefetch_thread,
+				    request));
+	return request;
+}
+
+// Called with prefetch_mutex_ held.
+static void abandon_prefetch(struct prefetch_request *request) {
+	if (request == NULL)
+		return;
+	if (!request->done) {
+		request->abandoned = 1;  // The opener frees it.
+		return;
+	}
+	discard_prefetch(request->prefetch);
+	free(request->uri);
+	free(request);
+}
+
+// Set the URI on playbin; if prefetching applies, make it play from the
+// prefetch instead. Consumes the *request started for the uri; if it isn't
+// opened yet, we play the uri directly rather than holding up playback.
+static void set_player_uri(const char *uri,
+			   struct prefetch_request **request) {
+	struct http_prefetch *prefetch = NULL;
+	g_mutex_lock(&prefetch_mutex_);
+	struct prefetch_request *r = *request;
+	*request = NULL;
+	if (r != NULL && (uri == NULL || strcmp(r->uri, uri) != 0)) {
+		abandon_prefetch(r);
+		r = NULL;
+	}
+	if (r == NULL)
+		r = start_prefetch(uri);
+	if (r != NULL) {
+		if (r->done) {
+			prefetch = r->prefetch;
+			r->prefetch = NULL;
+		}
+		abandon_prefetch(r);
+	}
+	discard_prefetch(pending_prefetch_);  // Never picked up.
+	pending_prefetch_ = prefetch;
+	g_mutex_unlock(&prefetch_mutex_);
+	g_object_set(G_OBJECT(player_), "uri",
+		     prefetch ? "appsrc://" : uri, NULL);
+}
+
+// Going to PLAYING after a warm switch: a locked sink is skipped when the
+// pipeline hands out its base time, so it would keep syncing against a
+// different one than the rest of the pipeline (and position queries go
+// wrong). We therefore pick the base time for the new stream when its URI
+// is set and make the pipeline use it instead of choosing its own: with
+// start time NONE, GstPipeline doesn't recalculate the base time but
+// distributes the one we set.
+static void set_warm_base_time(void) {
+#if (GST_VERSION_MAJOR >= 1)
+	GstClock *clock = warm_switch_pending_
+		? gst_element_get_clock(audio_sink_element_) : NULL;
+	if (clock != NULL) {
+		const GstClockTime base_time = gst_clock_get_time(clock);
+		gst_object_unref(clock);
+		gst_element_set_base_time(audio_sink_element_, base_time);
+		gst_element_set_start_time(player_, GST_CLOCK_TIME_NONE);
+		gst_element_set_base_time(player_, base_time);
+	}
+#endif
+}
+
+static void cancel_deferred_start(void) {
+	if (deferred_request_ == NULL)
+		return;
+	if (deferred_timeout_id_ != 0) {
+		g_source_remove(deferred_timeout_id_);
+		deferred_timeout_id_ = 0;
+	}
+	g_mutex_lock(&prefetch_mutex_);
+	abandon_prefetch(deferred_request_);
+	g_mutex_unlock(&prefetch_mutex_);
+	deferred_request_ = NULL;
+}
+
+// The prefetch the deferred start waits for is open, or we don't wait any
+// longer: set the URI and go where the user wants.
+static void finish_deferred_start(void) {
+	if (deferred_timeout_id_ != 0) {
+		g_source_remove(deferred_timeout_id_);
+		deferred_timeout_id_ = 0;
+	}
+	struct prefetch_request *request = deferred_request_;
+	deferred_request_ = NULL;
+	set_player_uri(gsuri_, &request);
+	set_warm_base_time();
+	if (gst_element_set_state(player_, want_playing_
+				  ? GST_STATE_PLAYING : GST_STATE_PAUSED)
+	    == GST_STATE_CHANGE_FAILURE) {
+		Log_error("gstreamer", "setting play state failed (3)");
+		finish_warm_switch();
+	}
+}
+
+// Runs in the main loop after a prefetch got opened.
+static gboolean prefetch_opened(gpointer user_data) {
+	(void)user_data;
+	if (deferred_request_ == NULL)
+		return FALSE;
+	g_mutex_lock(&prefetch_mutex_);
+	const int done = deferred_request_->done;
+	g_mutex_unlock(&prefetch_mutex_);
+	if (done)
+		finish_deferred_start();
+	return FALSE;
+}
+
+static gboolean deferred_start_timeout(gpointer user_data) {
+	(void)user_data;
+	deferred_timeout_id_ = 0;
+	Log_info("gstreamer", "Prefetch of '%s' not ready; playing it "
+		 "directly.", gsuri_);
+	finish_deferred_start();
+	return FALSE;
+}
+
+// Hand gsuri_ to playbin from the main loop, which we don't want to block
+// while its prefetch is opened. If the prefetch isn't open yet, setting
+// the URI is deferred until it is (or PREFETCH_WAIT_MS passed), and the
+// pipeline is then taken to PLAYING or PAUSED as want_playing_ says.
+// Returns 1 if the URI is set right away and the caller changes the state.
+static int start_current_stream(void) {
+	cancel_deferred_start();
+	g_mutex_lock(&prefetch_mutex_);
+	struct prefetch_request *r = current_request_;
+	if (r != NULL && (gsuri_ == NULL || strcmp(r->uri, gsuri_) != 0)) {
+		abandon_prefetch(r);
+		r = NULL;
+	}
+	if (r == NULL)
+		r = start_prefetch(gsuri_);
+	current_request_ = r;
+	const int wait = (r != NULL && !r->done);
+	if (wait) {
+		deferred_request_ = r;
+		current_request_ = NULL;
+	}
+	g_mutex_unlock(&prefetch_mutex_);
+	if (wait) {
+		deferred_timeout_id_ = g_timeout_add(PREFETCH_WAIT_MS,
+						     deferred_start_timeout,
+						     NULL);
+		return 0;
+	}
+	set_player_uri(gsuri_, &current_request_);
+	set_warm_base_time();
+	return 1;
+}
+
+// Set up the pipeline for the new gsuri_. Usually this goes through
+// READY, which tears down everything including the audio sink. With
+// --gstout-warm-pipeline, the running sink is kept out of the state
+// change, so only source and decoders are rebuilt and the device stays
+// open and configured; if the new stream has different caps, the sink
+// renegotiates as it would for a gapless transition.
+// Returns like start_current_stream().
+static int switch_to_new_stream(void) {
+#if (GST_VERSION_MAJOR >= 1)
+	GstState sink_state = GST_STATE_NULL;
+	if (warm_pipeline && audio_sink_element_ != NULL) {
+		gst_element_get_state(audio_sink_element_, &sink_state, NULL, 0);
+	}
+	if (sink_state >= GST_STATE_PAUSED) {
+		gst_element_set_locked_state(audio_sink_element_, TRUE);
+		// Drop what is left of the old stream (and its EOS), and let
+		// running time of the new stream start now.
+		GstPad *pad = gst_element_get_static_pad(audio_sink_element_,
+							 "sink");
+		if (pad != NULL) {
+			gst_pad_send_event(pad, gst_event_new_flush_start());
+			gst_pad_send_event(pad, gst_event_new_flush_stop(TRUE));
+			gst_object_unref(pad);
+		}
+		warm_switch_pending_ = 1;
+	}
+#endif
+	if (gst_element_set_state(player_, GST_STATE_READY) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		Log_error("gstreamer", "setting play state failed (1)");
+		// Error, but continue; can't get worse :)
+		finish_warm_switch();
+	}
+	prepare_new_stream();
+	return start_current_stream();
+}
+
+// The pipeline caught up with the sink we kept running, or the new stream
+// failed; let the sink take part in state changes again.
+static void finish_warm_switch(void) {
+	if (!warm_switch_pending_)
+		return;
+	warm_switch_pending_ = 0;
+	gst_element_set_locked_state(audio_sink_element_, FALSE);
+#if (GST_VERSION_MAJOR >= 1)
+	// Back to normal base time handling, so that pause and resume
+	// adjust it again. Only looked at on the next PLAYING -> PAUSED.
+	gst_element_set_start_time(player_, 0);
+#endif
+}
+
+static void cancel_meta_update(void) {
+	if (meta_update_id_ != 0) {
+		g_source_remove(meta_update_id_);
+		meta_update_id_ = 0;
+	}
+	last_tags_hash_ = 0;
+}
+
 static void output_gstreamer_set_next_uri(const char *uri) {
 	Log_info("gstreamer", "Set next uri to '%s'", uri);
 	free(gs_next_uri_);
 	gs_next_uri_ = (uri && *uri) ? strdup(uri) : NULL;
+	g_mutex_lock(&prefetch_mutex_);
+	abandon_prefetch(next_request_);
+	next_request_ = start_prefetch(gs_next_uri_);
+	g_mutex_unlock(&prefetch_mutex_);
 }
 
 static void output_gstreamer_set_uri(const char *uri,
@@ -182,29 +778,43 @@ static void output_gstreamer_set_uri(const char *uri,
 	Log_info("gstreamer", "Set uri to '%s'", uri);
 	free(gsuri_);
 	gsuri_ = (uri && *uri) ? strdup(uri) : NULL;
+	cancel_deferred_start();
+	g_mutex_lock(&prefetch_mutex_);
+	abandon_prefetch(current_request_);
+	current_request_ = start_prefetch(gsuri_);
+	g_mutex_unlock(&prefetch_mutex_);
 	meta_update_callback_ = meta_cb;
+	cancel_meta_update();
 	SongMetaData_clear(&song_meta_);
+	__atomic_store_n(&uri_set_time_, metrics_now_usec(), __ATOMIC_SEQ_CST);
+	track_playing_ = 0;
+	trace_new_track(uri);
 }
 
 static int output_gstreamer_play(output_transition_cb_t callback) {
+	trace_instant("play", NULL);
 	play_trans_callback_ = callback;
-	if (get_current_player_state() != GST_STATE_PAUSED) {
-		if (gst_element_set_state(player_, GST_STATE_READY) ==
-		    GST_STATE_CHANGE_FAILURE) {
-			Log_error("gstreamer", "setting play state failed (1)");
-			// Error, but continue; can't get worse :)
-		}
-		g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
+	want_playing_ = 1;
+	if (deferred_request_ != NULL) {
+		return 0;  // Plays once the URI is set.
+	}
+	if (get_current_player_state() != GST_STATE_PAUSED
+	    && !switch_to_new_stream()) {
+		return 0;  // Deferred; see start_current_stream().
 	}
 	if (gst_element_set_state(player_, GST_STATE_PLAYING) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		Log_error("gstreamer", "setting play state failed (2)");
+		finish_warm_switch();
 		return -1;
 	}
 	return 0;
 }
 
 static int output_gstreamer_stop(void) {
+	want_playing_ = 0;
+	cancel_deferred_start();
+	finish_warm_switch();
 	if (gst_element_set_state(player_, GST_STATE_READY) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		return -1;
@@ -214,6 +824,10 @@ static int output_gstreamer_stop(void) {
 }
 
 static int output_gstreamer_pause(void) {
+	want_playing_ = 0;
+	if (deferred_request_ != NULL) {
+		return 0;  // Pauses once the URI is set.
+	}
 	if (gst_element_set_state(player_, GST_STATE_PAUSED) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		return -1;
@@ -233,7 +847,6 @@ static int output_gstreamer_seek(gint64 position_nanos) {
 	}
 }
 
-#if 0
 static const char *gststate_get_name(GstState state)
 {
 	switch(state) {
@@ -251,42 +864,240 @@ static const char *gststate_get_name(GstState state)
 		return "Unknown";
 	}
 }
-#endif
+
+static void remember_replaygain(const GstTagList *tags) {
+	if (replaygain_filter_ == NULL || stream_uri_ == NULL)
+		return;
+	struct replaygain_info info = { 0.0, 1.0 };
+	if (!gst_tag_list_get_double(tags, GST_TAG_TRACK_GAIN, &info.gain))
+		return;
+	gst_tag_list_get_double(tags, GST_TAG_TRACK_PEAK, &info.peak);
+	if (g_hash_table_size(replaygain_cache_)
+	    >= MAX_REPLAYGAIN_CACHE_ENTRIES) {
+		g_hash_table_remove_all(replaygain_cache_);  // Simple eviction.
+	}
+	struct replaygain_info *value = g_new(struct replaygain_info, 1);
+	*value = info;
+	g_hash_table_insert(replaygain_cache_, g_strdup(stream_uri_), value);
+}
+
+// If we already know the gain of the new stream, tell the filter right
+// away: rgvolume starts with the right level before the stream's own tags
+// show up, and rganalysis skips analyzing this track (not "forced").
+static void inject_cached_replaygain(void) {
+	if (replaygain_filter_ == NULL || !loudness_enabled_
+	    || stream_uri_ == NULL)
+		return;
+	const struct replaygain_info *info = (const struct replaygain_info*)
+		g_hash_table_lookup(replaygain_cache_, stream_uri_);
+	if (info == NULL)
+		return;
+	Log_info("gstreamer", "Using cached track gain %.2fdB for %s",
+		 info->gain, stream_uri_);
+	GstPad *pad = gst_element_get_static_pad(replaygain_filter_, "sink");
+	if (pad == NULL)
+		return;
+	GstTagList *tags = gst_tag_list_new(GST_TAG_TRACK_GAIN, info->gain,
+					    GST_TAG_TRACK_PEAK, info->peak,
+					    NULL);
+	gst_pad_send_event(pad, gst_event_new_tag(tags));
+	gst_object_unref(pad);
+}
+
+// The stream tags we take over into the song meta data. Looked up by
+// quark, so matching a tag is an integer compare instead of a chain of
+// strcmp()s; tags are interned by GStreamer anyway.
+struct meta_tag {
+	const char *name;
+	size_t offset;   // Of the destination in struct SongMetaData.
+	GQuark quark;
+};
+static struct meta_tag meta_tags_[] = {
+	{ GST_TAG_TITLE,    offsetof(struct SongMetaData, title), 0 },
+	{ GST_TAG_ARTIST,   offsetof(struct SongMetaData, artist), 0 },
+	{ GST_TAG_ALBUM,    offsetof(struct SongMetaData, album), 0 },
+	{ GST_TAG_GENRE,    offsetof(struct SongMetaData, genre), 0 },
+	{ GST_TAG_COMPOSER, offsetof(struct SongMetaData, composer), 0 },
+	{ GST_TAG_AUDIO_CODEC, offsetof(struct SongMetaData, codec), 0 },
+};
+#define META_TAG_COUNT G_N_ELEMENTS(meta_tags_)
+static GQuark bitrate_quark_;
+static GQuark nominal_bitrate_quark_;
+static GQuark duration_quark_;
 
 // This is crazy. I want C++ :)
 struct MetaModify {
-	struct SongMetaData *meta;
-	int any_change;
+	const char *value[META_TAG_COUNT];  // Peeked from the tag list.
+	guint bitrate;
+	guint nominal_bitrate;
+	guint64 duration;
+	int any_value;
 };
 
+static void init_meta_tags(void) {
+	for (size_t i = 0; i < META_TAG_COUNT; ++i) {
+		meta_tags_[i].quark =
+			g_quark_from_static_string(meta_tags_[i].name);
+	}
+	bitrate_quark_ = g_quark_from_static_string(GST_TAG_BITRATE);
+	nominal_bitrate_quark_ =
+		g_quark_from_static_string(GST_TAG_NOMINAL_BITRATE);
+	duration_quark_ = g_quark_from_static_string(GST_TAG_DURATION);
+}
+
 static void MetaModify_add_tag(const GstTagList *list, const gchar *tag,
 			       gpointer user_data) {
 	struct MetaModify *data = (struct MetaModify*) user_data;
-	const char **destination = NULL;
-	if (strcmp(tag, GST_TAG_TITLE) == 0) {
-		destination = &data->meta->title;
-	} else if (strcmp(tag, GST_TAG_ARTIST) == 0) {
-		destination = &data->meta->artist;
-	} else if (strcmp(tag, GST_TAG_ALBUM) == 0) {
-		destination = &data->meta->album;
-	} else if (strcmp(tag, GST_TAG_GENRE) == 0) {
-		destination = &data->meta->genre;
-	} else if (strcmp(tag, GST_TAG_COMPOSER) == 0) {
-		destination = &data->meta->composer;
-	}
-	if (destination != NULL) {
-		char *replace = NULL;
-		gst_tag_list_get_string(list, tag, &replace);
-		if (replace != NULL &&
-		    (*destination == NULL
-		     || strcmp(replace, *destination) != 0)) {
-			free((char*)*destination);
-			*destination = replace;
-			data->any_change++;
-		} else {
-			free(replace);
+	const GQuark quark = g_quark_try_string(tag);
+	for (size_t i = 0; i < META_TAG_COUNT; ++i) {
+		if (meta_tags_[i].quark != quark)
+			continue;
+		if (gst_tag_list_peek_string_index(list, tag, 0,
+						   &data->value[i])) {
+			data->any_value = 1;
+		}
+		return;
+	}
+	if (quark == bitrate_quark_) {
+		gst_tag_list_get_uint(list, tag, &data->bitrate);
+	} else if (quark == nominal_bitrate_quark_) {
+		data->any_value |= gst_tag_list_get_uint(
+			list, tag, &data->nominal_bitrate);
+	} else if (quark == duration_quark_) {
+		data->any_value |= gst_tag_list_get_uint64(
+			list, tag, &data->duration);
+	}
+}
+
+static guint MetaModify_hash(const struct MetaModify *data) {
+	guint hash = 5381;
+	for (size_t i = 0; i < META_TAG_COUNT; ++i) {
+		hash = hash * 33 + (data->value[i]
+				    ? g_str_hash(data->value[i]) : 0);
+	}
+	// The actual bitrate of VBR streams changes all the time; it only
+	// counts if we don't know any yet, see MetaModify_apply().
+	hash = hash * 33 + data->nominal_bitrate;
+	hash = hash * 33 + (guint) (data->duration / GST_MSECOND);
+	return hash;
+}
+
+// Take over changed values into the song meta data. Returns number of
+// changes.
+static int MetaModify_apply(const struct MetaModify *data,
+			    struct SongMetaData *meta) {
+	int changes = 0;
+	for (size_t i = 0; i < META_TAG_COUNT; ++i) {
+		const char **destination = (const char **)
+			((char*) meta + meta_tags_[i].offset);
+		const char *value = data->value[i];
+		if (value == NULL
+		    || (*destination != NULL && strcmp(value, *destination) == 0))
+			continue;
+		free((char*)*destination);
+		*destination = strdup(value);
+		changes++;
+	}
+	const int bitrate = data->nominal_bitrate > 0
+		? (int) data->nominal_bitrate
+		: (meta->bitrate == 0 ? (int) data->bitrate : meta->bitrate);
+	if (bitrate != meta->bitrate) {
+		meta->bitrate = bitrate;
+		changes++;
+	}
+	const gint64 duration_ms = data->duration / GST_MSECOND;
+	if (duration_ms > 0 && duration_ms != meta->duration_ms) {
+		meta->duration_ms = duration_ms;
+		changes++;
+	}
+	return changes;
+}
+
+// Update the track stats with what we know about the stream now.
+static void update_track_stats(const struct MetaModify *modify) {
+	g_mutex_lock(&track_stats_mutex_);
+	if (song_meta_.codec != NULL) {
+		g_strlcpy(track_stats_.codec, song_meta_.codec,
+			  sizeof(track_stats_.codec));
+	}
+	track_stats_.bitrate = song_meta_.bitrate;
+	track_stats_.sample_rate = song_meta_.sample_rate;
+	track_stats_.duration_ms = song_meta_.duration_ms;
+	const int reported = modify ? (int) modify->bitrate : 0;
+	if (reported > 0) {
+		if (track_stats_.min_bitrate == 0
+		    || reported < track_stats_.min_bitrate)
+			track_stats_.min_bitrate = reported;
+		if (reported > track_stats_.max_bitrate)
+			track_stats_.max_bitrate = reported;
+	}
+	g_mutex_unlock(&track_stats_mutex_);
+}
+
+static void log_track_stats(void) {
+	if (track_stats_.start_time == 0)
+		return;
+	Log_info("gstreamer", "Track stats: codec '%s', %d bit/s "
+		 "(%d..%d), %dHz, %" PRId64 "ms, %u tag messages, "
+		 "%u meta data updates, played %" PRId64 "s",
+		 track_stats_.codec, track_stats_.bitrate,
+		 track_stats_.min_bitrate, track_stats_.max_bitrate,
+		 track_stats_.sample_rate, track_stats_.duration_ms,
+		 track_stats_.tag_messages, track_stats_.meta_updates,
+		 (g_get_monotonic_time() - track_stats_.start_time)
+		 / G_USEC_PER_SEC);
+}
+
+static gboolean send_meta_update(gpointer user_data) {
+	(void)user_data;
+	meta_update_id_ = 0;
+	if (meta_update_callback_ != NULL) {
+		g_mutex_lock(&track_stats_mutex_);
+		track_stats_.meta_updates++;
+		g_mutex_unlock(&track_stats_mutex_);
+		meta_update_callback_(&song_meta_);
+	}
+	return FALSE;
+}
+
+static void schedule_meta_update(void) {
+	if (meta_update_id_ == 0) {
+		meta_update_id_ = g_timeout_add(META_UPDATE_DELAY_MS,
+						send_meta_update, NULL);
+	}
+}
+
+// Pick up sample rate and duration once the stream is set up.
+static void update_stream_properties(void) {
+#if (GST_VERSION_MAJOR >= 1)
+	int changes = 0;
+	GstPad *stream_pad = NULL;
+	g_signal_emit_by_name(player_, "get-audio-pad", 0, &stream_pad);
+	if (stream_pad != NULL) {
+		GstCaps *caps = gst_pad_get_current_caps(stream_pad);
+		gint rate = 0;
+		if (caps != NULL && gst_caps_get_size(caps) > 0
+		    && gst_structure_get_int(gst_caps_get_structure(caps, 0),
+					     "rate", &rate)
+		    && rate != song_meta_.sample_rate) {
+			song_meta_.sample_rate = rate;
+			changes++;
 		}
+		if (caps) gst_caps_unref(caps);
+		gst_object_unref(stream_pad);
 	}
+	gint64 duration = 0;
+	if (gst_element_query_duration(player_, GST_FORMAT_TIME, &duration)
+	    && duration > 0
+	    && duration / GST_MSECOND != song_meta_.duration_ms) {
+		song_meta_.duration_ms = duration / GST_MSECOND;
+		changes++;
+	}
+	if (changes) {
+		update_track_stats(NULL);
+		schedule_meta_update();
+	}
+#endif
 }
 
 static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
@@ -312,9 +1123,12 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 			free(gsuri_);
 			gsuri_ = gs_next_uri_;
 			gs_next_uri_ = NULL;
-			gst_element_set_state(player_, GST_STATE_READY);
-			g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
-			gst_element_set_state(player_, GST_STATE_PLAYING);
+			if (switch_to_new_stream()
+			    && gst_element_set_state(player_,
+						     GST_STATE_PLAYING)
+			    == GST_STATE_CHANGE_FAILURE) {
+				finish_warm_switch();
+			}
 			if (play_trans_callback_) {
 				play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
 			}
@@ -331,15 +1145,65 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 
 		Log_error("gstreamer", "%s: Error: %s (Debug: %s)",
 			  msgSrcName, err->message, debug);
+		const int negotiation_error =
+			g_error_matches(err, GST_CORE_ERROR,
+					GST_CORE_ERROR_NEGOTIATION)
+			|| g_error_matches(err, GST_STREAM_ERROR,
+					   GST_STREAM_ERROR_FORMAT);
 		g_error_free(err);
 		g_free(debug);
 
+		// The new stream won't get to PLAYING, so don't wait for
+		// that to hand the sink back to the pipeline.
+		finish_warm_switch();
+		if (bitperfect && !native_audio_fallback_ && negotiation_error
+		    && gsuri_ != NULL) {
+			// The device can't play this format natively. Let
+			// playbin convert, but only for this stream.
+			Log_error("gstreamer", "Native format not supported by "
+				  "sink; falling back to conversion.");
+			native_audio_fallback_ = 1;
+			gst_element_set_state(player_, GST_STATE_READY);
+			set_playbin_flag(PLAY_FLAG_NATIVE_AUDIO, 0);
+			if (start_current_stream()) {
+				gst_element_set_state(player_,
+						      GST_STATE_PLAYING);
+			}
+		} else {
+			// The pipeline is stuck after an error; let the
+			// controlling layer know that nothing is playing.
+			gst_element_set_state(player_, GST_STATE_READY);
+			if (play_trans_callback_) {
+				play_trans_callback_(PLAY_STOPPED);
+			}
+		}
 		break;
 	}
 	case GST_MESSAGE_STATE_CHANGED: {
 		GstState oldstate, newstate, pending;
 		gst_message_parse_state_changed(msg, &oldstate, &newstate,
 						&pending);
+		if (msgSrc == GST_OBJECT(player_)) {
+			char transition[32];
+			snprintf(transition, sizeof(transition), "%s -> %s",
+				 gststate_get_name(oldstate),
+				 gststate_get_name(newstate));
+			trace_instant("state", transition);
+		}
+		if (msgSrc == GST_OBJECT(player_)
+		    && newstate == GST_STATE_PLAYING) {
+			finish_warm_switch();
+#if (GST_VERSION_MAJOR < 1)
+			// No first buffer probe; PLAYING is close enough.
+			const int64_t start = __atomic_exchange_n(
+				&uri_set_time_, 0, __ATOMIC_SEQ_CST);
+			if (start != 0) {
+				metrics_observe_usec(track_start_metric_,
+						     metrics_now_usec() - start);
+			}
+#endif
+			track_playing_ = 1;
+		}
 		/*
 		g_print("GStreamer: %s: State change: '%s' -> '%s', "
 			"PENDING: '%s'\n", msgSrcName,
@@ -350,39 +1214,101 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 		break;
 	}
 
+#if (GST_VERSION_MAJOR >= 1)
+	case GST_MESSAGE_STREAM_START:
+		free(stream_uri_);
+		stream_uri_ = gsuri_ ? strdup(gsuri_) : NULL;
+		inject_cached_replaygain();
+		log_track_stats();
+		g_mutex_lock(&track_stats_mutex_);
+		memset(&track_stats_, 0, sizeof(track_stats_));
+		track_stats_.start_time = g_get_monotonic_time();
+		g_mutex_unlock(&track_stats_mutex_);
+		update_track_stats(NULL);
+		break;
+
+	case GST_MESSAGE_ASYNC_DONE:
+	case GST_MESSAGE_DURATION_CHANGED:
+		update_stream_properties();
+		break;
+#endif
+
 	case GST_MESSAGE_TAG: {
 		GstTagList *tags = NULL;
 
-		if (meta_update_callback_ != NULL) {
+		if (replaygain_filter_ != NULL) {
 			gst_message_parse_tag(msg, &tags);
-			/*g_print("GStreamer: Got tags from element %s\n",
-				GST_OBJECT_NAME (msg->src));
-			*/
-			struct MetaModify modify;
-			modify.meta = &song_meta_;
-			modify.any_change = 0;
-			gst_tag_list_foreach(tags, &MetaModify_add_tag, &modify);
+			remember_replaygain(tags);
 			gst_tag_list_free(tags);
-			if (modify.any_change) {
-				meta_update_callback_(&song_meta_);
+			tags = NULL;
+		}
+		gst_message_parse_tag(msg, &tags);
+		/*g_print("GStreamer: Got tags from element %s\n",
+			GST_OBJECT_NAME (msg->src));
+		*/
+		struct MetaModify modify;
+		memset(&modify, 0, sizeof(modify));
+		gst_tag_list_foreach(tags, &MetaModify_add_tag, &modify);
+		g_mutex_lock(&track_stats_mutex_);
+		track_stats_.tag_messages++;
+		g_mutex_unlock(&track_stats_mutex_);
+		const guint hash = MetaModify_hash(&modify);
+		if (modify.any_value && hash != last_tags_hash_) {
+			last_tags_hash_ = hash;
+			if (MetaModify_apply(&modify, &song_meta_)) {
+				schedule_meta_update();
 			}
 		}
+		update_track_stats(&modify);
+		gst_tag_list_free(tags);
 		break;
 	}
 
 	case GST_MESSAGE_BUFFERING:
         {
-                if (buffer_duration <= 0.0) break;  /* nothing to buffer */
+                if (buffering_ == NULL) break;  /* nothing to buffer */
 
                 gint percent = 0;
                 gst_message_parse_buffering (msg, &percent);
-
-
-                /* Pause playback until buffering is complete. */
-                if (percent < 100)
-                        gst_element_set_state(player_, GST_STATE_PAUSED);
-                else
-                        gst_element_set_state(player_, GST_STATE_PLAYING);
+		gint avg_in = -1, avg_out = -1;
+		gint64 buffering_left = -1;
+		gst_message_parse_buffering_stats(msg, NULL, &avg_in, &avg_out,
+						  &buffering_left);
+
+		metrics_add(buffering_messages_metric_, 1);
+		g_mutex_lock(&buffering_mutex_);
+		const enum buffering_action action
+			= Buffering_update(buffering_, percent, avg_in);
+		g_mutex_unlock(&buffering_mutex_);
+		switch (action) {
+		case BUFFERING_HOLD:
+			// The previous stream is still playing; see
+			// hold_incoming_stream().
+			if (g_atomic_int_get(&incoming_stream_))
+				break;
+			if (want_playing_)
+				gst_element_set_state(player_,
+						      GST_STATE_PAUSED);
+			if (hold_start_ == 0)
+				hold_start_ = metrics_now_usec();
+			break;
+		case BUFFERING_RELEASE:
+			if (want_playing_)
+				gst_element_set_state(player_,
+						      GST_STATE_PLAYING);
+			if (hold_start_ != 0)
+				trace_span("buffering", hold_start_, NULL);
+			// The initial fill is part of the track start time.
+			if (hold_start_ != 0 && track_playing_) {
+				metrics_observe_usec(rebuffer_metric_,
+						     metrics_now_usec()
+						     - hold_start_);
+			}
+			hold_start_ = 0;
+			break;
+		case BUFFERING_NO_CHANGE:
+			break;
+		}
 		break;
         }
 	default:
@@ -401,6 +1327,9 @@ static gchar *audio_device = NULL;
 static gchar *audio_pipe = NULL;
 static gchar *videosink = NULL;
 static double initial_db = 0.0;
+static int volume_ramp_ms = 50;
+static gchar *replaygain_mode = NULL;
+static double replaygain_preamp = 0.0;
 
 /* Options specific to output_gstreamer */
 static GOptionEntry option_entries[] = {
@@ -422,9 +1351,58 @@ static GOptionEntry option_entries[] = {
         { "gstout-buffer-duration", 0, 0, G_OPTION_ARG_DOUBLE, &buffer_duration,
           "The size of the buffer in seconds. Set to zero to disable buffering.",
           NULL },
+        { "gstout-buffer-min-duration", 0, 0, G_OPTION_ARG_DOUBLE,
+          &buffer_min_duration,
+          "Lower bound in seconds the buffer size adapts to on stable "
+          "connections (default: 1s or buffer-duration if smaller).", NULL },
+        { "gstout-buffer-max-duration", 0, 0, G_OPTION_ARG_DOUBLE,
+          &buffer_max_duration,
+          "Upper bound in seconds the buffer size grows to on unreliable "
+          "connections (default: 4 x buffer-duration).", NULL },
+        { "gstout-buffer-start-percent", 0, 0, G_OPTION_ARG_INT,
+          &buffer_start_percent,
+          "Start playing a new stream once the buffer is filled that "
+          "many percent (default 100).", NULL },
+        { "gstout-buffer-low-percent", 0, 0, G_OPTION_ARG_INT,
+          &buffer_low_percent,
+          "Pause to rebuffer if the buffer drops below that many percent "
+          "while playing (default 10).", NULL },
+        { "gstout-buffer-resume-percent", 0, 0, G_OPTION_ARG_INT,
+          &buffer_resume_percent,
+          "Resume after rebuffering once filled that many percent "
+          "(default 100).", NULL },
+        { "gstout-buffer-fast-start", 0, 0, G_OPTION_ARG_DOUBLE,
+          &buffer_fast_start,
+          "Fast-start: begin playing once that many seconds are buffered "
+          "and keep filling the buffer while playing (default 0: off).",
+          NULL },
+        { "gstout-http-connections", 0, 0, G_OPTION_ARG_INT,
+          &http_connections,
+          "Fetch http:// media with that many parallel range requests "
+          "to keep up on high-latency links (default 0: off). Live streams "
+          "and servers without range support are fetched as usual.", NULL },
         { "gstout-initial-volume-db", 0, 0, G_OPTION_ARG_DOUBLE, &initial_db,
           "GStreamer initial volume in decibel (e.g. 0.0 = max; -6 = 1/2 max) ",
 	  NULL },
+        { "gstout-volume-ramp-ms", 0, 0, G_OPTION_ARG_INT, &volume_ramp_ms,
+          "Length of the ramp in milliseconds to smoothly apply volume "
+          "changes; 0 changes volume instantly.", NULL },
+        { "gstout-warm-pipeline", 0, 0, G_OPTION_ARG_NONE, &warm_pipeline,
+          "Keep the audio sink open and running when switching tracks; "
+          "only source and decoder are set up anew.", NULL },
+        { "gstout-bitperfect", 0, 0, G_OPTION_ARG_NONE, &bitperfect,
+          "Send audio to the sink in the stream's native format without "
+          "conversion or resampling; only convert if the sink can't play "
+          "it. No software volume: use with a hardware --mixer.", NULL },
+        { "gstout-replaygain", 0, 0, G_OPTION_ARG_STRING, &replaygain_mode,
+          "ReplayGain loudness normalization: off (default), track, album "
+          "or analyze (compute gain of untagged tracks; remembered per URI). "
+          "Switched at runtime with the RenderingControl Loudness variable.",
+          NULL },
+        { "gstout-replaygain-preamp", 0, 0, G_OPTION_ARG_DOUBLE,
+          &replaygain_preamp,
+          "Pre-amp in decibel applied on top of the ReplayGain.",
+          NULL },
         { NULL }
 };
 
@@ -473,16 +1451,120 @@ static int output_gstreamer_get_position(gint64 *track_duration,
 	return rc;
 }
 
+static double target_element_volume(void) {
+	const float left = channel_volume_[OUTPUT_CHANNEL_LEFT];
+	const float right = channel_volume_[OUTPUT_CHANNEL_RIGHT];
+	const double volume = master_volume_ * ((left > right) ? left : right);
+	return (volume < MAX_ELEMENT_VOLUME) ? volume : MAX_ELEMENT_VOLUME;
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Called in the streaming thread; remember where the volume element is.
+static GstPadProbeReturn track_volume_stream_time(GstPad *pad,
+						  GstPadProbeInfo *info,
+						  gpointer user_data) {
+	g_mutex_lock(&volume_mutex_);
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+			volume_stream_time_ = gst_segment_to_stream_time(
+				&volume_segment_, GST_FORMAT_TIME,
+				GST_BUFFER_PTS(buffer));
+		}
+	} else {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+		if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+			gst_event_copy_segment(event, &volume_segment_);
+			volume_stream_time_ = GST_CLOCK_TIME_NONE;
+		}
+	}
+	g_mutex_unlock(&volume_mutex_);
+	return GST_PAD_PROBE_OK;
+}
+
+// Once the ramp is done, remove the control points and set the final
+// value, so that it stays after seeks and stream changes.
+static gboolean finish_volume_ramp(gpointer user_data) {
+	volume_ramp_finish_id_ = 0;
+	gst_timed_value_control_source_unset_all(
+		GST_TIMED_VALUE_CONTROL_SOURCE(volume_ramp_));
+	g_object_set(volume_, "volume", target_element_volume(), NULL);
+	return FALSE;
+}
+#endif
+
+// Runs in the main loop VOLUME_BATCH_MS after the first of a burst of
+// volume changes and ramps to the latest target.
+static gboolean update_element_volume(gpointer user_data) {
+	g_mutex_lock(&volume_mutex_);
+	volume_update_pending_ = 0;
+	const GstClockTime now = volume_stream_time_;
+	g_mutex_unlock(&volume_mutex_);
+
+	const double target = target_element_volume();
+#if (GST_VERSION_MAJOR >= 1)
+	if (volume_ramp_ != NULL && volume_ramp_ms > 0
+	    && GST_CLOCK_TIME_IS_VALID(now)) {
+		gdouble current;
+		if (!gst_control_source_get_value(volume_ramp_, now,
+						  &current)) {
+			double volume;
+			g_object_get(volume_, "volume", &volume, NULL);
+			current = volume / MAX_ELEMENT_VOLUME;
+		}
+		GstTimedValueControlSource *ramp =
+			GST_TIMED_VALUE_CONTROL_SOURCE(volume_ramp_);
+		gst_timed_value_control_source_unset_all(ramp);
+		gst_timed_value_control_source_set(ramp, now, current);
+		gst_timed_value_control_source_set(
+			ramp, now + volume_ramp_ms * GST_MSECOND,
+			target / MAX_ELEMENT_VOLUME);
+		if (volume_ramp_finish_id_ != 0) {
+			g_source_remove(volume_ramp_finish_id_);
+		}
+		// Some slack, the streaming thread might be a bit behind.
+		volume_ramp_finish_id_ = g_timeout_add(volume_ramp_ms + 100,
+						       finish_volume_ramp,
+						       NULL);
+		return FALSE;
+	}
+	if (volume_ramp_ != NULL) {
+		gst_timed_value_control_source_unset_all(
+			GST_TIMED_VALUE_CONTROL_SOURCE(volume_ramp_));
+	}
+#endif
+	g_object_set(volume_, "volume", target, NULL);
+	return FALSE;
+}
+
+static void schedule_volume_update(void) {
+	g_mutex_lock(&volume_mutex_);
+	if (!volume_update_pending_) {
+		volume_update_pending_ = 1;
+		g_timeout_add(VOLUME_BATCH_MS, update_element_volume, NULL);
+	}
+	g_mutex_unlock(&volume_mutex_);
+}
+
 static int output_gstreamer_get_volume(float *v) {
 	double volume;
-	g_object_get(player_, "volume", &volume, NULL);
+	if (volume_ != NULL) {
+		volume = master_volume_;
+	} else {
+		g_object_get(player_, "volume", &volume, NULL);
+	}
 	Log_info("gstreamer", "Query volume fraction: %f", volume);
 	*v = volume;
 	return 0;
 }
 static int output_gstreamer_set_volume(float value) {
 	Log_info("gstreamer", "Set volume fraction to %f", value);
-	g_object_set(player_, "volume", (double) value, NULL);
+	if (volume_ != NULL) {
+		master_volume_ = value;
+		schedule_volume_update();
+	} else {
+		g_object_set(player_, "volume", (double) value, NULL);
+	}
 	return 0;
 }
 static int output_gstreamer_get_mute(int *m) {
@@ -497,17 +1579,431 @@ static int output_gstreamer_set_mute(int m) {
 	return 0;
 }
 
+static void apply_channel_volume(void) {
+	const float left = channel_volume_[OUTPUT_CHANNEL_LEFT];
+	const float right = channel_volume_[OUTPUT_CHANNEL_RIGHT];
+	const float level = (left > right) ? left : right;
+	float panorama = 0.0;
+	if (level > 0) {
+		// "simple" method: positive values attenuate the left channel,
+		// negative the right one.
+		panorama = (left < right) ? 1 - left / level
+			: -(1 - right / level);
+	}
+	g_object_set(balance_panorama_, "panorama", panorama, NULL);
+	schedule_volume_update();
+}
+
+static int output_gstreamer_get_channel_volume(enum output_channel channel,
+					       float *v) {
+	if (balance_panorama_ == NULL)
+		return -1;
+	*v = channel_volume_[channel];
+	return 0;
+}
+static int output_gstreamer_set_channel_volume(enum output_channel channel,
+					       float value) {
+	if (balance_panorama_ == NULL)
+		return -1;
+	Log_info("gstreamer", "Set %s channel volume fraction to %f",
+		 channel == OUTPUT_CHANNEL_LEFT ? "left" : "right", value);
+	channel_volume_[channel] = value;
+	apply_channel_volume();
+	return 0;
+}
+
+// Wrap the given audio sink (or autoaudiosink if NULL) into a bin with the
+// per-channel volume stage in front. Returns the sink unchanged if the
+// stage can't be built.
+static GstElement *make_balance_sink(GstElement *sink) {
+	if (sink == NULL) {
+		sink = gst_element_factory_make("autoaudiosink", NULL);
+		if (sink == NULL)
+			return NULL;  // Let playbin figure it out.
+	}
+	GstElement *convert_in = gst_element_factory_make("audioconvert", NULL);
+	GstElement *volume = gst_element_factory_make("volume", NULL);
+	GstElement *panorama = gst_element_factory_make("audiopanorama", NULL);
+	GstElement *convert_out = gst_element_factory_make("audioconvert",
+							   NULL);
+	if (!convert_in || !volume || !panorama || !convert_out) {
+		Log_error("gstreamer", "Can't create audiopanorama; "
+			  "per-channel volume not available.");
+		if (convert_in) gst_object_unref(convert_in);
+		if (volume) gst_object_unref(volume);
+		if (panorama) gst_object_unref(panorama);
+		if (convert_out) gst_object_unref(convert_out);
+		return sink;
+	}
+	g_object_set(G_OBJECT(panorama), "method", 1 /* simple */, NULL);
+
+	GstElement *bin = gst_bin_new("balance-sink");
+	gst_bin_add_many(GST_BIN(bin), convert_in, volume, panorama,
+			 convert_out, sink, NULL);
+	if (!gst_element_link_many(convert_in, volume, panorama,
+				   convert_out, sink, NULL)) {
+		Log_error("gstreamer", "Can't link per-channel volume stage.");
+		gst_object_unref(bin);
+		return NULL;
+	}
+	GstPad *pad = gst_element_get_static_pad(convert_in, "sink");
+	gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+	gst_object_unref(pad);
+
+	volume_ = volume;
+	balance_panorama_ = panorama;
+	apply_channel_volume();
+#if (GST_VERSION_MAJOR >= 1)
+	if (volume_ramp_ms > 0) {
+		volume_ramp_ = gst_interpolation_control_source_new();
+		g_object_set(volume_ramp_, "mode",
+			     GST_INTERPOLATION_MODE_LINEAR, NULL);
+		gst_object_add_control_binding(
+			GST_OBJECT(volume),
+			gst_direct_control_binding_new(GST_OBJECT(volume),
+						       "volume", volume_ramp_));
+		gst_segment_init(&volume_segment_, GST_FORMAT_TIME);
+		pad = gst_element_get_static_pad(volume, "sink");
+		gst_pad_add_probe(pad, (GstPadProbeType)
+				  (GST_PAD_PROBE_TYPE_BUFFER
+				   | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+				  track_volume_stream_time, NULL, NULL);
+		gst_object_unref(pad);
+	}
+#endif
+	return bin;
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Runs in the main loop once the stream-start of a gapless next stream
+// reached the sink: do the hold we skipped while the previous stream was
+// playing out, if its buffer is still not filled enough.
+static gboolean hold_incoming_stream(gpointer user_data) {
+	(void)user_data;
+	if (buffering_ == NULL)
+		return FALSE;
+	struct buffering_stats stats;
+	g_mutex_lock(&buffering_mutex_);
+	Buffering_get_stats(buffering_, &stats);
+	g_mutex_unlock(&buffering_mutex_);
+	if (stats.is_holding) {
+		if (want_playing_)
+			gst_element_set_state(player_, GST_STATE_PAUSED);
+		if (hold_start_ == 0)
+			hold_start_ = metrics_now_usec();
+	}
+	return FALSE;
+}
+
+static gboolean watch_sink_caps(gpointer user_data);
+
+// Note the first buffer of each track arriving at the audio sink. A new
+// track only counts from its stream-start event on: at about-to-finish or
+// when the URI is changed while playing, the buffers of the previous track
+// are still on their way to the sink.
+static GstPadProbeReturn trace_first_buffer(GstPad *pad,
+					    GstPadProbeInfo *info,
+					    gpointer user_data) {
+	(void)pad;
+	(void)user_data;
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+		if (GST_EVENT_TYPE(event) == GST_EVENT_STREAM_START) {
+			gchar *uri = __atomic_exchange_n(&incoming_uri_, NULL,
+							 __ATOMIC_SEQ_CST);
+			if (uri != NULL) {
+				trace_new_track(uri);
+				g_free(uri);
+			}
+			g_atomic_int_set(&first_buffer_seen_, 0);
+			if (g_atomic_int_compare_and_exchange(
+				    &incoming_stream_, 1, 0)) {
+				g_idle_add(hold_incoming_stream, NULL);
+			}
+			g_idle_add(watch_sink_caps, NULL);
+		}
+	} else if (g_atomic_int_get(&first_buffer_seen_) == 0) {
+		g_atomic_int_set(&first_buffer_seen_, 1);
+		trace_instant("first-buffer", NULL);
+		trace_since_track_start("time-to-first-audio");
+		// Only for a URI that was set; gapless next tracks have no
+		// start time.
+		const int64_t start = __atomic_exchange_n(&uri_set_time_, 0,
+							  __ATOMIC_SEQ_CST);
+		if (start != 0) {
+			metrics_observe_usec(track_start_metric_,
+					     metrics_now_usec() - start);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+#endif
+
+static void output_gstreamer_disable_volume(void) {
+	Log_info("gstreamer", "Hardware mixer in use; no software volume.");
+	software_volume_ = 0;
+}
+
+// Append "<rate>Hz <format> <n>ch" of the given caps to the string.
+static void append_audio_format(GString *out, GstCaps *caps) {
+	const GstStructure *structure = NULL;
+	if (caps != NULL && gst_caps_get_size(caps) > 0) {
+		structure = gst_caps_get_structure(caps, 0);
+	}
+	int rate = 0, channels = 0;
+	const char *format = NULL;
+	if (structure != NULL) {
+		gst_structure_get_int(structure, "rate", &rate);
+		gst_structure_get_int(structure, "channels", &channels);
+		format = gst_structure_get_string(structure, "format");
+	}
+	if (rate == 0) {
+		g_string_append(out, "unknown");
+		return;
+	}
+	g_string_append_printf(out, "%dHz %s %dch", rate,
+			       format ? format : "?", channels);
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// The element the samples finally end up in. Our audio sink is often a bin
+// (software volume stage, --gstout-audiopipe, autoaudiosink) that might
+// convert internally, so the caps at its ghost pad don't tell. Returns a
+// new reference.
+static GstElement *find_real_sink(GstElement *element) {
+	gst_object_ref(element);
+	while (GST_IS_BIN(element)) {
+		GstIterator *it = gst_bin_iterate_sinks(GST_BIN(element));
+		GValue item = G_VALUE_INIT;
+		GstElement *child = NULL;
+		if (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+			child = GST_ELEMENT(g_value_dup_object(&item));
+			g_value_unset(&item);
+		}
+		gst_iterator_free(it);
+		if (child == NULL)
+			break;
+		gst_object_unref(element);
+		element = child;
+	}
+	return element;
+}
+#endif
+
+// Runs in the main loop: compare the format of the stream with what the
+// sink gets and tell the controlling layer if it changed.
+static gboolean report_output_format(gpointer user_data) {
+	format_report_pending_ = 0;
+	if (audio_sink_element_ == NULL)
+		return FALSE;
+#if (GST_VERSION_MAJOR >= 1)
+	GstPad *stream_pad = NULL;
+	g_signal_emit_by_name(player_, "get-audio-pad", 0, &stream_pad);
+	GstCaps *stream_caps = NULL;
+	if (stream_pad != NULL) {
+		stream_caps = gst_pad_get_current_caps(stream_pad);
+		gst_object_unref(stream_pad);
+	}
+	GstElement *real_sink = find_real_sink(audio_sink_element_);
+	GstPad *sink_pad = gst_element_get_static_pad(real_sink, "sink");
+	gst_object_unref(real_sink);
+	GstCaps *sink_caps = NULL;
+	if (sink_pad != NULL) {
+		sink_caps = gst_pad_get_current_caps(sink_pad);
+		gst_object_unref(sink_pad);
+	}
+	if (sink_caps == NULL) {
+		if (stream_caps) gst_caps_unref(stream_caps);
+		return FALSE;  // Not negotiated (yet).
+	}
+
+	GString *report = g_string_new("stream ");
+	append_audio_format(report, stream_caps);
+	g_string_append(report, "; output ");
+	append_audio_format(report, sink_caps);
+	const int unchanged = (stream_caps != NULL
+			       && gst_caps_is_equal(stream_caps, sink_caps));
+	g_string_append(report, unchanged ? " (bit-perfect)" : " (converted)");
+	if (stream_caps) gst_caps_unref(stream_caps);
+	gst_caps_unref(sink_caps);
+
+	if (last_format_report_ == NULL
+	    || strcmp(last_format_report_, report->str) != 0) {
+		Log_info("gstreamer", "Audio format: %s", report->str);
+		g_free(last_format_report_);
+		last_format_report_ = g_strdup(report->str);
+		if (format_callback_) {
+			format_callback_(last_format_report_);
+		}
+	}
+	g_string_free(report, TRUE);
+#endif
+	return FALSE;
+}
+
+// Called from the streaming thread whenever the sink gets new caps.
+static void sink_caps_changed(GObject *pad, GParamSpec *pspec,
+			      gpointer user_data) {
+	if (!format_report_pending_) {
+		format_report_pending_ = 1;
+		g_idle_add(report_output_format, NULL);
+	}
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Runs in the main loop: watch the caps at the sink pad of the element
+// the samples end up in (see find_real_sink()). Elements like
+// autoaudiosink only create that element when they get ready, so this is
+// checked again whenever a stream arrives at the sink.
+static gboolean watch_sink_caps(gpointer user_data) {
+	if (audio_sink_element_ == NULL)
+		return FALSE;
+	GstElement *real_sink = find_real_sink(audio_sink_element_);
+	GstPad *pad = gst_element_get_static_pad(real_sink, "sink");
+	gst_object_unref(real_sink);
+	if (pad == NULL || pad == caps_watch_pad_) {
+		if (pad) gst_object_unref(pad);
+		return FALSE;
+	}
+	if (caps_watch_pad_ != NULL) {
+		g_signal_handler_disconnect(caps_watch_pad_,
+					    caps_watch_handler_);
+		gst_object_unref(caps_watch_pad_);
+	}
+	caps_watch_pad_ = pad;
+	caps_watch_handler_ = g_signal_connect(G_OBJECT(pad), "notify::caps",
+					       G_CALLBACK(sink_caps_changed),
+					       NULL);
+	// The caps might have been set before we got here.
+	sink_caps_changed(G_OBJECT(pad), NULL, NULL);
+	return FALSE;
+}
+#endif
+
+static void output_gstreamer_set_format_callback(output_format_cb_t cb) {
+	format_callback_ = cb;
+	if (cb != NULL && last_format_report_ != NULL) {
+		cb(last_format_report_);
+	}
+}
+
+static int output_gstreamer_get_buffering_stats(struct buffering_stats *s) {
+	if (buffering_ == NULL)
+		return -1;
+	g_mutex_lock(&buffering_mutex_);
+	Buffering_get_stats(buffering_, s);
+	g_mutex_unlock(&buffering_mutex_);
+	return 0;
+}
+
+static int output_gstreamer_get_track_stats(struct track_stats *s) {
+	g_mutex_lock(&track_stats_mutex_);
+	*s = track_stats_;
+	g_mutex_unlock(&track_stats_mutex_);
+	return s->start_time == 0 ? -1 : 0;
+}
+
+static int output_gstreamer_get_loudness(int *l) {
+	*l = loudness_enabled_;
+	return 0;
+}
+static int output_gstreamer_set_loudness(int l) {
+	if (replaygain_filter_ == NULL) {
+		return -1;
+	}
+	Log_info("gstreamer", "Set loudness normalization %s "
+		 "(effective with next stream)", l ? "on" : "off");
+	loudness_enabled_ = l;
+	return 0;
+}
+
+// Build "[rganalysis !] audioconvert ! rgvolume ! rglimiter ! audioconvert"
+// to be used as audio-filter in playbin. Returns NULL on failure.
+static GstElement *make_replaygain_filter(const char *mode) {
+	const int analyze = (strcmp(mode, "analyze") == 0);
+	if (!analyze && strcmp(mode, "track") != 0
+	    && strcmp(mode, "album") != 0) {
+		Log_error("gstreamer", "Unknown --gstout-replaygain mode '%s'",
+			  mode);
+		return NULL;
+	}
+	GstElement *bin = gst_bin_new("replaygain");
+	GstElement *analysis = analyze
+		? gst_element_factory_make("rganalysis", NULL) : NULL;
+	GstElement *convert_in = gst_element_factory_make("audioconvert", NULL);
+	GstElement *volume = gst_element_factory_make("rgvolume", NULL);
+	GstElement *limiter = gst_element_factory_make("rglimiter", NULL);
+	GstElement *convert_out = gst_element_factory_make("audioconvert",
+							   NULL);
+	if (!convert_in || !volume || !limiter || !convert_out
+	    || (analyze && !analysis)) {
+		Log_error("gstreamer", "Can't create ReplayGain elements; "
+			  "gst-plugins-good installed ?");
+		gst_object_unref(bin);
+		return NULL;
+	}
+	g_object_set(G_OBJECT(volume),
+		     "album-mode", (gboolean) (strcmp(mode, "album") == 0),
+		     "pre-amp", replaygain_preamp,
+		     NULL);
+	GstElement *first = convert_in;
+	gst_bin_add_many(GST_BIN(bin), convert_in, volume, limiter,
+			 convert_out, NULL);
+	if (analysis) {
+		// Don't analyze tracks that already come with a gain.
+		g_object_set(G_OBJECT(analysis), "forced", FALSE, NULL);
+		gst_bin_add(GST_BIN(bin), analysis);
+		if (gst_element_link(analysis, convert_in)) {
+			first = analysis;
+		} else {
+			Log_error("gstreamer", "Can't link rganalysis; "
+				  "playing without analysis.");
+			gst_bin_remove(GST_BIN(bin), analysis);
+		}
+	}
+	if (!gst_element_link_many(convert_in, volume, limiter,
+				   convert_out, NULL)) {
+		Log_error("gstreamer", "Can't link ReplayGain elements.");
+		gst_object_unref(bin);
+		return NULL;
+	}
+	GstPad *pad = gst_element_get_static_pad(first, "sink");
+	gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+	gst_object_unref(pad);
+	pad = gst_element_get_static_pad(convert_out, "src");
+	gst_element_add_pad(bin, gst_ghost_pad_new("src", pad));
+	gst_object_unref(pad);
+
+	// We keep our own reference: playbin drops it when the loudness is
+	// switched off.
+	gst_object_ref_sink(bin);
+	return bin;
+}
+
 static void prepare_next_stream(GstElement *obj, gpointer userdata) {
 	(void)obj;
 	(void)userdata;
 
 	Log_info("gstreamer", "about-to-finish cb: setting uri %s",
 		 gs_next_uri_);
+	trace_instant("about-to-finish", NULL);
 	free(gsuri_);
 	gsuri_ = gs_next_uri_;
 	gs_next_uri_ = NULL;
 	if (gsuri_ != NULL) {
-		g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
+		// Playbin sets up the next source after we return; it must
+		// not inherit the state of the stream that is ending.
+#if (GST_VERSION_MAJOR >= 1)
+		g_free(__atomic_exchange_n(&incoming_uri_, g_strdup(gsuri_),
+					   __ATOMIC_SEQ_CST));
+		g_atomic_int_set(&incoming_stream_, 1);
+#else
+		trace_new_track(gsuri_);
+#endif
+		start_stream_buffering();
+		// Only use the prefetch if it is ready; we are holding up
+		// the streaming thread here.
+		set_player_uri(gsuri_, &next_request_);
 		if (play_trans_callback_) {
 			// TODO(hzeller): can we figure out when we _actually_
 			// start playing this ? there are probably a couple
@@ -522,8 +2018,20 @@ static int output_gstreamer_init(void)
 	GstBus *bus;
 
 	SongMetaData_init(&song_meta_);
+	init_meta_tags();
 	scan_mime_list();
 
+	buffering_messages_metric_ = metrics_counter(
+		"gmrender_buffering_messages_total",
+		"Buffering messages received from GStreamer.", NULL);
+	rebuffer_metric_ = metrics_histogram(
+		"gmrender_rebuffer_duration_seconds",
+		"Time playback paused to rebuffer.", NULL);
+	track_start_metric_ = metrics_histogram(
+		"gmrender_track_start_seconds",
+		"Time from setting a new URI to its first audio at the sink.",
+		NULL);
+
 #if (GST_VERSION_MAJOR < 1)
 	const char player_element_name[] = "playbin2";
 #else
@@ -543,6 +2051,17 @@ static int output_gstreamer_init(void)
                              "buffer-duration",
                              buffer_duration_ns,
                              NULL);
+		struct buffering_config config;
+		config.min_duration = buffer_min_duration > 0
+			? buffer_min_duration
+			: (buffer_duration < 1.0 ? buffer_duration : 1.0);
+		config.max_duration = buffer_max_duration > 0
+			? buffer_max_duration : 4 * buffer_duration;
+		config.start_percent = buffer_start_percent;
+		config.low_percent = buffer_low_percent;
+		config.resume_percent = buffer_resume_percent;
+		config.fast_start_duration = buffer_fast_start;
+		buffering_ = Buffering_new(&config, buffer_duration);
         } else {
                 Log_info("gstreamer",
 			 "Buffering disabled (--gstout-buffer-duration)");
@@ -557,6 +2076,7 @@ static int output_gstreamer_init(void)
 		return 1;
 	}
 
+	GstElement *audio_out = NULL;
 	if (audio_sink != NULL) {
 		GstElement *sink = NULL;
 		Log_info("gstreamer", "Setting audio sink to %s; device=%s\n",
@@ -569,7 +2089,7 @@ static int output_gstreamer_init(void)
 		  if (audio_device != NULL) {
 		    g_object_set (G_OBJECT(sink), "device", audio_device, NULL);
 		  }
-		  g_object_set (G_OBJECT (player_), "audio-sink", sink, NULL);
+		  audio_out = sink;
 		}
 	}
 	if (audio_pipe != NULL) {
@@ -580,9 +2100,45 @@ static int output_gstreamer_init(void)
 		if (sink == NULL) {
 			Log_error("gstreamer", "Could not create pipeline.");
 		} else {
-			g_object_set (G_OBJECT (player_), "audio-sink", sink, NULL);
+			audio_out = sink;
+		}
+	}
+	if (bitperfect) {
+		Log_info("gstreamer", "Bit-perfect mode: no conversion, "
+			 "no software volume.");
+		software_volume_ = 0;
+		set_playbin_flag(PLAY_FLAG_NATIVE_AUDIO, 1);
+		if (audio_out == NULL) {
+			audio_out = gst_element_factory_make("autoaudiosink",
+							     NULL);
+		}
+	}
+	if (software_volume_) {
+		audio_out = make_balance_sink(audio_out);
+	} else {
+		// Keep playbin from inserting its own volume element.
+		set_playbin_flag(PLAY_FLAG_SOFT_VOLUME, 0);
+	}
+	if (audio_out != NULL) {
+		audio_sink_element_ = audio_out;
+		GstPad *pad = gst_element_get_static_pad(audio_out, "sink");
+		if (pad != NULL) {
+#if (GST_VERSION_MAJOR >= 1)
+			gst_pad_add_probe(pad, (GstPadProbeType)
+					  (GST_PAD_PROBE_TYPE_BUFFER
+					   | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+					  trace_first_buffer, NULL, NULL);
+#else
+			// Watch what format is negotiated with the sink.
+			g_signal_connect(G_OBJECT(pad), "notify::caps",
+					 G_CALLBACK(sink_caps_changed), NULL);
+#endif
+			gst_object_unref(pad);
 		}
 	}
+	if (audio_out != NULL) {
+		g_object_set (G_OBJECT (player_), "audio-sink", audio_out, NULL);
+	}
 	if (videosink != NULL) {
 		GstElement *sink = NULL;
 		Log_info("gstreamer", "Setting video sink to %s", videosink);
@@ -594,11 +2150,47 @@ static int output_gstreamer_init(void)
 	    GST_STATE_CHANGE_FAILURE) {
 		Log_error("gstreamer", "Error: pipeline doesn't become ready.");
 	}
+#if (GST_VERSION_MAJOR >= 1)
+	// Watch what format is negotiated with the sink.
+	watch_sink_caps(NULL);
+#endif
+
+	if (replaygain_mode != NULL && strcmp(replaygain_mode, "off") != 0
+	    && bitperfect) {
+		Log_error("gstreamer", "--gstout-replaygain is ignored in "
+			  "bit-perfect mode.");
+	} else if (replaygain_mode != NULL
+		   && strcmp(replaygain_mode, "off") != 0) {
+#if (GST_VERSION_MAJOR < 1)
+		Log_error("gstreamer", "--gstout-replaygain needs GStreamer 1.x");
+#else
+		replaygain_filter_ = make_replaygain_filter(replaygain_mode);
+		if (replaygain_filter_ != NULL) {
+			Log_info("gstreamer", "ReplayGain mode '%s', "
+				 "pre-amp %.1fdB", replaygain_mode,
+				 replaygain_preamp);
+			replaygain_cache_ = g_hash_table_new_full(
+				g_str_hash, g_str_equal, g_free, g_free);
+			loudness_enabled_ = 1;
+			apply_replaygain_filter();
+		}
+#endif
+	}
 
 	g_signal_connect(G_OBJECT(player_), "about-to-finish",
 			 G_CALLBACK(prepare_next_stream), NULL);
+	if (http_connections > 1) {
+#if (GST_VERSION_MAJOR < 1)
+		Log_error("gstreamer", "--gstout-http-connections needs "
+			  "GStreamer 1.x");
+		http_connections = 0;
+#else
+		g_signal_connect(G_OBJECT(player_), "source-setup",
+				 G_CALLBACK(setup_source), NULL);
+#endif
+	}
 	output_gstreamer_set_mute(0);
-	if (initial_db < 0) {
+	if (initial_db < 0 && software_volume_) {
 		output_gstreamer_set_volume(exp(initial_db / 20 * log(10)));
 	}
 
@@ -623,4 +2215,12 @@ struct output_module gstreamer_output = {
 	.set_volume  = output_gstreamer_set_volume,
 	.get_mute  = output_gstreamer_get_mute,
 	.set_mute  = output_gstreamer_set_mute,
+	.get_channel_volume = output_gstreamer_get_channel_volume,
+	.set_channel_volume = output_gstreamer_set_channel_volume,
+	.disable_volume = output_gstreamer_disable_volume,
+	.set_format_callback = output_gstreamer_set_format_callback,
+	.get_buffering_stats = output_gstreamer_get_buffering_stats,
+	.get_track_stats = output_gstreamer_get_track_stats,
+	.get_loudness = output_gstreamer_get_loudness,
+	.set_loudness = output_gstreamer_set_loudness,
 };
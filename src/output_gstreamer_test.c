@@ -0,0 +1,194 @@
+/* output_gstreamer_test.c - Test of the warm pipeline stream switch
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+// The sink handling is internal to the module, so the test is compiled
+// together with it. Plays a silent WAV file into a fakesink, then
+// switches to streams that fail and checks that the sink kept running for
+// the switch is handed back to the pipeline. Skipped (exit code 77) if
+// the GStreamer elements needed are not installed.
+#include "output_gstreamer.c"
+
+#define WAV_SECONDS 10
+#define WAV_RATE 8000
+#define WAIT_MS 5000
+
+static int failures = 0;
+
+static void put_le(FILE *out, unsigned value, int bytes) {
+	for (int i = 0; i < bytes; ++i) {
+		fputc((value >> (8 * i)) & 0xff, out);
+	}
+}
+
+// Write a mono 16 bit WAV file of silence.
+static int write_wav(const char *filename) {
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL)
+		return 0;
+	const unsigned data_size = WAV_SECONDS * WAV_RATE * 2;
+	fputs("RIFF", out);
+	put_le(out, 36 + data_size, 4);
+	fputs("WAVEfmt ", out);
+	put_le(out, 16, 4);
+	put_le(out, 1, 2);             // PCM
+	put_le(out, 1, 2);             // Channels
+	put_le(out, WAV_RATE, 4);
+	put_le(out, WAV_RATE * 2, 4);  // Bytes per second
+	put_le(out, 2, 2);             // Block align
+	put_le(out, 16, 2);            // Bits per sample
+	fputs("data", out);
+	put_le(out, data_size, 4);
+	for (unsigned i = 0; i < data_size; ++i) {
+		fputc(0, out);
+	}
+	return fclose(out) == 0;
+}
+
+// A file that no demuxer will take.
+static int write_garbage(const char *filename) {
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL)
+		return 0;
+	for (int i = 0; i < 65536; ++i) {
+		fputc('x', out);
+	}
+	return fclose(out) == 0;
+}
+
+static int is_playing(void) {
+	return get_current_player_state() == GST_STATE_PLAYING;
+}
+
+static int warm_switch_done(void) {
+	return !warm_switch_pending_;
+}
+
+// Run the main loop (bus messages) until the condition is true.
+static int run_until(int (*condition)(void)) {
+	const gint64 end = g_get_monotonic_time() + WAIT_MS * 1000;
+	while (!condition()) {
+		if (g_get_monotonic_time() > end)
+			return 0;
+		if (!g_main_context_iteration(NULL, FALSE))
+			g_usleep(1000);
+	}
+	return 1;
+}
+
+static void expect_sink_released(const char *good_uri, const char *bad_uri,
+				 const char *what) {
+	output_gstreamer_set_uri(good_uri, NULL);
+	output_gstreamer_play(NULL);
+	if (!run_until(is_playing)) {
+		fprintf(stderr, "%s: good stream doesn't play\n", what);
+		failures++;
+		output_gstreamer_stop();
+		return;
+	}
+
+	// The sink is playing, so this is a warm switch.
+	output_gstreamer_set_uri(bad_uri, NULL);
+	output_gstreamer_play(NULL);
+	if (!run_until(warm_switch_done)) {
+		fprintf(stderr, "%s: warm switch still pending\n", what);
+		failures++;
+	}
+	if (gst_element_is_locked_state(audio_sink_element_)) {
+		fprintf(stderr, "%s: sink still locked\n", what);
+		failures++;
+	}
+
+	// Stop must close the device.
+	output_gstreamer_stop();
+	GstState state = GST_STATE_VOID_PENDING;
+	gst_element_get_state(audio_sink_element_, &state, NULL,
+			      GST_CLOCK_TIME_NONE);
+	if (state > GST_STATE_READY) {
+		fprintf(stderr, "%s: sink still %s after stop\n", what,
+			gststate_get_name(state));
+		failures++;
+	}
+}
+
+int main(int argc, char *argv[]) {
+#if (GST_VERSION_MAJOR < 1)
+	return 77;  // No warm pipeline.
+#else
+	gst_init(&argc, &argv);
+	static const char *const needed[] = {
+		"playbin", "fakesink", "filesrc", "wavparse", "audioconvert",
+		"volume", "audiopanorama", NULL };
+	for (const char *const *name = needed; *name; ++name) {
+		GstElementFactory *factory = gst_element_factory_find(*name);
+		if (factory == NULL) {
+			fprintf(stderr, "No '%s' element; skipping.\n", *name);
+			return 77;
+		}
+		gst_object_unref(factory);
+	}
+
+	char *dir = g_dir_make_tmp("gmrender-test-XXXXXX", NULL);
+	if (dir == NULL)
+		return 1;
+	char *wav = g_build_filename(dir, "silence.wav", NULL);
+	char *garbage = g_build_filename(dir, "garbage.wav", NULL);
+	char *missing = g_build_filename(dir, "missing.wav", NULL);
+	if (!write_wav(wav) || !write_garbage(garbage))
+		return 1;
+	char *wav_uri = g_filename_to_uri(wav, NULL, NULL);
+	char *garbage_uri = g_filename_to_uri(garbage, NULL, NULL);
+	char *missing_uri = g_filename_to_uri(missing, NULL, NULL);
+
+	audio_sink = g_strdup("fakesink");
+	warm_pipeline = TRUE;
+	output_gstreamer_init();
+	// Play in real time, so that the stream is still running when we
+	// switch.
+	GstElement *sink = find_real_sink(audio_sink_element_);
+	g_object_set(G_OBJECT(sink), "sync", TRUE, NULL);
+	gst_object_unref(sink);
+
+	// Fails when the pipeline goes to PLAYING.
+	expect_sink_released(wav_uri, missing_uri, "missing file");
+	// Fails later in the streaming thread, with an error message.
+	expect_sink_released(wav_uri, garbage_uri, "unplayable stream");
+
+	gst_element_set_state(player_, GST_STATE_NULL);
+	unlink(wav);
+	unlink(garbage);
+	rmdir(dir);
+	g_free(wav_uri);
+	g_free(garbage_uri);
+	g_free(missing_uri);
+	g_free(wav);
+	g_free(garbage);
+	g_free(missing);
+	g_free(dir);
+
+	if (failures) {
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+#endif
+}
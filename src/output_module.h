@@ -46,6 +46,18 @@ struct output_module {
 	int (*set_volume)(float);
 	int (*get_mute)(int *);
 	int (*set_mute)(int);
+	// Volume of an individual channel as fraction 0..1, applied on top
+	// of the overall volume.
+	int (*get_channel_volume)(enum output_channel, float *);
+	int (*set_channel_volume)(enum output_channel, float);
+	// Called before init() if volume is handled by a hardware mixer:
+	// the output should then leave the samples untouched.
+	void (*disable_volume)(void);
+	void (*set_format_callback)(output_format_cb_t);
+	int (*get_buffering_stats)(struct buffering_stats *);
+	int (*get_track_stats)(struct track_stats *);
+	int (*get_loudness)(int *);
+	int (*set_loudness)(int);
 };
 
 #endif
@@ -0,0 +1,466 @@
+/* playlist.c - Streaming parser for playlist containers (m3u, pls, DIDL-Lite)
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <upnp.h>
+
+#include "logging.h"
+#include "playlist.h"
+
+// Entries longer than this are skipped; nobody sends URIs that long.
+#define MAX_ENTRY_LEN 4096
+
+// Upper bound of entries we accept, to keep memory bounded on small devices
+// even if someone hands us a gigantic playlist.
+#define MAX_ENTRIES (1 << 16)
+
+// Entries times length alone would still allow 65536 x 4096 bytes = 256MiB
+// of URIs, so the total is capped as well. Typical URIs are ~100 bytes, so
+// this still leaves room for the maximum number of entries.
+#define MAX_ARENA_SIZE (8 << 20)
+
+static const int kHttpTimeoutSec = 10;
+
+enum didl_state {
+	DIDL_TEXT,   // Between tags, not interested in the content.
+	DIDL_TAG,    // Within <...>
+	DIDL_RES,    // Within <res ...> ... </res>
+};
+
+struct playlist {
+	enum playlist_format format;
+	char *base_uri;
+
+	// All entries, NUL terminated, back to back in one allocation.
+	char *arena;
+	size_t arena_len;
+	size_t arena_capacity;
+	uint32_t *offsets;
+	int count;
+	int capacity;
+
+	// Parse state. The current line (or tag, or <res> content for DIDL)
+	// is accumulated here until it is complete.
+	char buffer[MAX_ENTRY_LEN];
+	size_t buffer_len;
+	int buffer_overflow;
+	int first_line;
+	enum didl_state didl_state;
+	int item_has_res;
+};
+
+static int has_suffix(const char *str, size_t len, const char *suffix) {
+	const size_t suffix_len = strlen(suffix);
+	return len >= suffix_len
+		&& strncasecmp(str + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+enum playlist_format Playlist_guess_format(const char *uri, const char *meta) {
+	if (uri == NULL || *uri == '\0')
+		return PLAYLIST_NONE;
+
+	// Look at the path only, not at the query.
+	size_t path_len = strcspn(uri, "?#");
+	// Note, .m3u8 is HLS, which GStreamer handles itself.
+	if (has_suffix(uri, path_len, ".m3u"))
+		return PLAYLIST_M3U;
+	if (has_suffix(uri, path_len, ".pls"))
+		return PLAYLIST_PLS;
+
+	if (meta == NULL || *meta == '\0')
+		return PLAYLIST_NONE;
+	if (strstr(meta, "audio/x-mpegurl") || strstr(meta, "audio/mpegurl"))
+		return PLAYLIST_M3U;
+	if (strstr(meta, "audio/x-scpls"))
+		return PLAYLIST_PLS;
+	if (strstr(meta, ">object.container"))
+		return PLAYLIST_DIDL;
+	return PLAYLIST_NONE;
+}
+
+struct playlist *Playlist_new(enum playlist_format format,
+			      const char *base_uri) {
+	assert(format != PLAYLIST_NONE);
+	struct playlist *result =
+		(struct playlist*) malloc(sizeof(struct playlist));
+	result->format = format;
+	result->base_uri = strdup(base_uri ? base_uri : "");
+	result->arena = NULL;
+	result->arena_len = 0;
+	result->arena_capacity = 0;
+	result->offsets = NULL;
+	result->count = 0;
+	result->capacity = 0;
+	result->buffer_len = 0;
+	result->buffer_overflow = 0;
+	result->first_line = 1;
+	result->didl_state = DIDL_TEXT;
+	result->item_has_res = 0;
+	return result;
+}
+
+void Playlist_delete(struct playlist *playlist) {
+	if (playlist == NULL)
+		return;
+	free(playlist->base_uri);
+	free(playlist->arena);
+	free(playlist->offsets);
+	free(playlist);
+}
+
+int Playlist_count(const struct playlist *playlist) {
+	return playlist->count;
+}
+
+const char *Playlist_get(const struct playlist *playlist, int index) {
+	if (index < 0 || index >= playlist->count)
+		return NULL;
+	return playlist->arena + playlist->offsets[index];
+}
+
+static void add_entry(struct playlist *playlist, const char *str, size_t len) {
+	// Trim whitespace on both ends.
+	while (len > 0 && isspace((unsigned char) *str)) {
+		++str;
+		--len;
+	}
+	while (len > 0 && isspace((unsigned char) str[len - 1]))
+		--len;
+	if (len == 0 || playlist->count >= MAX_ENTRIES
+	    || playlist->arena_len + len + 1 > MAX_ARENA_SIZE)
+		return;
+
+	if (playlist->count == playlist->capacity) {
+		playlist->capacity = playlist->capacity ? 2 * playlist->capacity
+			: 64;
+		playlist->offsets = (uint32_t*) realloc(
+			playlist->offsets,
+			playlist->capacity * sizeof(uint32_t));
+	}
+	if (playlist->arena_len + len + 1 > playlist->arena_capacity) {
+		size_t new_capacity = playlist->arena_capacity
+			? playlist->arena_capacity : 4096;
+		while (playlist->arena_len + len + 1 > new_capacity)
+			new_capacity *= 2;
+		playlist->arena = (char*) realloc(playlist->arena,
+						  new_capacity);
+		playlist->arena_capacity = new_capacity;
+	}
+	char *dest = playlist->arena + playlist->arena_len;
+	memcpy(dest, str, len);
+	dest[len] = '\0';
+	playlist->offsets[playlist->count++] = playlist->arena_len;
+	playlist->arena_len += len + 1;
+}
+
+// Undo the XML escaping of the <res> content in-place. Returns new length.
+static size_t xml_unescape(char *str, size_t len) {
+	static const struct {
+		const char *entity;
+		char c;
+	} kEntities[] = {
+		{ "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' },
+		{ "&quot;", '"' }, { "&apos;", '\'' },
+	};
+	size_t out = 0;
+	for (size_t i = 0; i < len; /**/) {
+		char replacement = 0;
+		size_t entity_len = 0;
+		if (str[i] == '&') {
+			for (size_t e = 0; e < sizeof(kEntities)
+				     / sizeof(kEntities[0]); ++e) {
+				size_t elen = strlen(kEntities[e].entity);
+				if (i + elen <= len &&
+				    strncmp(str + i, kEntities[e].entity,
+					    elen) == 0) {
+					replacement = kEntities[e].c;
+					entity_len = elen;
+					break;
+				}
+			}
+		}
+		if (entity_len) {
+			str[out++] = replacement;
+			i += entity_len;
+		} else {
+			str[out++] = str[i++];
+		}
+	}
+	return out;
+}
+
+static void handle_line(struct playlist *playlist, char *line, size_t len) {
+	if (playlist->first_line) {
+		// Skip UTF-8 byte order mark.
+		if (len >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0) {
+			line += 3;
+			len -= 3;
+		}
+		playlist->first_line = 0;
+	}
+	while (len > 0 && isspace((unsigned char) *line)) {
+		++line;
+		--len;
+	}
+
+	switch (playlist->format) {
+	case PLAYLIST_M3U:
+		// #EXTM3U, #EXTINF and plain comments.
+		if (len > 0 && line[0] != '#')
+			add_entry(playlist, line, len);
+		break;
+
+	case PLAYLIST_PLS: {
+		// FileN=http://...
+		if (len < 5 || strncasecmp(line, "file", 4) != 0)
+			break;
+		size_t pos = 4;
+		while (pos < len && isdigit((unsigned char) line[pos]))
+			++pos;
+		if (pos == 4 || pos >= len || line[pos] != '=')
+			break;
+		add_entry(playlist, line + pos + 1, len - pos - 1);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+// Look at the tag currently in the buffer ("res protocolInfo=..." or
+// "/item" or "didl:res ...") and return the local name (without namespace
+// prefix) and if this is a closing or self-closed tag.
+static int tag_is(const char *tag, size_t len, const char *name,
+		  int *is_closing, int *is_empty) {
+	*is_closing = (len > 0 && tag[0] == '/');
+	*is_empty = (len > 0 && tag[len - 1] == '/');
+	const char *start = tag + (*is_closing ? 1 : 0);
+	const char *end = start;
+	while (end < tag + len && !isspace((unsigned char) *end)
+	       && *end != '/') {
+		++end;
+	}
+	const char *colon = memchr(start, ':', end - start);
+	if (colon)
+		start = colon + 1;
+	return (size_t)(end - start) == strlen(name)
+		&& strncmp(start, name, end - start) == 0;
+}
+
+static void handle_didl_tag(struct playlist *playlist) {
+	int is_closing, is_empty;
+	const char *tag = playlist->buffer;
+	const size_t len = playlist->buffer_len;
+	playlist->didl_state = DIDL_TEXT;
+	if (playlist->buffer_overflow)
+		return;
+	if (tag_is(tag, len, "item", &is_closing, &is_empty)) {
+		playlist->item_has_res = 0;
+	} else if (tag_is(tag, len, "res", &is_closing, &is_empty)
+		   && !is_closing && !is_empty) {
+		// Items can have multiple resources in different formats.
+		// We just take the first one.
+		if (!playlist->item_has_res)
+			playlist->didl_state = DIDL_RES;
+	}
+}
+
+static void feed_didl(struct playlist *playlist, const char *data, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		const char c = data[i];
+		switch (playlist->didl_state) {
+		case DIDL_TEXT:
+			if (c == '<') {
+				playlist->didl_state = DIDL_TAG;
+				playlist->buffer_len = 0;
+				playlist->buffer_overflow = 0;
+			}
+			continue;
+
+		case DIDL_TAG:
+			if (c == '>') {
+				handle_didl_tag(playlist);
+				playlist->buffer_len = 0;
+				playlist->buffer_overflow = 0;
+				continue;
+			}
+			break;
+
+		case DIDL_RES:
+			if (c == '<') {
+				if (!playlist->buffer_overflow) {
+					size_t res_len = xml_unescape(
+						playlist->buffer,
+						playlist->buffer_len);
+					add_entry(playlist, playlist->buffer,
+						  res_len);
+				}
+				playlist->item_has_res = 1;
+				playlist->didl_state = DIDL_TAG;
+				playlist->buffer_len = 0;
+				playlist->buffer_overflow = 0;
+				continue;
+			}
+			break;
+		}
+		if (playlist->buffer_len < sizeof(playlist->buffer)) {
+			playlist->buffer[playlist->buffer_len++] = c;
+		} else {
+			playlist->buffer_overflow = 1;
+		}
+	}
+}
+
+void Playlist_feed(struct playlist *playlist, const char *data, size_t len) {
+	if (playlist->format == PLAYLIST_DIDL) {
+		feed_didl(playlist, data, len);
+		return;
+	}
+	while (len > 0) {
+		const char *eol = memchr(data, '\n', len);
+		const size_t chunk = eol ? (size_t)(eol - data) : len;
+		if (playlist->buffer_len + chunk <= sizeof(playlist->buffer)) {
+			memcpy(playlist->buffer + playlist->buffer_len,
+			       data, chunk);
+			playlist->buffer_len += chunk;
+		} else {
+			playlist->buffer_overflow = 1;
+		}
+		if (eol == NULL)
+			break;
+		if (!playlist->buffer_overflow) {
+			handle_line(playlist, playlist->buffer,
+				    playlist->buffer_len);
+		}
+		playlist->buffer_len = 0;
+		playlist->buffer_overflow = 0;
+		data += chunk + 1;
+		len -= chunk + 1;
+	}
+}
+
+void Playlist_finish(struct playlist *playlist) {
+	if (playlist->format != PLAYLIST_DIDL
+	    && playlist->buffer_len > 0 && !playlist->buffer_overflow) {
+		handle_line(playlist, playlist->buffer, playlist->buffer_len);
+	}
+	playlist->buffer_len = 0;
+	playlist->buffer_overflow = 0;
+}
+
+char *Playlist_resolve(const struct playlist *playlist, int index) {
+	const char *entry = Playlist_get(playlist, index);
+	if (entry == NULL)
+		return NULL;
+	const char *base = playlist->base_uri;
+	const char *scheme_end = strstr(base, "://");
+	if (strstr(entry, "://") != NULL || scheme_end == NULL)
+		return strdup(entry);  // Already absolute or nothing to do.
+
+	size_t prefix_len;
+	if (entry[0] == '/') {
+		// Absolute path: keep scheme://host:port of base.
+		const char *host = scheme_end + 3;
+		prefix_len = (host - base) + strcspn(host, "/?#");
+	} else {
+		// Relative path: replace last path component of base.
+		const size_t path_len = strcspn(base, "?#");
+		prefix_len = path_len;
+		while (prefix_len > 0 && base[prefix_len - 1] != '/')
+			--prefix_len;
+	}
+	const size_t entry_len = strlen(entry);
+	char *result = (char*) malloc(prefix_len + entry_len + 1);
+	memcpy(result, base, prefix_len);
+	memcpy(result + prefix_len, entry, entry_len + 1);
+	return result;
+}
+
+// Servers sometimes label the actual stream with the playlist mime-type
+// (or vice versa), so we trust the content-type we actually get.
+static int is_playable_stream(const char *content_type) {
+	if (content_type == NULL)
+		return 0;
+	return strncasecmp(content_type, "audio/", 6) == 0
+		&& strcasestr(content_type, "mpegurl") == NULL
+		&& strcasestr(content_type, "scpls") == NULL;
+}
+
+struct playlist *Playlist_fetch(const char *uri, enum playlist_format format) {
+	void *handle = NULL;
+	char *content_type = NULL;
+	int content_length = 0;
+	int http_status = 0;
+	int rc = UpnpOpenHttpGet(uri, &handle, &content_type, &content_length,
+				 &http_status, kHttpTimeoutSec);
+	if (rc != UPNP_E_SUCCESS || http_status != 200) {
+		Log_error("playlist", "Could not fetch playlist '%s' "
+			  "(rc=%d, http-status=%d)", uri, rc, http_status);
+		if (handle)
+			UpnpCloseHttpGet(handle);
+		return NULL;
+	}
+	if (is_playable_stream(content_type)) {
+		Log_info("playlist", "'%s' is a %s stream, not a playlist.",
+			 uri, content_type);
+		UpnpCloseHttpGet(handle);
+		return NULL;
+	}
+
+	struct playlist *playlist = Playlist_new(format, uri);
+	char buffer[4096];
+	for (;;) {
+		size_t size = sizeof(buffer);
+		rc = UpnpReadHttpGet(handle, buffer, &size, kHttpTimeoutSec);
+		if (rc != UPNP_E_SUCCESS || size == 0)
+			break;
+		Playlist_feed(playlist, buffer, size);
+	}
+	UpnpCloseHttpGet(handle);
+	Playlist_finish(playlist);
+
+	if (Playlist_count(playlist) == 0) {
+		Log_error("playlist", "No entries in playlist '%s'", uri);
+		Playlist_delete(playlist);
+		return NULL;
+	}
+	Log_info("playlist", "Playlist '%s': %d entries (%zu bytes)",
+		 uri, playlist->count, playlist->arena_len);
+	return playlist;
+}
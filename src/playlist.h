@@ -0,0 +1,83 @@
+/* playlist.h - Streaming parser for playlist containers (m3u, pls, DIDL-Lite)
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * Controllers sometimes hand us a playlist (.m3u, .pls or a DIDL-Lite
+ * container) instead of a single stream. GStreamer can't play these, so we
+ * expand them ourselves.
+ *
+ * The parser is incremental: data can be fed in arbitrary chunks as it
+ * arrives from the network, so we never hold the whole document in memory.
+ * Only the entry URIs are kept, NUL-separated in one compact string arena
+ * with an offset table - tens of thousands of entries cost not much more
+ * than the bytes of the URIs themselves. Relative entries are stored as-is
+ * and only resolved against the playlist location when they are about to be
+ * played.
+ */
+
+#ifndef _PLAYLIST_H
+#define _PLAYLIST_H
+
+#include <stddef.h>
+
+enum playlist_format {
+	PLAYLIST_NONE,     // Not a playlist we know how to expand.
+	PLAYLIST_M3U,
+	PLAYLIST_PLS,
+	PLAYLIST_DIDL,
+};
+
+struct playlist;
+
+// Guess if the given URI with optional DIDL-Lite meta data (can be NULL or
+// empty) denotes a playlist container.
+enum playlist_format Playlist_guess_format(const char *uri, const char *meta);
+
+// Create a new empty playlist with the given format. The base_uri is used
+// to resolve relative entries and is copied.
+struct playlist *Playlist_new(enum playlist_format format,
+			      const char *base_uri);
+void Playlist_delete(struct playlist *playlist);
+
+// Feed the next chunk of the playlist document. Chunk boundaries can be
+// anywhere, even within an entry.
+void Playlist_feed(struct playlist *playlist, const char *data, size_t len);
+
+// Flush the last, possibly not newline-terminated, entry.
+void Playlist_finish(struct playlist *playlist);
+
+// Number of entries parsed so far.
+int Playlist_count(const struct playlist *playlist);
+
+// Returns the raw entry as found in the playlist or NULL if index is out of
+// range. Returned value is owned by the playlist.
+const char *Playlist_get(const struct playlist *playlist, int index);
+
+// Resolve entry "index" to an absolute URI. Returns a newly allocated string
+// that needs to be free()'d by the caller or NULL if index is out of range.
+char *Playlist_resolve(const struct playlist *playlist, int index);
+
+// Fetch the playlist from the given URI and parse it while downloading.
+// Returns NULL if it could not be fetched or contains no entries.
+struct playlist *Playlist_fetch(const char *uri, enum playlist_format format);
+
+#endif /* _PLAYLIST_H */
@@ -24,6 +24,10 @@
 #ifndef _SONG_META_DATA_H
 #define _SONG_META_DATA_H
 
+#include <stdint.h>
+
+struct didl;
+
 // An 'object' dealing with the meta data of a song.
 struct SongMetaData {
 	const char *title;
@@ -31,6 +35,12 @@ struct SongMetaData {
 	const char *album;
 	const char *genre;
 	const char *composer;
+
+	// Technical properties of the stream; NULL or 0 if not known.
+	const char *codec;
+	int bitrate;            // bits per second.
+	int sample_rate;        // Hz
+	int64_t duration_ms;
 };
 
 // Construct song meta data object.
@@ -40,10 +50,13 @@ void SongMetaData_init(struct SongMetaData *object);
 void SongMetaData_clear(struct SongMetaData *object);
 
 // Returns a newly allocated xml string with the song meta data encoded as
-// DIDL-Lite. If we get a non-empty original xml document, returns an
-// edited version of that document.
+// DIDL-Lite. If we get the parsed original document, the meta data is
+// spliced into it and the edited document returned; the changes stay
+// recorded in "original", so it can be kept and edited again on the next
+// update. Technical properties are added as attributes of the first <res>
+// element of the original document.
 char *SongMetaData_to_DIDL(const struct SongMetaData *object,
-			   const char *original_xml);
+			   struct didl *original);
 
 // Parse DIDL-Lite and fill SongMetaData struct. Returns 1 when successful.
 int SongMetaData_parse_DIDL(struct SongMetaData *object, const char *xml);
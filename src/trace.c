@@ -0,0 +1,160 @@
+/* trace.c - Timeline of what happens when starting a track
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "trace.h"
+#include "webserver.h"
+
+#define TRACE_PATH "/upnp/trace.json"
+
+// Number of events kept; with a few dozen events per track, this covers
+// the last couple of tracks.
+#define TRACE_SIZE 1024
+
+struct trace_event {
+	int64_t timestamp;        // Start, in microseconds.
+	int64_t duration;         // -1 for instant events.
+	const char *name;
+	int track;
+	char detail[96];
+};
+
+static pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_event events_[TRACE_SIZE];
+static unsigned long event_count_ = 0;   // Total recorded.
+static int track_ = 0;
+static int64_t track_start_ = 0;
+
+static void record(const char *name, int64_t timestamp, int64_t duration,
+		   const char *detail) {
+	pthread_mutex_lock(&mutex_);
+	struct trace_event *event = &events_[event_count_++ % TRACE_SIZE];
+	event->timestamp = timestamp;
+	event->duration = duration;
+	event->name = name;
+	event->track = track_;
+	snprintf(event->detail, sizeof(event->detail), "%s",
+		 detail ? detail : "");
+	pthread_mutex_unlock(&mutex_);
+}
+
+void trace_new_track(const char *uri) {
+	const int64_t now = metrics_now_usec();
+	pthread_mutex_lock(&mutex_);
+	++track_;
+	track_start_ = now;
+	pthread_mutex_unlock(&mutex_);
+	record("track", now, -1, uri);
+}
+
+void trace_instant(const char *name, const char *detail) {
+	record(name, metrics_now_usec(), -1, detail);
+}
+
+void trace_span(const char *name, int64_t start_usec, const char *detail) {
+	record(name, start_usec, metrics_now_usec() - start_usec, detail);
+}
+
+void trace_since_track_start(const char *name) {
+	pthread_mutex_lock(&mutex_);
+	const int64_t start = track_start_;
+	pthread_mutex_unlock(&mutex_);
+	if (start != 0)
+		trace_span(name, start, NULL);
+}
+
+static void print_json_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (const unsigned char *p = (const unsigned char*) str; *p; ++p) {
+		if (*p == '"' || *p == '\\')
+			fprintf(out, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(out, "\\u%04x", *p);
+		else
+			fputc(*p, out);
+	}
+	fputc('"', out);
+}
+
+static char *generate_trace(void) {
+	char *result = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&result, &len);
+	if (out == NULL)
+		return NULL;
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	pthread_mutex_lock(&mutex_);
+	const unsigned long first = (event_count_ > TRACE_SIZE)
+		? event_count_ - TRACE_SIZE : 0;
+	for (unsigned long i = first; i < event_count_; ++i) {
+		const struct trace_event *event = &events_[i % TRACE_SIZE];
+		if (i > first) fputc(',', out);
+		if (strcmp(event->name, "track") == 0) {
+			// Name the row of the track after its URI.
+			fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+				event->track);
+			print_json_string(out, event->detail);
+			fprintf(out, "}},");
+		}
+		fprintf(out, "{\"name\":");
+		print_json_string(out, event->name);
+		fprintf(out, ",\"pid\":1,\"tid\":%d,\"ts\":%" PRId64,
+			event->track, event->timestamp);
+		if (event->duration >= 0) {
+			fprintf(out, ",\"ph\":\"X\",\"dur\":%" PRId64,
+				event->duration);
+		} else {
+			fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+		}
+		if (event->detail[0]) {
+			fprintf(out, ",\"args\":{\"detail\":");
+			print_json_string(out, event->detail);
+			fputc('}', out);
+		}
+		fputc('}', out);
+	}
+	pthread_mutex_unlock(&mutex_);
+	fprintf(out, "]}\n");
+	fclose(out);
+	return result;
+}
+
+void trace_init(void) {
+	webserver_register_generator(TRACE_PATH, "application/json",
+				     generate_trace);
+}
@@ -0,0 +1,55 @@
+/* trace.h - Timeline of what happens when starting a track
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * -----------------
+ *
+ * To find out where the time goes between a controller asking to play a
+ * track and the first audio coming out, the interesting steps (actions,
+ * pipeline state changes, buffering, first buffer at the sink) are recorded
+ * with monotonic timestamps into a ring buffer. It can be fetched from
+ *   /upnp/trace.json
+ * in Chrome trace-event format, e.g. to be loaded into chrome://tracing or
+ * https://ui.perfetto.dev; each track shows as its own row.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+// Start a new track; the following events are grouped under it.
+void trace_new_track(const char *uri);
+
+// Record a point in time. "name" needs to be a string constant; "detail"
+// is copied (and possibly truncated) and can be NULL.
+void trace_instant(const char *name, const char *detail);
+
+// Record a span that started at "start_usec" (see metrics_now_usec()) and
+// ends now.
+void trace_span(const char *name, int64_t start_usec, const char *detail);
+
+// Record a span from the start of the current track until now.
+void trace_since_track_start(const char *name);
+
+// Register the trace in the webserver.
+void trace_init(void);
+
+#endif /* _TRACE_H */
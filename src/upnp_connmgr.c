@@ -223,6 +223,10 @@ void register_mime_type(const char *mime_type) {
 		// mpeg, aac, aacp, ogg are supported).
 		register_mime_type_internal("audio/x-scpls");
 
+		// m3u and pls playlists are expanded by the transport
+		// (see playlist.c), so we can handle those as well.
+		register_mime_type_internal("audio/x-mpegurl");
+
 		// This is apparently something sent by the spotifyd
 		// https://gitorious.org/spotifyd
 		register_mime_type("audio/L16;rate=44100;channels=2");
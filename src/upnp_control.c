@@ -41,6 +41,7 @@
 #include <ithread.h>
 
 #include "logging.h"
+#include "metrics.h"
 #include "webserver.h"
 #include "upnp_service.h"
 #include "upnp_device.h"
@@ -90,7 +91,7 @@ typedef enum {
 	//CONTROL_CMD_SET_GREEN_BLACK,
 	//CONTROL_CMD_SET_GREEN_GAIN,
 	//CONTROL_CMD_SET_HOR_KEYSTONE,
-	//CONTROL_CMD_SET_LOUDNESS,
+	CONTROL_CMD_SET_LOUDNESS,
 	CONTROL_CMD_SET_MUTE,
 	//CONTROL_CMD_SET_RED_BLACK,
 	//CONTROL_CMD_SET_RED_GAIN,
@@ -141,6 +142,11 @@ static const int vol_mid_point = 50;  // volume_range.max / 2
 static struct param_range volume_range = { 0, 100, 1 };
 static struct param_range volume_db_range = { -60 * 256, 0, 0 };  // volume_min_db
 
+// Volume level of the individual channels. The variable container only
+// holds the Master values; these are applied by the output on top of it.
+static int channel_volume_level_[OUTPUT_CHANNEL_COUNT] = { 100, 100 };
+static const char *channel_names_[OUTPUT_CHANNEL_COUNT] = { "LF", "RF" };
+
 
 // The following are not really relevant for a sound renderer.
 static struct param_range brightness_range = { 0, 100, 1 };
@@ -173,16 +179,20 @@ typedef enum {
 	CONTROL_VAR_PRESET_NAME_LIST,
 	CONTROL_VAR_CONTRAST,
 	CONTROL_VAR_BRIGHTNESS,
+	CONTROL_VAR_X_OUTPUT_FORMAT,
 	CONTROL_VAR_COUNT
 } control_variable_t;
 
 static variable_container_t *state_variables_ = NULL;
 
 static ithread_mutex_t control_mutex;
+static struct metric *lock_wait_;
 
 static void service_lock(void)
 {
+	const int64_t start_time = metrics_now_usec();
 	ithread_mutex_lock(&control_mutex);
+	metrics_observe_usec(lock_wait_, metrics_now_usec() - start_time);
 	struct upnp_last_change_collector*
 		collector = upnp_control_get_service()->last_change;
 	if (collector) {
@@ -379,12 +389,12 @@ static struct argument arguments_get_loudness[] = {
 	{ "CurrentLoudness", PARAM_DIR_OUT, CONTROL_VAR_LOUDNESS },
 	{ NULL }
 };
-// static struct argument arguments_set_loudness[] = {
-// 	{ "InstanceID", PARAM_DIR_IN, CONTROL_VAR_AAT_INSTANCE_ID },
-// 	{ "Channel", PARAM_DIR_IN, CONTROL_VAR_AAT_CHANNEL },
-// 	{ "DesiredLoudness", PARAM_DIR_IN, CONTROL_VAR_LOUDNESS },
-// 	{ NULL }
-// };
+static struct argument arguments_set_loudness[] = {
+	{ "InstanceID", PARAM_DIR_IN, CONTROL_VAR_AAT_INSTANCE_ID },
+	{ "Channel", PARAM_DIR_IN, CONTROL_VAR_AAT_CHANNEL },
+	{ "DesiredLoudness", PARAM_DIR_IN, CONTROL_VAR_LOUDNESS },
+	{ NULL }
+};
 
 
 static struct argument *argument_list[] = {
@@ -406,6 +416,7 @@ static struct argument *argument_list[] = {
 	[CONTROL_CMD_GET_VOL_DB] =          	arguments_get_vol_db,
 	[CONTROL_CMD_GET_VOL_DBRANGE] =     	arguments_get_vol_dbrange,
 	[CONTROL_CMD_LIST_PRESETS] =        	arguments_list_presets,
+	[CONTROL_CMD_SET_LOUDNESS] =        	arguments_set_loudness,
 	[CONTROL_CMD_SET_MUTE] =            	arguments_set_mute,
 	[CONTROL_CMD_SET_VOL] =             	arguments_set_vol,
 	[CONTROL_CMD_SET_VOL_DB] =          	arguments_set_vol_db,
@@ -423,7 +434,6 @@ static struct argument *argument_list[] = {
 	//[CONTROL_CMD_SET_COLOR_TEMP] =      	arguments_set_color_temp,
 	//[CONTROL_CMD_SET_HOR_KEYSTONE] =    	arguments_set_hor_keystone,
 	//[CONTROL_CMD_SET_VERT_KEYSTONE] =   	arguments_set_vert_keystone,
-	//[CONTROL_CMD_SET_LOUDNESS] =        	arguments_set_loudness,
 	[CONTROL_CMD_COUNT] =			NULL
 };
 
@@ -433,9 +443,14 @@ static void replace_var(control_variable_t varnum, const char *new_value) {
 	VariableContainer_change(state_variables_, varnum, new_value);
 }
 
-static void change_volume(const char *volume, const char *db_volume) {
-	replace_var(CONTROL_VAR_VOLUME, volume);
-	replace_var(CONTROL_VAR_VOLUME_DB, db_volume);
+// Same for integer and boolean variables.
+static void replace_var_int(control_variable_t varnum, long long value) {
+	VariableContainer_change_int(state_variables_, varnum, value);
+}
+
+static void change_volume(int volume, int db_volume) {
+	replace_var_int(CONTROL_VAR_VOLUME, volume);
+	replace_var_int(CONTROL_VAR_VOLUME_DB, db_volume);
 }
 
 static int cmd_obtain_variable(struct action_event *event,
@@ -538,7 +553,7 @@ static int get_mute(struct action_event *event)
 }
 
 static void set_mute_toggle(int do_mute) {
-	replace_var(CONTROL_VAR_MUTE, do_mute ? "1" : "0");
+	replace_var_int(CONTROL_VAR_MUTE, do_mute ? 1 : 0);
 	output_set_mute(do_mute);
 }
 
@@ -547,16 +562,63 @@ static int set_mute(struct action_event *event) {
 	service_lock();
 	const int do_mute = atoi(value);
 	set_mute_toggle(do_mute);
-	replace_var(CONTROL_VAR_MUTE, do_mute ? "1" : "0");
+	replace_var_int(CONTROL_VAR_MUTE, do_mute ? 1 : 0);
 	service_unlock();
 	return 0;
 }
 
+// Determine the channel an action applies to. Returns 1 and sets "channel"
+// for an individual channel, 0 for "Master" and -1 on error.
+static int get_channel_argument(struct action_event *event,
+				enum output_channel *channel) {
+	const char *value = upnp_get_string(event, "Channel");
+	if (value == NULL) {
+		return -1;
+	}
+	if (strcmp(value, "Master") == 0) {
+		return 0;
+	}
+	for (int i = 0; i < OUTPUT_CHANNEL_COUNT; ++i) {
+		if (strcmp(value, channel_names_[i]) == 0) {
+			*channel = (enum output_channel) i;
+			return 1;
+		}
+	}
+	upnp_set_error(event, UPNP_SOAP_E_INVALID_ARGS,
+		       "Unsupported channel '%s'", value);
+	return -1;
+}
+
+static float volume_level_to_decibel(int volume);
+
+// Respond with the volume level or decibel of an individual channel.
+static int get_channel_volume(struct action_event *event,
+			      enum output_channel channel, int as_decibel) {
+	char value[10];
+	const int level = channel_volume_level_[channel];
+	if (as_decibel) {
+		snprintf(value, sizeof(value), "%d",
+			 (int) (256 * volume_level_to_decibel(level)));
+	} else {
+		snprintf(value, sizeof(value), "%d", level);
+	}
+	upnp_add_response(event, as_decibel ? "CurrentVolumeDB" : "CurrentVolume",
+			  value);
+	return 0;
+}
+
 static int get_volume(struct action_event *event)
 {
-	/* FIXME - Channel */
-	return cmd_obtain_variable(event, CONTROL_VAR_VOLUME,
-				   "CurrentVolume");
+	enum output_channel channel;
+	switch (get_channel_argument(event, &channel)) {
+	case 0:
+		return cmd_obtain_variable(event, CONTROL_VAR_VOLUME,
+					   "CurrentVolume");
+	case 1:
+		return get_channel_volume(event, channel, 0);
+	default:
+		return -1;
+	}
 }
 
 static float volume_level_to_decibel(int volume) {
@@ -594,20 +656,64 @@ static float change_volume_decibel(float raw_decibel) {
 	// actual level.
 	float decibel = volume_level_to_decibel(volume_level);
 
-	char volume[10];
-	snprintf(volume, sizeof(volume), "%d", volume_level);
-	char db_volume[10];
-	snprintf(db_volume, sizeof(db_volume), "%d", (int) (256 * decibel));
-
 	Log_info("control", "Setting volume-db to %.2fdb == #%d",
 		decibel, volume_level);
 
-	change_volume(volume, db_volume);
+	change_volume(volume_level, (int) (256 * decibel));
 	return decibel;
 }
 
+// Set the volume level of an individual channel and event it. Needs to be
+// called with the service locked.
+static int change_channel_volume(struct action_event *event,
+				 enum output_channel channel, int level) {
+	if (level < volume_range.min) level = volume_range.min;
+	if (level > volume_range.max) level = volume_range.max;
+	const float decibel = volume_level_to_decibel(level);
+	// The lowest level is silence, not just vol_min_db.
+	const float fraction = (level == volume_range.min)
+		? 0.0 : exp(decibel / 20 * log(10));
+	if (output_set_channel_volume(channel, fraction) != 0) {
+		upnp_set_error(event, UPNP_SOAP_E_ACTION_FAILED,
+			       "Per-channel volume not supported by output");
+		return -1;
+	}
+	Log_info("control", "Setting %s volume-db to %.2fdb == #%d",
+		 channel_names_[channel], decibel, level);
+	channel_volume_level_[channel] = level;
+
+	char volume[10];
+	snprintf(volume, sizeof(volume), "%d", level);
+	char db_volume[10];
+	snprintf(db_volume, sizeof(db_volume), "%d", (int) (256 * decibel));
+	upnp_last_change_collector_t *collector =
+		upnp_control_get_service()->last_change;
+	if (collector) {
+		UPnPLastChangeCollector_add_channel_value(
+			collector, CONTROL_VAR_VOLUME, channel_names_[channel],
+			volume);
+		UPnPLastChangeCollector_add_channel_value(
+			collector, CONTROL_VAR_VOLUME_DB,
+			channel_names_[channel], db_volume);
+	}
+	return 0;
+}
+
 static int set_volume_db(struct action_event *event) {
 	const char *str_decibel_in = upnp_get_string(event, "DesiredVolume");
+	enum output_channel channel;
+	const int is_channel = get_channel_argument(event, &channel);
+	if (str_decibel_in == NULL || is_channel < 0) {
+		return -1;
+	}
+	if (is_channel) {
+		service_lock();
+		const int rc = change_channel_volume(
+			event, channel,
+			volume_decibel_to_level(atof(str_decibel_in)));
+		service_unlock();
+		return rc;
+	}
 	service_lock();
 	float raw_decibel_in = atof(str_decibel_in);
 	float decibel = change_volume_decibel(raw_decibel_in);
@@ -620,18 +726,27 @@ static int set_volume_db(struct action_event *event) {
 
 static int set_volume(struct action_event *event) {
 	const char *volume = upnp_get_string(event, "DesiredVolume");
+	enum output_channel channel;
+	const int is_channel = get_channel_argument(event, &channel);
+	if (volume == NULL || is_channel < 0) {
+		return -1;
+	}
+	if (is_channel) {
+		service_lock();
+		const int rc = change_channel_volume(event, channel,
+						     atoi(volume));
+		service_unlock();
+		return rc;
+	}
 	service_lock();
 	int volume_level = atoi(volume);  // range 0..100
 	if (volume_level < volume_range.min) volume_level = volume_range.min;
 	if (volume_level > volume_range.max) volume_level = volume_range.max;
 	const float decibel = volume_level_to_decibel(volume_level);
 
-	char db_volume[10];
-	snprintf(db_volume, sizeof(db_volume), "%d", (int) (256 * decibel));
-
 	const double fraction = exp(decibel / 20 * log(10));
 
-	change_volume(volume, db_volume);
+	change_volume(volume_level, (int) (256 * decibel));
 	output_set_volume(fraction);
 	set_mute_toggle(volume_level == 0);
 	service_unlock();
@@ -641,9 +756,16 @@ static int set_volume(struct action_event *event) {
 
 static int get_volume_db(struct action_event *event)
 {
-	/* FIXME - Channel */
-	return cmd_obtain_variable(event, CONTROL_VAR_VOLUME_DB,
-				   "CurrentVolumeDB");
+	enum output_channel channel;
+	switch (get_channel_argument(event, &channel)) {
+	case 0:
+		return cmd_obtain_variable(event, CONTROL_VAR_VOLUME_DB,
+					   "CurrentVolumeDB");
+	case 1:
+		return get_channel_volume(event, channel, 1);
+	default:
+		return -1;
+	}
 }
 
 static int get_volume_dbrange(struct action_event *event) {
@@ -662,6 +784,30 @@ static int get_loudness(struct action_event *event)
 				   "CurrentLoudness");
 }
 
+static int set_loudness(struct action_event *event)
+{
+	const char *value = upnp_get_string(event, "DesiredLoudness");
+	if (value == NULL) {
+		return -1;
+	}
+	// Boolean, which can be sent as 0/1 or false/true.
+	const int do_loudness = (atoi(value) != 0
+				 || strcasecmp(value, "true") == 0
+				 || strcasecmp(value, "yes") == 0);
+	int rc = 0;
+	service_lock();
+	if (output_set_loudness(do_loudness) == 0) {
+		replace_var_int(CONTROL_VAR_LOUDNESS, do_loudness ? 1 : 0);
+	} else {
+		upnp_set_error(event, UPNP_SOAP_E_ACTION_FAILED,
+			       "Loudness normalization not available "
+			       "(see --gstout-replaygain)");
+		rc = -1;
+	}
+	service_unlock();
+	return rc;
+}
+
 
 static struct action control_actions[] = {
 	[CONTROL_CMD_GET_BLUE_BLACK] =      	{"GetBlueVideoBlackLevel", get_blue_videoblacklevel}, /* optional */
@@ -682,6 +828,7 @@ static struct action control_actions[] = {
 	[CONTROL_CMD_GET_VOL_DB] =          	{"GetVolumeDB", get_volume_db}, /* optional */
 	[CONTROL_CMD_GET_VOL_DBRANGE] =     	{"GetVolumeDBRange", get_volume_dbrange}, /* optional */
 	[CONTROL_CMD_LIST_PRESETS] =        	{"ListPresets", list_presets},
+	[CONTROL_CMD_SET_LOUDNESS] =        	{"SetLoudness", set_loudness}, /* optional */
 	[CONTROL_CMD_SET_MUTE] =            	{"SetMute", set_mute}, /* optional */
 	[CONTROL_CMD_SET_VOL] =             	{"SetVolume", set_volume}, /* optional */
 	[CONTROL_CMD_SET_VOL_DB] =          	{"SetVolumeDB", set_volume_db}, /* optional */
@@ -699,7 +846,6 @@ static struct action control_actions[] = {
 	//[CONTROL_CMD_SET_COLOR_TEMP] =      	{"SetColorTemperature", NULL}, /* optional */
 	//[CONTROL_CMD_SET_HOR_KEYSTONE] =    	{"SetHorizontalKeystone", NULL}, /* optional */
 	//[CONTROL_CMD_SET_VERT_KEYSTONE] =   	{"SetVerticalKeystone", NULL}, /* optional */
-	//[CONTROL_CMD_SET_LOUDNESS] =        	{"SetLoudness", NULL}, /* optional */
 	[CONTROL_CMD_COUNT] =			{NULL, NULL}
 };
 
@@ -763,6 +909,11 @@ struct service *upnp_control_get_service(void) {
 		{CONTROL_VAR_LOUDNESS, "Loudness", "0",
 		 EV_NO, DATATYPE_BOOLEAN, NULL, NULL },
 
+		// Vendor extension: audio format of stream and output, to
+		// see if the output is bit-perfect.
+		{CONTROL_VAR_X_OUTPUT_FORMAT, "X_OutputFormat", "",
+		 EV_NO, DATATYPE_STRING, NULL, NULL },
+
 		{CONTROL_VAR_COUNT, NULL, NULL, EV_NO, DATATYPE_UNKNOWN, NULL, NULL }
 	};
 
@@ -776,8 +927,18 @@ struct service *upnp_control_get_service(void) {
 	return &control_service_;
 }
 
+// Called by the output whenever the negotiated audio format changes.
+static void update_output_format(const char *format) {
+	service_lock();
+	replace_var(CONTROL_VAR_X_OUTPUT_FORMAT, format);
+	service_unlock();
+}
+
 void upnp_control_init(struct upnp_device *device) {
 	struct service *service = upnp_control_get_service();
+	lock_wait_ = metrics_histogram("gmrender_lock_wait_seconds",
+				       "Time waiting for the service lock.",
+				       "lock=\"control\"");
 
 	// Set initial volume.
 	float volume_fraction = 0;
@@ -786,6 +947,10 @@ void upnp_control_init(struct upnp_device *device) {
 			 "control variables accordingly.", volume_fraction);
 		change_volume_decibel(20 * log(volume_fraction) / log(10));
 	}
+	int loudness = 0;
+	if (output_get_loudness(&loudness) == 0) {
+		replace_var_int(CONTROL_VAR_LOUDNESS, loudness ? 1 : 0);
+	}
 
 	assert(service->last_change == NULL);
 	service->last_change =
@@ -801,6 +966,8 @@ void upnp_control_init(struct upnp_device *device) {
 					   CONTROL_VAR_AAT_INSTANCE_ID);
 	UPnPLastChangeCollector_add_ignore(service->last_change,
 					   CONTROL_VAR_AAT_PRESET_NAME);
+
+	output_set_format_callback(update_output_format);
 }
 
 void upnp_control_register_variable_listener(variable_change_listener_t cb,
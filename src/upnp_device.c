@@ -43,6 +43,8 @@
 #include <upnptools.h>
 
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "xmlescape.h"
 #include "webserver.h"
@@ -60,6 +62,10 @@ struct upnp_device {
         UpnpDevice_Handle device_handle;
 };
 
+static struct metric *events_sent_;
+static struct metric *event_bytes_;
+static struct metric *subscriptions_;
+
 int upnp_add_response(struct action_event *event,
 		      const char *key, const char *value)
 {
@@ -222,6 +228,7 @@ static int handle_subscription_request(struct upnp_device *priv,
 				    eventvar_names, eventvar_values, 1, sid);
 	if (rc == UPNP_E_SUCCESS) {
 		result = 0;
+		metrics_add(subscriptions_, 1);
 	} else {
 		Log_error("upnp", "Accept Subscription Error: %s (%d)",
 			  UpnpGetErrorMessage(rc), rc);
@@ -243,6 +250,11 @@ int upnp_device_notify(struct upnp_device *device,
                    device->upnp_device_descriptor->udn, serviceID,
 		   varnames, varvalues, varcount);
 
+	metrics_add(events_sent_, 1);
+	for (int i = 0; i < varcount; ++i) {
+		metrics_add(event_bytes_, strlen(varvalues[i]));
+	}
+
 	return 0;
 }
 
@@ -322,7 +334,8 @@ static int handle_action_request(struct upnp_device *priv,
 #ifdef ENABLE_ACTION_LOGGING
 	{
 		char *action_request_xml = NULL;
-		if (UpnpActionRequest_get_ActionRequest(ar_event)) {
+		if (Log_info_enabled_for("upnp")
+		    && UpnpActionRequest_get_ActionRequest(ar_event)) {
 			action_request_xml = ixmlDocumenttoString(
 					   UpnpActionRequest_get_ActionRequest(ar_event));
 		}
@@ -332,6 +345,7 @@ static int handle_action_request(struct upnp_device *priv,
 	}
 #endif
 
+	const int64_t start_time = metrics_now_usec();
 	if (event_action->callback) {
 		struct action_event event;
 		int rc;
@@ -341,10 +355,14 @@ static int handle_action_request(struct upnp_device *priv,
                 event.device = priv;
 
 		rc = (event_action->callback) (&event);
+		if (rc != 0) {
+			metrics_add(event_action->errors, 1);
+		}
 		if (rc == 0) {
 			UpnpActionRequest_set_ErrCode(event.request, UPNP_E_SUCCESS);
 #ifdef ENABLE_ACTION_LOGGING
-			if (UpnpActionRequest_get_ActionResult(ar_event)) {
+			if (Log_info_enabled_for("upnp")
+			    && UpnpActionRequest_get_ActionResult(ar_event)) {
 				char *action_result_xml = ixmlDocumenttoString(
 						UpnpActionRequest_get_ActionResult(ar_event));
 				Log_info("upnp", "Action '%s' OK; Response %s",
@@ -387,6 +405,13 @@ static int handle_action_request(struct upnp_device *priv,
 		UPnPLastChangeCollector_finish(event_service->last_change);
 		ithread_mutex_unlock(event_service->service_mutex);
 	}
+	metrics_observe_usec(event_action->duration,
+			     metrics_now_usec() - start_time);
+	// The Get* actions are polled all the time and would only crowd out
+	// the interesting events.
+	if (strncmp(actionName, "Get", 3) != 0) {
+		trace_span("action", start_time, actionName);
+	}
 	return 0;
 }
 
@@ -482,6 +507,31 @@ static gboolean initialize_device(struct upnp_device_descriptor *device_def,
 	return TRUE;
 }
 
+static void register_metrics(struct upnp_device_descriptor *device_def) {
+	struct service *srv;
+	for (int i = 0; (srv = device_def->services[i]); i++) {
+		for (struct action *action = srv->actions;
+		     action->action_name != NULL; ++action) {
+			char labels[256];
+			snprintf(labels, sizeof(labels),
+				 "service=\"%s\",action=\"%s\"",
+				 srv->service_id, action->action_name);
+			action->duration = metrics_histogram(
+				"gmrender_action_duration_seconds",
+				"Time to handle UPnP actions.", labels);
+			action->errors = metrics_counter(
+				"gmrender_action_errors_total",
+				"UPnP actions that returned an error.", labels);
+		}
+	}
+	events_sent_ = metrics_counter("gmrender_events_total",
+				       "LastChange events sent.", NULL);
+	event_bytes_ = metrics_counter("gmrender_event_bytes_total",
+				       "Bytes of event values sent.", NULL);
+	subscriptions_ = metrics_counter("gmrender_subscriptions_total",
+					 "Event subscriptions accepted.", NULL);
+}
+
 struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 				     const char *ip_address,
 				     unsigned short port)
@@ -516,6 +566,8 @@ struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 		webserver_register_buf(srv->scpd_url, buf, "text/xml");
 	}
 
+	register_metrics(device_def);
+
 	if (!initialize_device(device_def, result_device, ip_address, port)) {
 		UpnpFinish();
 		free(result_device);
@@ -549,64 +601,64 @@ struct service *find_service(struct upnp_device_descriptor *device_def,
 
 /// ---- code to generate device descriptor
 
-static struct xmlelement *gen_specversion(struct xmldoc *doc,
-                                          int major, int minor)
+static void gen_specversion(struct xmldoc *doc, struct xmlelement *parent,
+                            int major, int minor)
 {
         struct xmlelement *top;
 
-        top=xmlelement_new(doc, "specVersion");
+        top=xmlelement_new(doc, parent, "specVersion");
 
         add_value_element_int(doc, top, "major", major);
         add_value_element_int(doc, top, "minor", minor);
 
-        return top;
+        xmlelement_end(doc, top);
 }
 
 
-static struct xmlelement *gen_desc_iconlist(struct xmldoc *doc,
-					    struct icon **icons) {
+static void gen_desc_iconlist(struct xmldoc *doc, struct xmlelement *parent,
+			      struct icon **icons) {
 	struct xmlelement *top;
-	struct xmlelement *parent;
+	struct xmlelement *icon;
 	struct icon *icon_entry;
 
-	top=xmlelement_new(doc, "iconList");
+	top=xmlelement_new(doc, parent, "iconList");
 
 	for (int i = 0; (icon_entry=icons[i]); i++) {
-		parent=xmlelement_new(doc, "icon");
-		add_value_element(doc,parent,"mimetype", icon_entry->mimetype);
-		add_value_element_int(doc,parent,"width",icon_entry->width);
-		add_value_element_int(doc,parent,"height",icon_entry->height);
-		add_value_element_int(doc,parent,"depth",icon_entry->depth);
-		add_value_element(doc,parent,"url",icon_entry->url);
-		xmlelement_add_element(doc, top, parent);
+		icon=xmlelement_new(doc, top, "icon");
+		add_value_element(doc,icon,"mimetype", icon_entry->mimetype);
+		add_value_element_int(doc,icon,"width",icon_entry->width);
+		add_value_element_int(doc,icon,"height",icon_entry->height);
+		add_value_element_int(doc,icon,"depth",icon_entry->depth);
+		add_value_element(doc,icon,"url",icon_entry->url);
+		xmlelement_end(doc, icon);
 	}
 
-	return top;
+	xmlelement_end(doc, top);
 }
 
 
-static struct xmlelement *
-gen_desc_servicelist(struct upnp_device_descriptor *device_def,
-		     struct xmldoc *doc)
+static void gen_desc_servicelist(struct upnp_device_descriptor *device_def,
+				 struct xmldoc *doc,
+				 struct xmlelement *parent)
 {
 	int i;
 	struct service *srv;
 	struct xmlelement *top;
-	struct xmlelement *parent;
+	struct xmlelement *service;
 
-	top=xmlelement_new(doc, "serviceList");
+	top=xmlelement_new(doc, parent, "serviceList");
 
         for (i=0; (srv = device_def->services[i]); i++) {
-		parent = xmlelement_new(doc, "service");
-		add_value_element(doc, parent, "serviceType",srv->service_type);
-		add_value_element(doc, parent, "serviceId", srv->service_id);
-		add_value_element(doc, parent, "SCPDURL", srv->scpd_url);
-		add_value_element(doc, parent, "controlURL", srv->control_url);
-		add_value_element(doc, parent, "eventSubURL", srv->event_url);
-		xmlelement_add_element(doc, top, parent);
+		service = xmlelement_new(doc, top, "service");
+		add_value_element(doc, service, "serviceType",srv->service_type);
+		add_value_element(doc, service, "serviceId", srv->service_id);
+		add_value_element(doc, service, "SCPDURL", srv->scpd_url);
+		add_value_element(doc, service, "controlURL", srv->control_url);
+		add_value_element(doc, service, "eventSubURL", srv->event_url);
+		xmlelement_end(doc, service);
         }
 
-	return top;
+	xmlelement_end(doc, top);
 }
 
 
@@ -615,16 +667,13 @@ static struct xmldoc *generate_desc(struct upnp_device_descriptor *device_def)
 {
 	struct xmldoc *doc;
 	struct xmlelement *root;
-	struct xmlelement *child;
 	struct xmlelement *parent;
 
 	doc = xmldoc_new();
 
 	root=xmldoc_new_topelement(doc, "root", "urn:schemas-upnp-org:device-1-0");
-	child=gen_specversion(doc,1,0);
-	xmlelement_add_element(doc, root, child);
-	parent=xmlelement_new(doc, "device");
-	xmlelement_add_element(doc, root, parent);
+	gen_specversion(doc, root, 1, 0);
+	parent=xmlelement_new(doc, root, "device");
 	add_value_element(doc,parent,"deviceType", device_def->device_type);
 	add_value_element(doc,parent,"presentationURL", device_def->presentation_url);
 	add_value_element(doc,parent,"friendlyName", device_def->friendly_name);
@@ -638,11 +687,11 @@ static struct xmldoc *generate_desc(struct upnp_device_descriptor *device_def)
 	//add_value_element(doc,parent,"serialNumber", device_def->serial_number);
 	//add_value_element(doc,parent,"UPC", device_def->upc);
 	if (device_def->icons) {
-		child=gen_desc_iconlist(doc,device_def->icons);
-		xmlelement_add_element(doc,parent,child);
+		gen_desc_iconlist(doc, parent, device_def->icons);
 	}
-	child=gen_desc_servicelist(device_def, doc);
-	xmlelement_add_element(doc, parent, child);
+	gen_desc_servicelist(device_def, doc, parent);
+	xmlelement_end(doc, parent);
+	xmlelement_end(doc, root);
 
 	return doc;
 }
@@ -49,83 +49,81 @@ static const char *param_datatype_names[] = {
         [DATATYPE_UNKNOWN] =    NULL
 };
 
-static struct xmlelement *gen_specversion(struct xmldoc *doc,
-                                          int major, int minor)
+static void gen_specversion(struct xmldoc *doc, struct xmlelement *parent,
+                            int major, int minor)
 {
 	struct xmlelement *top;
 
-	top=xmlelement_new(doc, "specVersion");
+	top=xmlelement_new(doc, parent, "specVersion");
 
 	add_value_element_int(doc, top, "major", major);
 	add_value_element_int(doc, top, "minor", minor);
 
-	return top;
+	xmlelement_end(doc, top);
 }
 
-static struct xmlelement *gen_scpd_action(struct xmldoc *doc,
-                                          struct action *act,
-                                          struct argument *arglist,
-                                          const struct var_meta *meta_array)
+static void gen_scpd_action(struct xmldoc *doc, struct xmlelement *parent,
+                            struct action *act,
+                            struct argument *arglist,
+                            const struct var_meta *meta_array)
 {
 	struct xmlelement *top;
-	struct xmlelement *parent,*child;
+	struct xmlelement *list,*child;
 
-	top=xmlelement_new(doc, "action");
+	top=xmlelement_new(doc, parent, "action");
 
 	add_value_element(doc, top, "name", act->action_name);
 	if (arglist) {
 		struct argument *arg;
 		int j;
-		parent=xmlelement_new(doc, "argumentList");
-		xmlelement_add_element(doc, top, parent);
+		list=xmlelement_new(doc, top, "argumentList");
 		/* a NULL name is the sentinel for 'end of list' */
 		for(j=0; (arg=&arglist[j], arg->name); j++) {
-			child=xmlelement_new(doc, "argument");
+			child=xmlelement_new(doc, list, "argument");
 			add_value_element(doc,child,"name", arg->name);
 			add_value_element(doc,child,"direction",
 					  (arg->direction == PARAM_DIR_IN)
 					  ? "in" : "out");
 			add_value_element(doc,child,"relatedStateVariable",
 					  meta_array[arg->statevar].name);
-			xmlelement_add_element(doc, parent,child);
+			xmlelement_end(doc, child);
 		}
+		xmlelement_end(doc, list);
 	}
-	return top;
+	xmlelement_end(doc, top);
 }
 
-static struct xmlelement *gen_scpd_actionlist(struct xmldoc *doc,
-                                              struct service *srv)
+static void gen_scpd_actionlist(struct xmldoc *doc, struct xmlelement *parent,
+                                struct service *srv)
 {
 	struct xmlelement *top;
-	struct xmlelement *child;
 	int i;
 
 	const struct var_meta* meta_array = VariableContainer_get_meta(
 	  			             srv->variable_container, NULL);
-	top=xmlelement_new(doc, "actionList");
+	top=xmlelement_new(doc, parent, "actionList");
 	for(i=0; i<srv->command_count; i++) {
 		struct action *act;
 		struct argument *arglist;
 		act=&(srv->actions[i]);
 		arglist=srv->action_arguments[i];
        		if (act) {
-			child=gen_scpd_action(doc, act, arglist, meta_array);
-			xmlelement_add_element(doc, top, child);
+			gen_scpd_action(doc, top, act, arglist, meta_array);
 		}
 	}
-	return top;
+	xmlelement_end(doc, top);
 }
 
-static struct xmlelement *gen_scpd_statevar(struct xmldoc *doc,
-					    const struct var_meta *meta) {
-	struct xmlelement *top,*parent;
+static void gen_scpd_statevar(struct xmldoc *doc, struct xmlelement *parent,
+			      const struct var_meta *meta) {
+	struct xmlelement *top,*list;
 	const char **valuelist;
 	struct param_range *range;
 
 	valuelist = meta->allowed_values;
 	range = meta->allowed_range;
 
-	top=xmlelement_new(doc, "stateVariable");
+	top=xmlelement_new(doc, parent, "stateVariable");
 
 	xmlelement_set_attribute(doc, top, "sendEvents",(meta->sendevents==EV_YES)?"yes":"no");
 	add_value_element(doc,top,"name", meta->name);
@@ -134,20 +132,20 @@ static struct xmlelement *gen_scpd_statevar(struct xmldoc *doc,
 	if (valuelist) {
 		const char *allowed_value;
 		int i;
-		parent=xmlelement_new(doc, "allowedValueList");
-		xmlelement_add_element(doc, top, parent);
+		list=xmlelement_new(doc, top, "allowedValueList");
 		for(i=0; (allowed_value=valuelist[i]); i++) {
-			add_value_element(doc,parent,"allowedValue", allowed_value);
+			add_value_element(doc,list,"allowedValue", allowed_value);
 		}
+		xmlelement_end(doc, list);
 	}
 	if (range) {
-		parent=xmlelement_new(doc, "allowedValueRange");
-		xmlelement_add_element(doc, top, parent);
-		add_value_element_long(doc,parent,"minimum",range->min);
-		add_value_element_long(doc,parent,"maximum",range->max);
+		list=xmlelement_new(doc, top, "allowedValueRange");
+		add_value_element_long(doc,list,"minimum",range->min);
+		add_value_element_long(doc,list,"maximum",range->max);
 		if (range->step != 0L) {
-			add_value_element_long(doc,parent,"step",range->step);
+			add_value_element_long(doc,list,"step",range->step);
 		}
+		xmlelement_end(doc, list);
 	}
 	assert(!(valuelist && range));  // Discrete values _and_ range ?
 
@@ -173,45 +171,39 @@ static struct xmlelement *gen_scpd_statevar(struct xmldoc *doc,
 		}
 	}
 
-	return top;
+	xmlelement_end(doc, top);
 }
 
-static struct xmlelement *gen_scpd_servicestatetable(struct xmldoc *doc,
-						     struct service *srv)
+static void gen_scpd_servicestatetable(struct xmldoc *doc,
+				       struct xmlelement *parent,
+				       struct service *srv)
 {
 	struct xmlelement *top;
-	struct xmlelement *child;
 	int i;
 
-	top=xmlelement_new(doc, "serviceStateTable");
+	top=xmlelement_new(doc, parent, "serviceStateTable");
 	int var_count;
 	const struct var_meta* meta_array = VariableContainer_get_meta(
 					 srv->variable_container, &var_count);
 	for (i = 0; i < var_count; i++) {
 		const struct var_meta *meta = &(meta_array[i]);
-		child=gen_scpd_statevar(doc, meta);
-		xmlelement_add_element(doc, top, child);
+		gen_scpd_statevar(doc, top, meta);
 	}
-	return top;
+	xmlelement_end(doc, top);
 }
 
 static struct xmldoc *generate_scpd(struct service *srv)
 {
 	struct xmldoc *doc;
 	struct xmlelement *root;
-	struct xmlelement *child;
 
 	doc = xmldoc_new();
 
 	root=xmldoc_new_topelement(doc, "scpd", "urn:schemas-upnp-org:service-1-0");
-	child=gen_specversion(doc,1,0);
-	xmlelement_add_element(doc, root, child);
-
-	child=gen_scpd_actionlist(doc,srv);
-	xmlelement_add_element(doc, root, child);
-
-	child=gen_scpd_servicestatetable(doc,srv);
-	xmlelement_add_element(doc, root, child);
+	gen_specversion(doc, root, 1, 0);
+	gen_scpd_actionlist(doc, root, srv);
+	gen_scpd_servicestatetable(doc, root, srv);
+	xmlelement_end(doc, root);
 
 	return doc;
 }
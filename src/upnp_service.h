@@ -33,10 +33,14 @@ struct service;
 struct action_event;
 struct variable_container;
 struct upnp_last_change_collector;
+struct metric;
 
 struct action {
 	const char *action_name;
 	int (*callback) (struct action_event *);
+	// Created in upnp_device_init().
+	struct metric *duration;   // Time to handle; counts calls as well.
+	struct metric *errors;
 };
 
 typedef enum {
@@ -0,0 +1,164 @@
+/* upnp_time.c - Format and parse UPnP time values
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include "upnp_time.h"
+
+#define NANOS_PER_SEC 1000000000LL
+// More hours don't fit into int64_t nanoseconds.
+#define MAX_HOUR_DIGITS 6
+
+static const int64_t kPow10[] = {
+	1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL,
+	10000000LL, 100000000LL, 1000000000LL,
+};
+
+static char *print_two_digits(char *out, int value) {
+	out[0] = '0' + value / 10;
+	out[1] = '0' + value % 10;
+	return out + 2;
+}
+
+size_t upnp_time_print(char *buffer, int64_t nanos, int fraction_digits) {
+	if (nanos < 0)
+		nanos = 0;
+	if (fraction_digits < 0)
+		fraction_digits = 0;
+	if (fraction_digits > 9)
+		fraction_digits = 9;
+	int64_t seconds = nanos / NANOS_PER_SEC;
+	const int64_t fraction = (nanos % NANOS_PER_SEC)
+		/ kPow10[9 - fraction_digits];
+	const int second = seconds % 60;
+	const int minute = (seconds / 60) % 60;
+	int64_t hour = seconds / 3600;
+
+	// Hours have no fixed width: collect digits backwards.
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = '0' + hour % 10;
+		hour /= 10;
+	} while (hour > 0);
+
+	char *out = buffer;
+	while (n > 0)
+		*out++ = digits[--n];
+	*out++ = ':';
+	out = print_two_digits(out, minute);
+	*out++ = ':';
+	out = print_two_digits(out, second);
+	if (fraction_digits > 0) {
+		*out++ = '.';
+		int64_t f = fraction;
+		for (int i = fraction_digits - 1; i >= 0; --i) {
+			out[i] = '0' + f % 10;
+			f /= 10;
+		}
+		out += fraction_digits;
+	}
+	*out = '\0';
+	return out - buffer;
+}
+
+// Parse at least one decimal digit, at most max_digits. Returns pointer
+// after the number or NULL if there is none or it is too long.
+static const char *parse_number(const char *p, int max_digits,
+				int64_t *value) {
+	const char *start = p;
+	*value = 0;
+	while (*p >= '0' && *p <= '9') {
+		if (p - start == max_digits)
+			return NULL;
+		*value = *value * 10 + (*p - '0');
+		++p;
+	}
+	return p == start ? NULL : p;
+}
+
+int upnp_time_parse(const char *str, int64_t *nanos) {
+	if (str == NULL)
+		return 0;
+	const char *p = str;
+	int negative = 0;
+	if (*p == '+' || *p == '-') {
+		negative = (*p == '-');
+		++p;
+	}
+	int64_t hour, minute, second;
+	p = parse_number(p, MAX_HOUR_DIGITS, &hour);
+	if (p == NULL || *p++ != ':')
+		return 0;
+	p = parse_number(p, 2, &minute);
+	if (p == NULL || *p++ != ':' || minute > 59)
+		return 0;
+	p = parse_number(p, 2, &second);
+	if (p == NULL || second > 59)
+		return 0;
+
+	int64_t fraction_nanos = 0;
+	if (*p == '.') {
+		++p;
+		const char *digits = p;
+		while (*p >= '0' && *p <= '9')
+			++p;
+		if (p == digits)
+			return 0;
+		if (*p == '/') {
+			// F0/F1, with F0 < F1.
+			int64_t numerator, denominator;
+			if (parse_number(digits, 18, &numerator) != p)
+				return 0;
+			p = parse_number(p + 1, 18, &denominator);
+			if (p == NULL || numerator >= denominator)
+				return 0;
+			if (numerator <= INT64_MAX / NANOS_PER_SEC) {
+				fraction_nanos = numerator * NANOS_PER_SEC
+					/ denominator;
+			} else {
+				// Rather lose some precision than overflow.
+				fraction_nanos = numerator
+					/ (denominator / NANOS_PER_SEC);
+			}
+		} else {
+			// F+: any number of digits; we only care up to
+			// nanoseconds.
+			for (int i = 0; i < 9 && digits + i < p; ++i) {
+				fraction_nanos += (digits[i] - '0')
+					* kPow10[8 - i];
+			}
+		}
+	}
+	if (*p != '\0')
+		return 0;
+
+	const int64_t result = ((hour * 60 + minute) * 60 + second)
+		* NANOS_PER_SEC + fraction_nanos;
+	*nanos = negative ? -result : result;
+	return 1;
+}
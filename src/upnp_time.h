@@ -0,0 +1,50 @@
+/* upnp_time.h - Format and parse UPnP time values
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ * -----------------
+ *
+ * UPnP AV times look like H+:MM:SS[.F+] or H+:MM:SS[.F0/F1], e.g.
+ * "1:02:03", "0:00:07.250" or "0:00:07.1/4". These are formatted on
+ * every position update, so this is done with plain integer arithmetic.
+ */
+
+#ifndef _UPNP_TIME_H
+#define _UPNP_TIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Enough for any int64_t nanosecond value with fraction.
+#define UPNP_TIME_BUFSIZE 32
+
+// Print time given in nanoseconds into "buffer" of at least
+// UPNP_TIME_BUFSIZE bytes, with the given number of fraction digits
+// (0..9). Negative times are printed as zero. Returns length of the result.
+size_t upnp_time_print(char *buffer, int64_t nanos, int fraction_digits);
+
+// Parse a UPnP time with optional sign and fraction. Minutes and seconds
+// are accepted with one digit as well, as some control points send them
+// that way. Returns 1 and stores the time in nanoseconds in *nanos if
+// valid, 0 otherwise.
+int upnp_time_parse(const char *str, int64_t *nanos);
+
+#endif /* _UPNP_TIME_H */
@@ -0,0 +1,85 @@
+/* upnp_time_bench.c - Benchmark of the UPnP time functions
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+// Built with "make check"; run ./upnp_time_bench [iterations].
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "upnp_time.h"
+
+static int64_t now_nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *what, int64_t start, long iterations,
+		   int64_t checksum) {
+	printf("%-24s %8.1f ns/op  (checksum %lld)\n", what,
+	       (double) (now_nanos() - start) / iterations,
+	       (long long) checksum);
+}
+
+int main(int argc, char *argv[]) {
+	const long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+	char buffer[UPNP_TIME_BUFSIZE];
+	// The checksums keep the compiler from dropping the work.
+	int64_t checksum = 0;
+	int64_t start = now_nanos();
+	for (long i = 0; i < iterations; ++i) {
+		// Position updates: a new second each time.
+		checksum += upnp_time_print(buffer, i * 1000000000LL, 0);
+	}
+	report("print", start, iterations, checksum);
+
+	checksum = 0;
+	start = now_nanos();
+	for (long i = 0; i < iterations; ++i) {
+		checksum += upnp_time_print(buffer, i * 1000001LL, 3);
+	}
+	report("print with fraction", start, iterations, checksum);
+
+	static const char *const kInputs[] = {
+		"0:03:25", "1:02:03.456", "00:00:07.1/4", "-0:00:10",
+	};
+	const int input_count = sizeof(kInputs) / sizeof(kInputs[0]);
+	checksum = 0;
+	start = now_nanos();
+	for (long i = 0; i < iterations; ++i) {
+		int64_t nanos = 0;
+		upnp_time_parse(kInputs[i % input_count], &nanos);
+		checksum += nanos;
+	}
+	report("parse", start, iterations, checksum);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* upnp_time_test.c - Round-trip and fuzz test of the UPnP time functions
+ *
+ * Copyright (C) 2019 GMediaRender contributors
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_time.h"
+
+#define NANOS_PER_SEC 1000000000LL
+#define INVALID INT64_MIN
+
+static int failures = 0;
+
+static int64_t parse(const char *str) {
+	int64_t nanos;
+	return upnp_time_parse(str, &nanos) ? nanos : INVALID;
+}
+
+static void expect_print(int64_t nanos, int fraction_digits,
+			 const char *expected) {
+	char buffer[UPNP_TIME_BUFSIZE];
+	const size_t len = upnp_time_print(buffer, nanos, fraction_digits);
+	if (strcmp(buffer, expected) != 0 || len != strlen(expected)) {
+		fprintf(stderr, "print(%lld, %d): got '%s', expected '%s'\n",
+			(long long) nanos, fraction_digits, buffer, expected);
+		failures++;
+	}
+}
+
+static void expect_parse(const char *str, int64_t expected) {
+	const int64_t nanos = parse(str);
+	if (nanos != expected) {
+		fprintf(stderr, "parse('%s'): got %lld, expected %lld\n",
+			str, (long long) nanos, (long long) expected);
+		failures++;
+	}
+}
+
+static void test_print(void) {
+	expect_print(0, 0, "0:00:00");
+	expect_print(-5, 0, "0:00:00");
+	expect_print(3723 * NANOS_PER_SEC, 0, "1:02:03");
+	expect_print(3723456000000LL, 3, "1:02:03.456");
+	expect_print(7 * NANOS_PER_SEC + 5, 9, "0:00:07.000000005");
+	expect_print(INT64_MAX, 9, "2562047:47:16.854775807");
+}
+
+static void test_parse(void) {
+	expect_parse("1:02:03", 3723 * NANOS_PER_SEC);
+	expect_parse("00:03:20", 200 * NANOS_PER_SEC);
+	expect_parse("+10:0:5", 36005 * NANOS_PER_SEC);
+	expect_parse("-0:00:01", -NANOS_PER_SEC);
+	expect_parse("0:00:07.25", 7250000000LL);
+	expect_parse("0:00:07.1/4", 7250000000LL);
+	expect_parse("0:00:07.1234567891234", 7123456789LL);
+
+	expect_parse("", INVALID);
+	expect_parse("abc", INVALID);
+	expect_parse("1:2", INVALID);
+	expect_parse("1:02:03x", INVALID);
+	expect_parse("0:60:00", INVALID);
+	expect_parse("0:00:07.", INVALID);
+	expect_parse("0:00:07.4/4", INVALID);
+	expect_parse("1234567:00:00", INVALID);
+	expect_parse("0:00:00.999999999999999999/9999999999999999999",
+		     INVALID);
+}
+
+// Everything we print must parse back to the same value.
+static void test_round_trip(void) {
+	char buffer[UPNP_TIME_BUFSIZE];
+	srand(42);
+	for (int i = 0; i < 100000; ++i) {
+		int64_t nanos = ((int64_t) rand() * rand())
+			% (999999LL * 3600 * NANOS_PER_SEC);
+		nanos -= nanos % 1000000;  // Milliseconds; printed with 3.
+		upnp_time_print(buffer, nanos, 3);
+		if (parse(buffer) != nanos) {
+			fprintf(stderr, "round trip of %lld: '%s' parsed "
+				"as %lld\n", (long long) nanos, buffer,
+				(long long) parse(buffer));
+			failures++;
+			return;
+		}
+	}
+}
+
+// Random input made of the characters times consist of must not trip the
+// parser (run with -fsanitize=address,undefined to get the most out of
+// this).
+static void test_fuzz(void) {
+	static const char kAlphabet[] = "0123456789:./+-x ";
+	char input[32];
+	srand(4711);
+	for (int i = 0; i < 1000000; ++i) {
+		const int len = rand() % (int) sizeof(input);
+		for (int j = 0; j < len; ++j)
+			input[j] = kAlphabet[rand() % (sizeof(kAlphabet) - 1)];
+		input[len] = '\0';
+		int64_t nanos;
+		upnp_time_parse(input, &nanos);
+	}
+}
+
+int main(void) {
+	test_print();
+	test_parse();
+	test_round_trip();
+	test_fuzz();
+	if (failures > 0) {
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
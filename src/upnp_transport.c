@@ -41,9 +41,14 @@
 #include <upnp.h>
 #include <ithread.h>
 
+#include "didl.h"
+#include "logging.h"
+#include "metrics.h"
 #include "output.h"
+#include "playlist.h"
 #include "upnp_service.h"
 #include "upnp_device.h"
+#include "upnp_time.h"
 #include "variable-container.h"
 #include "xmlescape.h"
 
@@ -404,13 +409,43 @@ static struct argument *argument_list[] = {
 static enum transport_state transport_state_ = TRANSPORT_STOPPED;
 static variable_container_t *state_variables_ = NULL;
 
+// If the AVTransportURI is a playlist, we expand it and play the entries
+// one after another; the AVTransportURI stays the playlist, the
+// CurrentTrack* variables reflect the entry being played.
+static struct playlist *playlist_ = NULL;
+static int playlist_pos_ = 0;
+
+// AVTransportURIMetaData, parsed once, so that meta data updates from the
+// stream can be spliced into it. NULL if it is not DIDL-Lite we can edit.
+static struct didl *transport_didl_ = NULL;
+
+// A playlist is fetched in the background while the transport is
+// TRANSITIONING. A fetch only applies if fetch_generation_ did not change
+// in the meantime, i.e. no newer URI was set. Afterwards, the transport
+// returns to state_after_fetch_, and starts playing if a Play arrived
+// while fetching.
+static int fetching_playlist_ = 0;
+static unsigned int fetch_generation_ = 0;
+static enum transport_state state_after_fetch_ = TRANSPORT_STOPPED;
+static int play_after_fetch_ = 0;
+
+struct playlist_fetch {
+	char *uri;
+	char *meta;
+	enum playlist_format format;
+	unsigned int generation;
+};
+
 /* protects transport_values, and service-specific state */
 
 static ithread_mutex_t transport_mutex;
+static struct metric *lock_wait_;
 
 static void service_lock(void)
 {
+	const int64_t start_time = metrics_now_usec();
 	ithread_mutex_lock(&transport_mutex);
+	metrics_observe_usec(lock_wait_, metrics_now_usec() - start_time);
 
 	struct upnp_last_change_collector *
 		collector = upnp_transport_get_service()->last_change;
@@ -466,6 +501,11 @@ static int replace_var(transport_variable_t varnum, const char *new_value) {
 	return VariableContainer_change(state_variables_, varnum, new_value);
 }
 
+// Same for integer variables.
+static int replace_var_int(transport_variable_t varnum, long long value) {
+	return VariableContainer_change_int(state_variables_, varnum, value);
+}
+
 static const char *get_var(transport_variable_t varnum) {
 	return VariableContainer_get(state_variables_, varnum, NULL);
 }
@@ -477,11 +517,13 @@ static const char *get_var(transport_variable_t varnum) {
 static int replace_transport_uri_and_meta(const char *uri, const char *meta) {
 	replace_var(TRANSPORT_VAR_AV_URI, uri);
 	replace_var(TRANSPORT_VAR_AV_URI_META, meta);
+	Didl_delete(transport_didl_);
+	transport_didl_ = Didl_parse(meta);
 
 	// This influences as well the tracks. If there is a non-empty URI,
 	// we have exactly one track.
-	const char *tracks = (uri != NULL && strlen(uri) > 0) ? "1" : "0";
-	replace_var(TRANSPORT_VAR_NR_TRACKS, tracks);
+	replace_var_int(TRANSPORT_VAR_NR_TRACKS,
+			(uri != NULL && strlen(uri) > 0) ? 1 : 0);
 
 	// We only really want to send back meta data if we didn't get anything
 	// useful or if this is an audio item.
@@ -492,8 +534,8 @@ static int replace_transport_uri_and_meta(const char *uri, const char *meta) {
 
 // Similar to replace_transport_uri_and_meta() above, but current values.
 static void replace_current_uri_and_meta(const char *uri, const char *meta){
-	const char *tracks = (uri != NULL && strlen(uri) > 0) ? "1" : "0";
-	replace_var(TRANSPORT_VAR_CUR_TRACK, tracks);
+	replace_var_int(TRANSPORT_VAR_CUR_TRACK,
+			(uri != NULL && strlen(uri) > 0) ? 1 : 0);
 	replace_var(TRANSPORT_VAR_CUR_TRACK_URI, uri);
 	replace_var(TRANSPORT_VAR_CUR_TRACK_META, meta);
 }
@@ -522,6 +564,10 @@ static void change_transport_state(enum transport_state new_state) {
 		available_actions = "PLAY,STOP,SEEK";
 		break;
 	case TRANSPORT_TRANSITIONING:
+		// Only while fetching a playlist; Play is done once it is
+		// there.
+		available_actions = "PLAY,STOP";
+		break;
 	case TRANSPORT_PAUSED_RECORDING:
 	case TRANSPORT_RECORDING:
 	case TRANSPORT_NO_MEDIA_PRESENT:
@@ -534,20 +580,156 @@ static void change_transport_state(enum transport_state new_state) {
 	}
 }
 
+// Set the current track variables to the playlist entry at playlist_pos_.
+static void replace_current_from_playlist(void) {
+	char *uri = Playlist_resolve(playlist_, playlist_pos_);
+	replace_var_int(TRANSPORT_VAR_CUR_TRACK, playlist_pos_ + 1);
+	replace_var(TRANSPORT_VAR_CUR_TRACK_URI, uri);
+	replace_var(TRANSPORT_VAR_CUR_TRACK_META, "");
+	free(uri);
+}
+
+// Hand the output the playlist entry after the current one, so that it can
+// prepare a gapless transition. We only ever resolve this one entry ahead.
+static void queue_next_playlist_entry(void) {
+	char *next_uri = Playlist_resolve(playlist_, playlist_pos_ + 1);
+	if (next_uri != NULL) {
+		output_set_next_uri(next_uri);
+		free(next_uri);
+	}
+}
+
+static void clear_playlist(void) {
+	Playlist_delete(playlist_);
+	playlist_ = NULL;
+	playlist_pos_ = 0;
+}
+
 // Callback from our output if the song meta data changed.
 static void update_meta_from_stream(const struct SongMetaData *meta) {
-	if (meta->title == NULL || strlen(meta->title) == 0) {
-		return;
-	}
-	const char *original_xml = get_var(TRANSPORT_VAR_AV_URI_META);
-	char *didl = SongMetaData_to_DIDL(meta, original_xml);
 	service_lock();
-	replace_var(TRANSPORT_VAR_AV_URI_META, didl);
-	replace_var(TRANSPORT_VAR_CUR_TRACK_META, didl);
+	const char *original_xml = get_var(TRANSPORT_VAR_AV_URI_META);
+	const int have_original = (original_xml != NULL
+				   && strlen(original_xml) > 0);
+	char *didl = NULL;
+	if (transport_didl_ != NULL) {
+		didl = SongMetaData_to_DIDL(meta, transport_didl_);
+	} else if (!have_original
+		   && meta->title != NULL && strlen(meta->title) > 0) {
+		// Without a title, there is nothing worth generating a
+		// document for. Once we have one, we keep editing it.
+		didl = SongMetaData_to_DIDL(meta, NULL);
+		transport_didl_ = Didl_parse(didl);
+	}
+	// Otherwise, the document we got is not something we can edit.
+	if (didl != NULL) {
+		replace_var(TRANSPORT_VAR_AV_URI_META, didl);
+		replace_var(TRANSPORT_VAR_CUR_TRACK_META, didl);
+	}
 	service_unlock();
 	free(didl);
 }
 
+static int start_playback(void);
+
+// Set the transport to the given URI, expanded to the playlist if there is
+// one. Takes ownership of the playlist. Needs the service lock held.
+static void apply_transport_uri(const char *uri, const char *meta,
+				struct playlist *playlist) {
+	clear_playlist();
+	// Transport URI/Meta set now, current URI/Meta when it starts playing.
+	int requires_meta_update = replace_transport_uri_and_meta(uri, meta);
+	char *play_uri = NULL;
+	if (playlist != NULL) {
+		replace_var_int(TRANSPORT_VAR_NR_TRACKS,
+				Playlist_count(playlist));
+		playlist_ = playlist;
+		play_uri = Playlist_resolve(playlist_, 0);
+		// The meta data describes the container, the actual track
+		// info can only come from the stream.
+		requires_meta_update = 1;
+	}
+
+	if (transport_state_ == TRANSPORT_PLAYING) {
+		// Uh, wrong state.
+		// Usually, this should not be called while we are PLAYING, only
+		// STOPPED or PAUSED. But if actually some controller sets this
+		// while playing, probably the best is to update the current
+		// current URI/Meta as well to reflect the state best.
+		if (playlist_) {
+			replace_current_from_playlist();
+		} else {
+			replace_current_uri_and_meta(uri, meta);
+		}
+	}
+
+	output_set_uri(play_uri ? play_uri : uri,
+		       (requires_meta_update ? update_meta_from_stream : NULL));
+	if (playlist_) {
+		queue_next_playlist_entry();
+	}
+	free(play_uri);
+}
+
+static void *fetch_playlist_thread(void *userdata) {
+	struct playlist_fetch *fetch = (struct playlist_fetch*) userdata;
+	// This can take a while; don't hold the lock.
+	struct playlist *playlist = Playlist_fetch(fetch->uri, fetch->format);
+
+	service_lock();
+	if (fetch->generation == fetch_generation_) {
+		fetching_playlist_ = 0;
+		change_transport_state(state_after_fetch_);
+		// If the fetch failed, we try to play the URI itself.
+		apply_transport_uri(fetch->uri, fetch->meta, playlist);
+		playlist = NULL;
+		if (play_after_fetch_) {
+			play_after_fetch_ = 0;
+			start_playback();
+		}
+	}
+	service_unlock();
+
+	Playlist_delete(playlist);  // Superseded by a newer URI.
+	free(fetch->uri);
+	free(fetch->meta);
+	free(fetch);
+	return NULL;
+}
+
+// Answer SetAVTransportURI right away and fetch the playlist in the
+// background; fetching can take up to the HTTP timeouts. Needs the service
+// lock held.
+static void start_playlist_fetch(const char *uri, const char *meta,
+				 enum playlist_format format) {
+	if (!fetching_playlist_) {
+		state_after_fetch_ = transport_state_;
+		fetching_playlist_ = 1;
+	}
+	clear_playlist();
+	replace_transport_uri_and_meta(uri, meta);
+	change_transport_state(TRANSPORT_TRANSITIONING);
+
+	struct playlist_fetch *fetch = (struct playlist_fetch*)
+		malloc(sizeof(*fetch));
+	fetch->uri = strdup(uri);
+	fetch->meta = strdup(meta);
+	fetch->format = format;
+	fetch->generation = fetch_generation_;
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, fetch_playlist_thread, fetch) != 0) {
+		Log_error("transport", "Can't start playlist fetch.");
+		free(fetch->uri);
+		free(fetch->meta);
+		free(fetch);
+		fetching_playlist_ = 0;
+		change_transport_state(state_after_fetch_);
+		apply_transport_uri(uri, meta, NULL);
+		return;
+	}
+	pthread_detach(thread);
+}
+
 /* UPnP action handlers */
 
 static int set_avtransport_uri(struct action_event *event)
@@ -560,23 +742,27 @@ static int set_avtransport_uri(struct action_event *event)
 		return -1;
 	}
 
-	service_lock();
 	const char *meta = upnp_get_string(event, "CurrentURIMetaData");
-	// Transport URI/Meta set now, current URI/Meta when it starts playing.
-	int requires_meta_update = replace_transport_uri_and_meta(uri, meta);
-
-	if (transport_state_ == TRANSPORT_PLAYING) {
-		// Uh, wrong state.
-		// Usually, this should not be called while we are PLAYING, only
-		// STOPPED or PAUSED. But if actually some controller sets this
-		// while playing, probably the best is to update the current
-		// current URI/Meta as well to reflect the state best.
-		replace_current_uri_and_meta(uri, meta);
+	if (meta == NULL) {
+		meta = "";
 	}
 
-	output_set_uri(uri, (requires_meta_update
-			     ? update_meta_from_stream
-			     : NULL));
+	const enum playlist_format format = Playlist_guess_format(uri, meta);
+	service_lock();
+	++fetch_generation_;  // A fetch still running is superseded.
+	if (format != PLAYLIST_NONE) {
+		start_playlist_fetch(uri, meta, format);
+	} else {
+		if (fetching_playlist_) {
+			fetching_playlist_ = 0;
+			change_transport_state(state_after_fetch_);
+		}
+		apply_transport_uri(uri, meta, NULL);
+		if (play_after_fetch_) {
+			play_after_fetch_ = 0;
+			start_playback();
+		}
+	}
 	service_unlock();
 
 	return 0;
@@ -596,6 +782,13 @@ static int set_next_avtransport_uri(struct action_event *event)
 	int rc = 0;
 	service_lock();
 
+	if (playlist_) {
+		// The controller takes over managing what comes next.
+		Log_info("transport", "Next URI set by controller; "
+			 "not continuing with playlist.");
+		clear_playlist();
+		replace_var_int(TRANSPORT_VAR_NR_TRACKS, 1);
+	}
 	output_set_next_uri(next_uri);
 	replace_var(TRANSPORT_VAR_NEXT_AV_URI, next_uri);
 
@@ -646,35 +839,11 @@ static int get_transport_settings(struct action_event *event)
 	return 0;
 }
 
-// Print UPnP formatted time into given buffer. time given in nanoseconds.
-static int divide_leave_remainder(gint64 *val, gint64 divisor) {
-	int result = *val / divisor;
-	*val %= divisor;
-	return result;
-}
-static void print_upnp_time(char *result, size_t size, gint64 t) {
-	const gint64 one_sec = 1000000000LL;  // units are in nanoseconds.
-	const int hour = divide_leave_remainder(&t, 3600LL * one_sec);
-	const int minute = divide_leave_remainder(&t, 60LL * one_sec);
-	const int second = divide_leave_remainder(&t, one_sec);
-	snprintf(result, size, "%d:%02d:%02d", hour, minute, second);
-}
-
-static gint64 parse_upnp_time(const char *time_string) {
-	int hour = 0;
-	int minute = 0;
-	int second = 0;
-	sscanf(time_string, "%d:%02d:%02d", &hour, &minute, &second);
-	const gint64 seconds = (hour * 3600 + minute * 60 + second);
-	const gint64 one_sec_unit = 1000000000LL;
-	return one_sec_unit * seconds;
-}
-
 // We constantly update the track time to event about it to our clients.
 static void *thread_update_track_time(void *userdata) {
 	(void)userdata;
 	const gint64 one_sec_unit = 1000000000LL;
-	char tbuf[32];
+	char tbuf[UPNP_TIME_BUFSIZE];
 	gint64 last_duration = -1, last_position = -1;
 	for (;;) {
 		usleep(500000);  // 500ms
@@ -683,12 +852,12 @@ static void *thread_update_track_time(void *userdata) {
 		const int pos_result = output_get_position(&duration, &position);
 		if (pos_result == 0) {
 			if (duration != last_duration) {
-				print_upnp_time(tbuf, sizeof(tbuf), duration);
+				upnp_time_print(tbuf, duration, 0);
 				replace_var(TRANSPORT_VAR_CUR_TRACK_DUR, tbuf);
 				last_duration = duration;
 			}
 			if (position / one_sec_unit != last_position) {
-				print_upnp_time(tbuf, sizeof(tbuf), position);
+				upnp_time_print(tbuf, position, 0);
 				replace_var(TRANSPORT_VAR_REL_TIME_POS, tbuf);
 				last_position = position / one_sec_unit;
 			}
@@ -738,8 +907,17 @@ static int stop(struct action_event *event)
 	case TRANSPORT_STOPPED:
 		// nothing to change.
 		break;
-	case TRANSPORT_PLAYING:
 	case TRANSPORT_TRANSITIONING:
+		if (fetching_playlist_) {
+			// Stay in TRANSITIONING until the playlist is there,
+			// but don't start playing it then.
+			output_stop();
+			state_after_fetch_ = TRANSPORT_STOPPED;
+			play_after_fetch_ = 0;
+			break;
+		}
+		/* >>> fall through */
+	case TRANSPORT_PLAYING:
 	case TRANSPORT_PAUSED_RECORDING:
 	case TRANSPORT_RECORDING:
 	case TRANSPORT_PAUSED_PLAYBACK:
@@ -764,12 +942,28 @@ static void inform_play_transition_from_output(enum PlayFeedback fb) {
 	service_lock();
 	switch (fb) {
 	case PLAY_STOPPED:
+		if (fetching_playlist_) {
+			// The previous stream ended; the transport already
+			// has the playlist that is being fetched.
+			state_after_fetch_ = TRANSPORT_STOPPED;
+			break;
+		}
+		clear_playlist();
 		replace_transport_uri_and_meta("", "");
 		replace_current_uri_and_meta("", "");
 		change_transport_state(TRANSPORT_STOPPED);
 		break;
 
 	case PLAY_STARTED_NEXT_STREAM: {
+		if (fetching_playlist_) {
+			break;  // The transport moved on to the playlist.
+		}
+		if (playlist_) {
+			playlist_pos_++;
+			replace_current_from_playlist();
+			queue_next_playlist_entry();
+			break;
+		}
 		const char *av_uri = get_var(TRANSPORT_VAR_NEXT_AV_URI);
 		const char *av_meta = get_var(TRANSPORT_VAR_NEXT_AV_URI_META);
 		replace_transport_uri_and_meta(av_uri, av_meta);
@@ -782,6 +976,23 @@ static void inform_play_transition_from_output(enum PlayFeedback fb) {
 	service_unlock();
 }
 
+// Start the output and update the transport. Needs the service lock held.
+// Returns 0 on success.
+static int start_playback(void) {
+	if (output_play(&inform_play_transition_from_output)) {
+		return -1;
+	}
+	change_transport_state(TRANSPORT_PLAYING);
+	if (playlist_) {
+		replace_current_from_playlist();
+	} else {
+		const char *av_uri = get_var(TRANSPORT_VAR_AV_URI);
+		const char *av_meta = get_var(TRANSPORT_VAR_AV_URI_META);
+		replace_current_uri_and_meta(av_uri, av_meta);
+	}
+	return 0;
+}
+
 static int play(struct action_event *event)
 {
 	if (!has_instance_id(event)) {
@@ -805,19 +1016,19 @@ static int play(struct action_event *event)
 		/* >>> fall through */
 
 	case TRANSPORT_PAUSED_PLAYBACK:
-		if (output_play(&inform_play_transition_from_output)) {
+		if (start_playback()) {
 			upnp_set_error(event, 704, "Playing failed");
 			rc = -1;
-		} else {
-			change_transport_state(TRANSPORT_PLAYING);
-			const char *av_uri = get_var(TRANSPORT_VAR_AV_URI);
-			const char *av_meta = get_var(TRANSPORT_VAR_AV_URI_META);
-			replace_current_uri_and_meta(av_uri, av_meta);
 		}
 		break;
 
-	case TRANSPORT_NO_MEDIA_PRESENT:
 	case TRANSPORT_TRANSITIONING:
+		if (fetching_playlist_) {
+			play_after_fetch_ = 1;
+			break;
+		}
+		/* >>> fall through */
+	case TRANSPORT_NO_MEDIA_PRESENT:
 	case TRANSPORT_PAUSED_RECORDING:
 	case TRANSPORT_RECORDING:
 		/* action not allowed in these states - error 701 */
@@ -876,7 +1087,13 @@ static int seek(struct action_event *event)
 	if (strcmp(unit, "REL_TIME") == 0) {
 		// This is the only thing we support right now.
 		const char *target = upnp_get_string(event, "Target");
-		gint64 nanos = parse_upnp_time(target);
+		int64_t nanos = 0;
+		if (!upnp_time_parse(target, &nanos) || nanos < 0) {
+			upnp_set_error(event, UPNP_TRANSPORT_E_ILL_SEEKTARGET,
+				       "Illegal seek target '%s'",
+				       target ? target : "");
+			return -1;
+		}
 		service_lock();
 		if (output_seek(nanos) == 0) {
 			// TODO(hzeller): Seeking might take some time,
@@ -1006,6 +1223,9 @@ struct service *upnp_transport_get_service(void) {
 void upnp_transport_init(struct upnp_device *device) {
 	struct service *service = upnp_transport_get_service();
 	assert(service->last_change == NULL);
+	lock_wait_ = metrics_histogram("gmrender_lock_wait_seconds",
+				       "Time waiting for the service lock.",
+				       "lock=\"transport\"");
 	service->last_change =
 		UPnPLastChangeCollector_new(service->variable_container,
 					    TRANSPORT_EVENT_XML_NS,
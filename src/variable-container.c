@@ -37,6 +37,7 @@
 #include <ctype.h>
 #include <stdint.h>
 
+#include "bitset.h"
 #include "upnp_device.h"
 #include "upnp_service.h"
 #include "xmlescape.h"
@@ -49,13 +50,182 @@ struct cb_list {
 	struct cb_list *next;
 };
 
+// Values of up to this size (including the terminating NUL) are stored
+// directly in the slot; most variables (state names, numbers, times) fit.
+#define INLINE_VALUE_SIZE 24
+
+// Longer values (URIs, DIDL-Lite meta data) live in a reference counted
+// buffer. Variables set to the same long value, such as AVTransportURIMetaData
+// and CurrentTrackMetaData, share one buffer instead of each having a copy.
+struct shared_value {
+	int refcount;
+	size_t len;
+	char data[];
+};
+
+enum slot_kind {
+	SLOT_DEFAULT,  // Points to the default value in the var_meta; no copy.
+	SLOT_INLINE,   // String in 'inline_value'.
+	SLOT_SHARED,   // String in 'shared'.
+	SLOT_INTEGER,  // Integer, also formatted into 'inline_value'.
+};
+
+// Variables with an integer (or boolean) datatype hold their value as
+// integer as long as it is set to a plain number; the string form is
+// formatted right away when it is set, so that reading never modifies the
+// slot. Everything else is a string.
+struct value_slot {
+	enum slot_kind kind;
+	long long integer;
+	const char *default_value;
+	struct shared_value *shared;
+	char inline_value[INLINE_VALUE_SIZE];
+};
+
+// Copy of a value that is about to be replaced; it needs to stay around
+// until all change callbacks have seen it.
+struct old_value {
+	char inline_value[INLINE_VALUE_SIZE];
+	struct shared_value *shared;  // Holding a reference if non-NULL.
+	const char *value;
+};
+
 struct variable_container {
 	int variable_num;
 	const struct var_meta *vars;
-	char **values;
+	struct value_slot *values;
 	struct cb_list *callbacks;
 };
 
+static int is_integer_datatype(param_datatype datatype) {
+	switch (datatype) {
+	case DATATYPE_BOOLEAN:
+	case DATATYPE_I2:
+	case DATATYPE_I4:
+	case DATATYPE_UI2:
+	case DATATYPE_UI4:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Parse value if it is an integer in canonical form, i.e. formatting it
+// again results in the same string. Returns 1 on success.
+static int parse_canonical_integer(const char *value, long long *result) {
+	const char *p = value;
+	if (*p == '-')
+		++p;
+	if (*p < '0' || *p > '9' || (p[0] == '0' && p[1] != '\0')
+	    || strlen(p) > 18 || (value[0] == '-' && p[0] == '0'))
+		return 0;
+	long long n = 0;
+	for (/**/; *p; ++p) {
+		if (*p < '0' || *p > '9')
+			return 0;
+		n = n * 10 + (*p - '0');
+	}
+	*result = (value[0] == '-') ? -n : n;
+	return 1;
+}
+
+static void shared_value_unref(struct shared_value *shared) {
+	if (--shared->refcount == 0)
+		free(shared);
+}
+
+static const char *slot_string(const struct value_slot *slot) {
+	switch (slot->kind) {
+	case SLOT_DEFAULT: return slot->default_value;
+	case SLOT_SHARED:  return slot->shared->data;
+	case SLOT_INLINE:
+	case SLOT_INTEGER: break;
+	}
+	return slot->inline_value;
+}
+
+// Drop whatever the slot holds; the caller sets the new value.
+static void slot_release(struct value_slot *slot) {
+	if (slot->kind == SLOT_SHARED) {
+		shared_value_unref(slot->shared);
+		slot->shared = NULL;
+	}
+}
+
+static void slot_set_integer(struct value_slot *slot, long long value) {
+	slot_release(slot);
+	slot->kind = SLOT_INTEGER;
+	slot->integer = value;
+	snprintf(slot->inline_value, sizeof(slot->inline_value), "%lld", value);
+}
+
+// Find a buffer with the same content in any of the variables, so that
+// we can share it.
+static struct shared_value *find_shared(variable_container_t *object,
+					const char *value, size_t len) {
+	for (int i = 0; i < object->variable_num; ++i) {
+		struct value_slot *slot = &object->values[i];
+		if (slot->kind != SLOT_SHARED)
+			continue;
+		if (slot->shared->data == value
+		    || (slot->shared->len == len
+			&& memcmp(slot->shared->data, value, len) == 0))
+			return slot->shared;
+	}
+	return NULL;
+}
+
+static void slot_set_string(variable_container_t *object,
+			    struct value_slot *slot, const char *value) {
+	const size_t len = strlen(value);
+	if (len < INLINE_VALUE_SIZE) {
+		slot_release(slot);
+		memcpy(slot->inline_value, value, len + 1);
+		slot->kind = SLOT_INLINE;
+		return;
+	}
+	// Take the reference first: value might live in our own buffer.
+	struct shared_value *shared = find_shared(object, value, len);
+	if (shared) {
+		shared->refcount++;
+	} else {
+		shared = (struct shared_value*)
+			malloc(sizeof(struct shared_value) + len + 1);
+		shared->refcount = 1;
+		shared->len = len;
+		memcpy(shared->data, value, len + 1);
+	}
+	slot_release(slot);
+	slot->kind = SLOT_SHARED;
+	slot->shared = shared;
+}
+
+static void old_value_save(const struct value_slot *slot,
+			   struct old_value *old) {
+	old->shared = NULL;
+	switch (slot->kind) {
+	case SLOT_DEFAULT:
+		old->value = slot->default_value;  // static, stays valid.
+		break;
+	case SLOT_SHARED:
+		old->shared = slot->shared;
+		old->shared->refcount++;
+		old->value = old->shared->data;
+		break;
+	case SLOT_INLINE:
+	case SLOT_INTEGER:
+		memcpy(old->inline_value, slot_string(slot),
+		       sizeof(old->inline_value));
+		old->value = old->inline_value;
+		break;
+	}
+}
+
+static void old_value_release(struct old_value *old) {
+	if (old->shared)
+		shared_value_unref(old->shared);
+}
+
 static int cmp_meta_id(const void *a, const void *b) {
 	return ((struct var_meta*)a)->id - ((struct var_meta*)b)->id;
 }
@@ -85,20 +255,29 @@ variable_container_t *VariableContainer_new(int variable_num,
 	// take care of it here. However accesses the meta-data does it through
 	// VariableContainer
 	result->vars = create_sorted_meta(variable_num, unordered_vars);
-	result->values = (char **) malloc(variable_num * sizeof(char*));
+	result->values = (struct value_slot *)
+		calloc(variable_num, sizeof(struct value_slot));
 	result->callbacks = NULL;
 	for (int i = 0; i < variable_num; ++i) {
 		assert(result->vars[i].name != NULL);
 		assert(result->vars[i].id == i);
 		assert(result->vars[i].default_value != NULL);
-		result->values[i] = strdup(result->vars[i].default_value);
+		struct value_slot *slot = &result->values[i];
+		slot->default_value = result->vars[i].default_value;
+		long long integer;
+		if (is_integer_datatype(result->vars[i].datatype)
+		    && parse_canonical_integer(slot->default_value, &integer)) {
+			slot_set_integer(slot, integer);
+		} else {
+			slot->kind = SLOT_DEFAULT;
+		}
 	}
 	return result;
 }
 
 void VariableContainer_delete(variable_container_t *object) {
 	for (int i = 0; i < object->variable_num; ++i) {
-		free(object->values[i]);
+		slot_release(&object->values[i]);
 	}
 	free(object->values);
 
@@ -128,7 +307,26 @@ const char *VariableContainer_get(variable_container_t *object,
 	const char *varname = object->vars[var].name;
 	if (name) *name = varname;
 	// Names of not used variables are set to NULL.
-	return varname ? object->values[var] : NULL;
+	return varname ? slot_string(&object->values[var]) : NULL;
+}
+
+int VariableContainer_get_int(variable_container_t *object, int var,
+			      long long *value) {
+	if (var < 0 || var >= object->variable_num
+	    || object->values[var].kind != SLOT_INTEGER)
+		return 0;
+	*value = object->values[var].integer;
+	return 1;
+}
+
+static void notify_change(variable_container_t *object, int var_num,
+			  const char *old_value) {
+	const char *new_value = slot_string(&object->values[var_num]);
+	for (struct cb_list *it = object->callbacks; it; it = it->next) {
+		it->callback(it->userdata,
+			     var_num, object->vars[var_num].name,
+			     old_value, new_value);
+	}
 }
 
 // Change content of variable with given number to NUL terminated content.
@@ -136,17 +334,41 @@ int VariableContainer_change(variable_container_t *object,
 			     int var_num, const char *value) {
 	assert(var_num >= 0 && var_num < object->variable_num);
 	if (value == NULL) value = "";
-	if (strcmp(value, object->values[var_num]) == 0)
+	long long integer;
+	if (is_integer_datatype(object->vars[var_num].datatype)
+	    && parse_canonical_integer(value, &integer)) {
+		return VariableContainer_change_int(object, var_num, integer);
+	}
+	struct value_slot *slot = &object->values[var_num];
+	if (strcmp(value, slot_string(slot)) == 0)
 		return 0;  // no change.
-	char *old_value = object->values[var_num];
-	char *new_value = strdup(value);
-	object->values[var_num] = new_value;
-	for (struct cb_list *it = object->callbacks; it; it = it->next) {
-		it->callback(it->userdata,
-			     var_num, object->vars[var_num].name,
-			     old_value, new_value);
+	if (object->callbacks == NULL) {
+		slot_set_string(object, slot, value);
+		return 1;
+	}
+	struct old_value old;
+	old_value_save(slot, &old);
+	slot_set_string(object, slot, value);
+	notify_change(object, var_num, old.value);
+	old_value_release(&old);
+	return 1;
+}
+
+int VariableContainer_change_int(variable_container_t *object,
+				 int var_num, long long value) {
+	assert(var_num >= 0 && var_num < object->variable_num);
+	struct value_slot *slot = &object->values[var_num];
+	if (slot->kind == SLOT_INTEGER && slot->integer == value)
+		return 0;  // no change.
+	if (object->callbacks == NULL) {
+		slot_set_integer(slot, value);
+		return 1;
 	}
-	free(old_value);
+	struct old_value old;
+	old_value_save(slot, &old);
+	slot_set_integer(slot, value);
+	notify_change(object, var_num, old.value);
+	old_value_release(&old);
 	return 1;
 }
 
@@ -165,6 +387,7 @@ void VariableContainer_register_callback(variable_container_t *object,
 struct upnp_last_change_builder {
 	const char *xml_namespace;
 	struct xmldoc *change_event_doc;
+	struct xmlelement *event_element;
 	struct xmlelement *instance_element;
 };
 
@@ -173,6 +396,7 @@ upnp_last_change_builder_t *UPnPLastChangeBuilder_new(const char *xml_namespace)
 		malloc(sizeof(upnp_last_change_builder_t));
 	result->xml_namespace = xml_namespace;
 	result->change_event_doc = NULL;
+	result->event_element = NULL;
 	result->instance_element = NULL;
 	return result;
 }
@@ -184,48 +408,64 @@ void UPnPLastChangeBuilder_delete(upnp_last_change_builder_t *builder) {
 	free(builder);
 }
 
+// The volume related variables need another qualifying attribute that
+// represents the channel. The variables in the container itself always
+// represent the "Master" channel; other channels are sent explicitly
+// with UPnPLastChangeCollector_add_channel_value().
+static int is_channel_variable(const char *name) {
+	return (strcmp(name, "Volume") == 0
+		|| strcmp(name, "VolumeDB") == 0
+		|| strcmp(name, "Mute") == 0
+		|| strcmp(name, "Loudness") == 0);
+}
+
 void UPnPLastChangeBuilder_add(upnp_last_change_builder_t *builder,
 			       const char *name, const char *value) {
+	UPnPLastChangeBuilder_add_channel(builder, name,
+					  is_channel_variable(name)
+					  ? "Master" : NULL,
+					  value);
+}
+
+void UPnPLastChangeBuilder_add_channel(upnp_last_change_builder_t *builder,
+				       const char *name, const char *channel,
+				       const char *value) {
 	assert(name != NULL);
 	assert(value != NULL);
 	if (builder->change_event_doc == NULL) {
 		builder->change_event_doc = xmldoc_new();
-		struct xmlelement *toplevel =
+		builder->event_element =
 			xmldoc_new_topelement(builder->change_event_doc, "Event",
 					      builder->xml_namespace);
 		// Right now, we only have exactly one instance.
 		builder->instance_element =
-			add_attributevalue_element(builder->change_event_doc,
-						   toplevel,
-						   "InstanceID", "val", "0");
+			xmlelement_new(builder->change_event_doc,
+				       builder->event_element, "InstanceID");
+		xmlelement_set_attribute(builder->change_event_doc,
+					 builder->instance_element, "val", "0");
 	}
 	struct xmlelement *xml_value;
-	xml_value = add_attributevalue_element(builder->change_event_doc,
-					       builder->instance_element,
-					       name, "val", value);
-	// HACK!
-	// The volume related events need another qualifying
-	// attribute that represents the channel. Since all other elements just
-	// have one value to transmit without qualifier, the variable container
-	// is oblivious about this notion of a qualifier.
-	// So this is a bit ugly: if we see the variables in question,
-	// we add the attribute manually.
-	if (strcmp(name, "Volume") == 0
-	    || strcmp(name, "VolumeDB") == 0
-	    || strcmp(name, "Mute") == 0
-	    || strcmp(name, "Loudness") == 0) {
-	  xmlelement_set_attribute(builder->change_event_doc,
-				   xml_value, "channel", "Master");
+	xml_value = xmlelement_new(builder->change_event_doc,
+				   builder->instance_element, name);
+	xmlelement_set_attribute(builder->change_event_doc,
+				 xml_value, "val", value);
+	if (channel != NULL) {
+		xmlelement_set_attribute(builder->change_event_doc,
+					 xml_value, "channel", channel);
 	}
+	xmlelement_end(builder->change_event_doc, xml_value);
 }
 
 char *UPnPLastChangeBuilder_to_xml(upnp_last_change_builder_t *builder) {
 	if (builder->change_event_doc == NULL)
 		return NULL;
 
+	xmlelement_end(builder->change_event_doc, builder->instance_element);
+	xmlelement_end(builder->change_event_doc, builder->event_element);
 	char *xml_doc_string = xmldoc_tostring(builder->change_event_doc);
 	xmldoc_free(builder->change_event_doc);
 	builder->change_event_doc = NULL;
+	builder->event_element = NULL;
 	builder->instance_element = NULL;
 	return xml_doc_string;
 }
@@ -234,7 +474,8 @@ char *UPnPLastChangeBuilder_to_xml(upnp_last_change_builder_t *builder) {
 struct upnp_last_change_collector {
 	variable_container_t *variable_container;
 	int last_change_variable_num;      // the variable we manipulate.
-	uint32_t not_eventable_variables;  // variables not to event on.
+	struct bitset *not_eventable_variables;  // variables not to event on.
+	struct bitset *changed_variables;  // changed, not yet in the builder.
 	struct upnp_device *upnp_device;
 	const char *service_id;
 	int open_transactions;
@@ -242,6 +483,8 @@ struct upnp_last_change_collector {
 };
 
 static void UPnPLastChangeCollector_notify(upnp_last_change_collector_t *obj);
+static void UPnPLastChangeCollector_add(upnp_last_change_collector_t *object,
+					const char *name, const char *value);
 static void UPnPLastChangeCollector_callback(void *userdata,
 					     int var_num, const char *var_name,
 					     const char *old_value,
@@ -256,7 +499,6 @@ UPnPLastChangeCollector_new(variable_container_t *variable_container,
 		malloc(sizeof(upnp_last_change_collector_t));
 	result->variable_container = variable_container;
 	result->last_change_variable_num = -1;
-	result->not_eventable_variables = 0;
 	result->upnp_device = upnp_device;
 	result->service_id = service_id;
 	result->open_transactions = 0;
@@ -267,7 +509,8 @@ UPnPLastChangeCollector_new(variable_container_t *variable_container,
 	// without proper registration.
 	// Also determine, which variable is actually the "LastChange" one.
 	const int var_count = VariableContainer_get_num_vars(variable_container);
-	assert(var_count < 32);  // otherwise widen not_eventable_variables
+	result->not_eventable_variables = Bitset_new(var_count);
+	result->changed_variables = Bitset_new(var_count);
 	for (int i = 0; i < var_count; ++i) {
 		const char *name;
 		const char *value = VariableContainer_get(variable_container,
@@ -280,7 +523,7 @@ UPnPLastChangeCollector_new(variable_container_t *variable_container,
 			continue;
 		}
 		// Send over all variables except "LastChange" itself.
-		UPnPLastChangeBuilder_add(result->builder, name, value);
+		UPnPLastChangeCollector_add(result, name, value);
 	}
 	assert(result->last_change_variable_num >= 0); // we expect to have one.
 	// The state change variable itself is not eventable.
@@ -296,7 +539,18 @@ UPnPLastChangeCollector_new(variable_container_t *variable_container,
 
 void UPnPLastChangeCollector_add_ignore(upnp_last_change_collector_t *object,
 					int variable_num) {
-	object->not_eventable_variables |= (1 << variable_num);
+	Bitset_set(object->not_eventable_variables, variable_num);
+}
+
+void UPnPLastChangeCollector_add_channel_value(
+	upnp_last_change_collector_t *object,
+	int variable_num, const char *channel, const char *value) {
+	const char *name;
+	if (VariableContainer_get(object->variable_container,
+				  variable_num, &name) == NULL)
+		return;
+	UPnPLastChangeBuilder_add_channel(object->builder, name, channel, value);
+	UPnPLastChangeCollector_notify(object);
 }
 
 void UPnPLastChangeCollector_start(upnp_last_change_collector_t *object) {
@@ -315,6 +569,18 @@ static void UPnPLastChangeCollector_notify(upnp_last_change_collector_t *obj) {
 	if (obj->open_transactions != 0)
 		return;
 
+	// Each changed variable is reported once with its latest value, even
+	// if it changed multiple times within the transaction.
+	for (int i = Bitset_next(obj->changed_variables, 0); i >= 0;
+	     i = Bitset_next(obj->changed_variables, i + 1)) {
+		const char *name;
+		const char *value = VariableContainer_get(obj->variable_container,
+							  i, &name);
+		if (value)
+			UPnPLastChangeCollector_add(obj, name, value);
+	}
+	Bitset_clear_all(obj->changed_variables);
+
 	char *xml_doc_string = UPnPLastChangeBuilder_to_xml(obj->builder);
 	if (xml_doc_string == NULL)
 		return;
@@ -343,20 +609,27 @@ static void UPnPLastChangeCollector_notify(upnp_last_change_collector_t *obj) {
 	free(xml_doc_string);
 }
 
-// The actual callback collecting changes by building an <Event/> XML document.
-// This is not very robust if in the same transaction, we get the same variable
-// changed twice -- it emits two changes.
+static void UPnPLastChangeCollector_add(upnp_last_change_collector_t *object,
+					const char *name, const char *value) {
+	UPnPLastChangeBuilder_add(object->builder, name, value);
+}
+
+// The actual callback collecting changes. It only marks the variable; the
+// <Event/> XML document is built from the current values once the
+// transaction is finished.
 static void UPnPLastChangeCollector_callback(void *userdata,
 					     int var_num, const char *var_name,
 					     const char *old_value,
 					     const char *new_value) {
+	(void)var_name;
 	(void)old_value;
+	(void)new_value;
 	upnp_last_change_collector_t *object =
 		(upnp_last_change_collector_t*) userdata;
 
-	if (object->not_eventable_variables & (1 << var_num)) {
+	if (Bitset_test(object->not_eventable_variables, var_num)) {
 		return;  // ignore changes on non-eventable variables.
 	}
-	UPnPLastChangeBuilder_add(object->builder, var_name, new_value);
+	Bitset_set(object->changed_variables, var_num);
 	UPnPLastChangeCollector_notify(object);
 }
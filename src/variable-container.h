@@ -32,7 +32,8 @@
  *
  * variable_container - handling a bunch of variables containting NUL
  *   terminated strings, allowing C-callbacks to be called when content changes
- *   and differs from previous value.
+ *   and differs from previous value. Integer variables can be accessed
+ *   as such without going through strings.
  *
  * upnp_last_change_builder - a builder for the LastChange XML document
  *   containing name/value pairs of variables.
@@ -80,6 +81,18 @@ const char *VariableContainer_get(variable_container_t *object, int var,
 int VariableContainer_change(variable_container_t *object,
 			     int variable_num, const char *value);
 
+// Variables with an integer or boolean datatype are stored as integer
+// while set to plain numbers, and only formatted when their string value
+// is needed. Returns 1 and the value in *value if variable holds an
+// integer, 0 otherwise.
+int VariableContainer_get_int(variable_container_t *object, int var,
+			      long long *value);
+
+// Change variable to the given integer. Returns like
+// VariableContainer_change().
+int VariableContainer_change_int(variable_container_t *object,
+				 int variable_num, long long value);
+
 // Callback handling. Whenever a variable changes, the callback is called.
 // Be careful when changing variables in the original container as this will
 // trigger recursive calls to the container.
@@ -101,8 +114,16 @@ typedef struct upnp_last_change_builder upnp_last_change_builder_t;
 upnp_last_change_builder_t *UPnPLastChangeBuilder_new(const char *xml_namespace);
 void UPnPLastChangeBuilder_delete(upnp_last_change_builder_t *builder);
 
+// Add a value. The volume related variables (Volume, VolumeDB, Mute,
+// Loudness) get channel="Master", as the variables hold the Master values.
 void UPnPLastChangeBuilder_add(upnp_last_change_builder_t *builder,
 			       const char *name, const char *value);
+// Add a value qualified with a channel="..." attribute as used for
+// per-channel volume in the RenderingControl service. If channel is NULL,
+// no channel attribute is added.
+void UPnPLastChangeBuilder_add_channel(upnp_last_change_builder_t *builder,
+				       const char *name, const char *channel,
+				       const char *value);
 // Returns a newly allocated XML string that needs to be free()'d by the caller.
 // Resets the document. If no changes have been added, NULL is returned.
 char *UPnPLastChangeBuilder_to_xml(upnp_last_change_builder_t *builder);
@@ -127,6 +148,14 @@ UPnPLastChangeCollector_new(variable_container_t *variable_container,
 void UPnPLastChangeCollector_add_ignore(upnp_last_change_collector_t *object,
 					int variable_num);
 
+// Event a value of variable "variable_num" for a channel other than
+// "Master". Per-channel values are not stored in the variable container
+// (which only holds the Master values), so they need to be passed
+// explicitly.
+void UPnPLastChangeCollector_add_channel_value(
+	upnp_last_change_collector_t *object,
+	int variable_num, const char *channel, const char *value);
+
 // If we know that there are a couple of changes upcoming, we can
 // 'start' a transaction and tell the collector to keep collecting until we
 // 'finish'. This can be nested.
@@ -47,6 +47,9 @@ typedef struct {
 	off_t pos;
 	const char *contents;
 	size_t len;
+	char *generated;    // Owned contents, if created for this request.
+	const struct webserver_handler *handler;
+	void *handle;       // Handle returned by handler->open().
 } WebServerFile;
 
 struct virtual_file;
@@ -56,9 +59,17 @@ static struct virtual_file {
 	const char *contents;
 	const char *content_type;
 	size_t len;
+	// Dynamic content: either generated in one piece or via a handler.
+	char *(*generate)(void);
+	const struct webserver_handler *handler;
+	void *userdata;
 	struct virtual_file *next;
 } *virtual_files = NULL;
 
+static int is_dynamic(const struct virtual_file *vf) {
+	return vf->generate != NULL || vf->handler != NULL;
+}
+
 int webserver_register_buf(const char *path, const char *contents,
 			   const char *content_type)
 {
@@ -75,6 +86,7 @@ int webserver_register_buf(const char *path, const char *contents,
 	if (entry == NULL) {
 		return -1;
 	}
+	memset(entry, 0, sizeof(*entry));
 	entry->len = strlen(contents);
 	entry->contents = contents;
 	entry->virtual_fname = path;
@@ -109,6 +121,7 @@ int webserver_register_file(const char *path, const char *content_type)
 	if (entry == NULL) {
 		return -1;
 	}
+	memset(entry, 0, sizeof(*entry));
 	if (buf.st_size) {
 		char *cbuf;
 		FILE *in;
@@ -143,13 +156,67 @@ int webserver_register_file(const char *path, const char *content_type)
 	return 0;
 }
 
+static int register_dynamic(const char *path, const char *content_type,
+			    char *(*generate)(void),
+			    const struct webserver_handler *handler,
+			    void *userdata)
+{
+	assert(path != NULL);
+	assert(content_type != NULL);
+
+	Log_info("webserver", "Provide %s (%s) dynamically",
+		 path, content_type);
+
+	struct virtual_file *entry =
+		(struct virtual_file*)malloc(sizeof(struct virtual_file));
+	if (entry == NULL) {
+		return -1;
+	}
+	memset(entry, 0, sizeof(*entry));
+	entry->virtual_fname = path;
+	entry->content_type = content_type;
+	entry->generate = generate;
+	entry->handler = handler;
+	entry->userdata = userdata;
+	entry->next = virtual_files;
+	virtual_files = entry;
+
+	return 0;
+}
+
+int webserver_register_generator(const char *path, const char *content_type,
+				 char *(*generate)(void))
+{
+	assert(generate != NULL);
+	return register_dynamic(path, content_type, generate, NULL, NULL);
+}
+
+int webserver_register_handler(const char *path, const char *content_type,
+			       const struct webserver_handler *handler,
+			       void *userdata)
+{
+	assert(handler != NULL);
+	return register_dynamic(path, content_type, NULL, handler, userdata);
+}
+
+// libupnp hands us the path including the query, if any. Returns 1 if
+// the path part of filename is the given virtual file name.
+static int path_matches(const char *filename, const char *virtual_fname) {
+	const size_t path_len = strcspn(filename, "?");
+	return (strncmp(filename, virtual_fname, path_len) == 0
+		&& virtual_fname[path_len] == '\0');
+}
+
 static VD_GET_INFO_CALLBACK(webserver_get_info, filename, info, cookie)
 {
 	struct virtual_file *virtfile = virtual_files;
 
 	while (virtfile != NULL) {
-		if (strcmp(filename, virtfile->virtual_fname) == 0) {
-			UpnpFileInfo_set_FileLength(info, virtfile->len);
+		if (path_matches(filename, virtfile->virtual_fname)) {
+			// We don't know the length of dynamic content upfront.
+			UpnpFileInfo_set_FileLength(info, is_dynamic(virtfile)
+						    ? UPNP_USING_CHUNKED
+						    : (off_t) virtfile->len);
 			UpnpFileInfo_set_LastModified(info, 0);
 			UpnpFileInfo_set_IsDirectory(info, 0);
 			UpnpFileInfo_set_IsReadable(info, 1);
@@ -178,12 +245,33 @@ static VD_OPEN_CALLBACK(webserver_open, filename, mode, cookie)
 		return NULL;
 	}
 
+	const char *query = strchr(filename, '?');
+	if (query != NULL)
+		++query;
 	for (struct virtual_file *vf = virtual_files; vf; vf = vf->next) {
-		if (strcmp(filename, vf->virtual_fname) == 0) {
+		if (path_matches(filename, vf->virtual_fname)) {
 			WebServerFile *file = (WebServerFile*)malloc(sizeof(WebServerFile));
-			file->pos = 0;
-			file->len = vf->len;
-			file->contents = vf->contents;
+			memset(file, 0, sizeof(*file));
+			if (vf->handler) {
+				file->handle = vf->handler->open(vf->userdata,
+								 query);
+				if (file->handle == NULL) {
+					free(file);
+					return NULL;
+				}
+				file->handler = vf->handler;
+			} else if (vf->generate) {
+				file->generated = vf->generate();
+				if (file->generated == NULL) {
+					free(file);
+					return NULL;
+				}
+				file->contents = file->generated;
+				file->len = strlen(file->generated);
+			} else {
+				file->len = vf->len;
+				file->contents = vf->contents;
+			}
 			return file;
 		}
 	}
@@ -201,6 +289,10 @@ static VD_READ_CALLBACK(webserver_read, fh, buf, buflen, cookie)
 	WebServerFile *file = (WebServerFile *) fh;
 	ssize_t len = -1;
 
+	if (file->handler) {
+		return file->handler->read(file->handle, buf, buflen);
+	}
+
 	len = minimum(buflen, file->len - file->pos);
 	memcpy(buf, file->contents + file->pos, len);
 
@@ -225,6 +317,10 @@ static VD_SEEK_CALLBACK(webserver_seek, fh, offset, origin, cookie)
 	WebServerFile *file = (WebServerFile *) fh;
 	off_t newpos = -1;
 
+	if (file->handler) {
+		return -1;  // Streams can't seek.
+	}
+
 	switch (origin) {
 	case SEEK_SET:
 		newpos = offset;
@@ -251,6 +347,10 @@ static VD_CLOSE_CALLBACK(webserver_close, fh, cookie)
 {
 	WebServerFile *file = (WebServerFile *) fh;
 
+	if (file->handler) {
+		file->handler->close(file->handle);
+	}
+	free(file->generated);
 	free(file);
 
 	return 0;
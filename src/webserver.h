@@ -34,4 +34,25 @@ int webserver_register_buf(const char *path, const char *contents,
 int webserver_register_file(const char *path,
                             const char *content_type);
 
+// Provide content that is created at request time by calling "generate",
+// which returns a malloc()'ed NUL terminated string (or NULL on error).
+int webserver_register_generator(const char *path, const char *content_type,
+                                 char *(*generate)(void));
+
+// Provide a stream of content. open() is called for each request with the
+// query part of the URL (without the '?'; NULL if there is none) and
+// returns a handle passed to the other functions, or NULL to fail the
+// request. read() fills up to "len" bytes into "buf" and returns the number
+// of bytes, 0 at the end of the stream or -1 on error; it can block until
+// data is available. Dynamic content is sent chunked.
+// Note, each open stream occupies one of the libupnp worker threads.
+struct webserver_handler {
+	void *(*open)(void *userdata, const char *query);
+	int (*read)(void *handle, char *buf, size_t len);
+	void (*close)(void *handle);
+};
+int webserver_register_handler(const char *path, const char *content_type,
+                               const struct webserver_handler *handler,
+                               void *userdata);
+
 #endif /* _WEBSERVER_H */
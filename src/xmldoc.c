@@ -34,47 +34,91 @@
 #include <assert.h>
 #include <string.h>
 
-#include <ixml.h>
+#include <glib.h>
 
 #include "xmldoc.h"
+#include "xmlescape.h"
 
-// The structs are mere placeholders that we internally cast to the
-// objects used in the upnplib.
-struct xmlelement {};
-struct xmldoc {};
+// Our documents are not deeply nested; SCPD is the deepest with 6 levels.
+#define MAX_DEPTH 16
 
-static IXML_Document *to_idoc(struct xmldoc *x) {
-	return (IXML_Document*) x;
-}
+// An open element. We don't copy the name: it is in the output already,
+// right after the '<' of the start tag.
+struct xmlelement {
+	size_t name_offset;
+	size_t name_len;
+};
 
-static IXML_Element *to_ielem(struct xmlelement *x) {
-	return (IXML_Element*) x;
-}
+struct xmldoc {
+	GString *out;
+	struct xmlelement open[MAX_DEPTH];
+	int depth;
+	int start_tag_open;  // Start tag not yet closed with '>'.
+};
 
 struct xmldoc *xmldoc_new(void)
 {
-	IXML_Document *doc;
-	doc = ixmlDocument_createDocument();
-	return (struct xmldoc*) doc;
+	struct xmldoc *doc = (struct xmldoc*) malloc(sizeof(*doc));
+	// Large enough for LastChange events without re-allocation.
+	doc->out = g_string_sized_new(1024);
+	g_string_append(doc->out, "<?xml version=\"1.0\"?>\n");
+	doc->depth = 0;
+	doc->start_tag_open = 0;
+	return doc;
 }
 
 void xmldoc_free(struct xmldoc *doc)
 {
 	assert(doc != NULL);
-	ixmlDocument_free(to_idoc(doc));
+	if (doc->out != NULL)
+		g_string_free(doc->out, TRUE);
+	free(doc);
 }
 
 char *xmldoc_tostring(struct xmldoc *doc)
 {
-	char *result = NULL;
 	assert(doc != NULL);
-	result = ixmlDocumenttoString(to_idoc(doc));
+	assert(doc->out != NULL);
+	assert(doc->depth == 0);  // Forgot to end an element ?
+	// Hand over the buffer; g_malloc() is plain malloc().
+	char *result = g_string_free(doc->out, FALSE);
+	doc->out = NULL;
 	return result;
 }
 
-struct xmldoc *xmldoc_parsexml(const char *xml_text) {
-	IXML_Document *doc = ixmlParseBuffer(xml_text);
-	return (struct xmldoc*) doc;
+static void close_start_tag(struct xmldoc *doc)
+{
+	if (doc->start_tag_open) {
+		g_string_append_c(doc->out, '>');
+		doc->start_tag_open = 0;
+	}
+}
+
+// Escape "value" to be used within double quotes.
+static void append_attribute_value(GString *out, const char *value)
+{
+	const char *quote;
+	while ((quote = strchr(value, '"')) != NULL) {
+		xmlescape_append(out, value, quote - value, 0);
+		g_string_append(out, "&quot;");
+		value = quote + 1;
+	}
+	xmlescape_append(out, value, strlen(value), 0);
+}
+
+static struct xmlelement *start_element(struct xmldoc *doc,
+					const char *elementName)
+{
+	assert(doc->out != NULL);
+	assert(doc->depth < MAX_DEPTH);
+	close_start_tag(doc);
+	g_string_append_c(doc->out, '<');
+	struct xmlelement *element = &doc->open[doc->depth++];
+	element->name_offset = doc->out->len;
+	element->name_len = strlen(elementName);
+	g_string_append_len(doc->out, elementName, element->name_len);
+	doc->start_tag_open = 1;
+	return element;
 }
 
 struct xmlelement *xmldoc_new_topelement(struct xmldoc *doc,
@@ -83,66 +127,42 @@ struct xmlelement *xmldoc_new_topelement(struct xmldoc *doc,
 {
 	assert(doc != NULL);
 	assert(elementName != NULL);
-	IXML_Element *element;
+	assert(doc->depth == 0);
+	struct xmlelement *element = start_element(doc, elementName);
 	if (xmlns) {
-		element = ixmlDocument_createElementNS(to_idoc(doc), xmlns,
-                                                       elementName);
-                ixmlElement_setAttribute(element, "xmlns", xmlns);
-	} else {
-		element = ixmlDocument_createElement(to_idoc(doc), elementName);
+		xmlelement_set_attribute(doc, element, "xmlns", xmlns);
 	}
-	ixmlNode_appendChild((IXML_Node *)(to_idoc(doc)),(IXML_Node *)element);
-	return (struct xmlelement *) element;
+	return element;
 }
 
-struct xmlelement *xmlelement_new(struct xmldoc *doc, const char *elementName)
+struct xmlelement *xmlelement_new(struct xmldoc *doc,
+				  struct xmlelement *parent,
+				  const char *elementName)
 {
 	assert(doc != NULL);
 	assert(elementName != NULL);
-	IXML_Element *element;
-	element = ixmlDocument_createElement(to_idoc(doc), elementName);
-	return (struct xmlelement*) element;
+	assert(doc->depth > 0 && parent == &doc->open[doc->depth - 1]);
+	return start_element(doc, elementName);
 }
 
-static struct xmlelement *find_element(IXML_Node *node, const char *key) {
-	node = ixmlNode_getFirstChild(node);
-	for (/**/; node != NULL; node = ixmlNode_getNextSibling(node)) {
-		if (strcmp(ixmlNode_getNodeName(node), key) == 0) {
-			return (struct xmlelement*) node;
-		}
-	}
-	return NULL;
-}
-
-struct xmlelement *find_element_in_doc(struct xmldoc *doc,
-				       const char *key) {
-
-	return find_element((IXML_Node*) to_idoc(doc), key);
-}
-
-struct xmlelement *find_element_in_element(struct xmlelement *element,
-					   const char *key) {
-	return find_element((IXML_Node*) to_ielem(element), key);
-}
-
-char *get_node_value(struct xmlelement *element) {
-	IXML_Node *node = (IXML_Node*) to_ielem(element);
-	node = ixmlNode_getFirstChild(node);
-	const char *node_value = (node != NULL
-				  ? ixmlNode_getNodeValue(node)
-				  : NULL);
-	return strdup(node_value != NULL ? node_value : "");
-}
-
-void xmlelement_add_element(struct xmldoc *doc,
-			    struct xmlelement *parent,
-			    struct xmlelement *child)
+void xmlelement_end(struct xmldoc *doc, struct xmlelement *element)
 {
 	assert(doc != NULL);
-	assert(parent != NULL);
-	assert(child != NULL);
-	ixmlNode_appendChild((IXML_Node *) to_ielem(parent),
-                             (IXML_Node *) to_ielem(child));
+	assert(doc->depth > 0 && element == &doc->open[doc->depth - 1]);
+	--doc->depth;
+	if (doc->start_tag_open) {
+		g_string_append(doc->out, "/>");
+		doc->start_tag_open = 0;
+		return;
+	}
+	g_string_append(doc->out, "</");
+	// The name is in our own buffer, which might move while appending,
+	// so make room first.
+	const size_t pos = doc->out->len;
+	g_string_set_size(doc->out, pos + element->name_len);
+	memcpy(doc->out->str + pos, doc->out->str + element->name_offset,
+	       element->name_len);
+	g_string_append_c(doc->out, '>');
 }
 
 void xmlelement_add_text(struct xmldoc *doc,
@@ -150,11 +170,10 @@ void xmlelement_add_text(struct xmldoc *doc,
 			 const char *text)
 {
 	assert(doc != NULL);
-	assert(parent != NULL);
+	assert(doc->depth > 0 && parent == &doc->open[doc->depth - 1]);
 	assert(text != NULL);
-	IXML_Node *textNode;
-	textNode = ixmlDocument_createTextNode(to_idoc(doc), text);
-	ixmlNode_appendChild((IXML_Node *) to_ielem(parent), textNode);
+	close_start_tag(doc);
+	xmlescape_append(doc->out, text, strlen(text), 0);
 }
 
 void xmlelement_set_attribute(struct xmldoc *doc,
@@ -163,56 +182,57 @@ void xmlelement_set_attribute(struct xmldoc *doc,
 			      const char *value)
 {
 	assert(doc != NULL);
-	assert(element != NULL);
+	assert(doc->depth > 0 && element == &doc->open[doc->depth - 1]);
+	assert(doc->start_tag_open);  // Already has content.
 	assert(name != NULL);
 	assert(value != NULL);
-	ixmlElement_setAttribute(to_ielem(element), name, value);
+	g_string_append_c(doc->out, ' ');
+	g_string_append(doc->out, name);
+	g_string_append(doc->out, "=\"");
+	append_attribute_value(doc->out, value);
+	g_string_append_c(doc->out, '"');
 }
 
 void add_value_element(struct xmldoc *doc,
                        struct xmlelement *parent,
                        const char *tagname, const char *value)
 {
-        struct xmlelement *top;
+	struct xmlelement *top;
 
-        top=xmlelement_new(doc, tagname);
-        xmlelement_add_text(doc, top, value);
-        xmlelement_add_element(doc, parent, top);
+	top = xmlelement_new(doc, parent, tagname);
+	xmlelement_add_text(doc, top, value);
+	xmlelement_end(doc, top);
 }
 
-struct xmlelement *add_attributevalue_element(struct xmldoc *doc,
-					      struct xmlelement *parent,
-					      const char *tagname,
-					      const char *attribute_name,
-					      const char *value)
+void add_attributevalue_element(struct xmldoc *doc,
+				struct xmlelement *parent,
+				const char *tagname,
+				const char *attribute_name,
+				const char *value)
 {
-        struct xmlelement *top;
+	struct xmlelement *top;
 
-        top = xmlelement_new(doc, tagname);
-        xmlelement_set_attribute(doc, top, attribute_name, value);
-        xmlelement_add_element(doc, parent, top);
-	return top;
+	top = xmlelement_new(doc, parent, tagname);
+	xmlelement_set_attribute(doc, top, attribute_name, value);
+	xmlelement_end(doc, top);
 }
 
 void add_value_element_int(struct xmldoc *doc,
                            struct xmlelement *parent,
                            const char *tagname, int value)
 {
-        char *buf;
+	char buf[16];
 
-        if (asprintf(&buf,"%d",value) >= 0) {
-		add_value_element(doc, parent, tagname, buf);
-		free(buf);
-	}
+	snprintf(buf, sizeof(buf), "%d", value);
+	add_value_element(doc, parent, tagname, buf);
 }
+
 void add_value_element_long(struct xmldoc *doc,
                             struct xmlelement *parent,
                             const char *tagname, long long value)
 {
-        char *buf;
+	char buf[32];
 
-        if (asprintf(&buf,"%lld",value) >= 0) {
-		add_value_element(doc, parent, tagname, buf);
-		free(buf);
-	}
+	snprintf(buf, sizeof(buf), "%lld", value);
+	add_value_element(doc, parent, tagname, buf);
 }
@@ -24,52 +24,48 @@
 #ifndef _XMLDOC_H
 #define _XMLDOC_H
 
+// Outgoing documents (device description, SCPD, LastChange events) are
+// written front to back directly into one buffer, escaping as we go; there
+// is no DOM. So elements have to be created in document order: attributes
+// right after the element is started, then its content, then end it.
+// An element handle is only valid until the element is ended.
+
 struct xmldoc;
 struct xmlelement;
 
+// Start a new document, beginning with the XML declaration.
 struct xmldoc *xmldoc_new(void);
-
 void xmldoc_free(struct xmldoc *doc);
+
+// Returns the finished document as malloc()ed string that the caller needs
+// to free(). All elements must be ended. No further output is possible
+// afterwards; the doc still needs to be xmldoc_free()d.
 char *xmldoc_tostring(struct xmldoc *doc);
-struct xmldoc *xmldoc_parsexml(const char *xml_text);
 
 struct xmlelement *xmldoc_new_topelement(struct xmldoc *doc,
                                          const char *elementName,
                                          const char *xmlns);
 
-struct xmlelement *xmlelement_new(struct xmldoc *doc, const char *elementName);
+// Start a new element within "parent", which must be the innermost element
+// not ended yet.
+struct xmlelement *xmlelement_new(struct xmldoc *doc,
+				  struct xmlelement *parent,
+				  const char *elementName);
+void xmlelement_end(struct xmldoc *doc, struct xmlelement *element);
 
-void xmlelement_add_element(struct xmldoc *doc,
-			    struct xmlelement *parent,
-			    struct xmlelement *child);
 void xmlelement_add_text(struct xmldoc *doc,
 			 struct xmlelement *parent,
 			 const char *text);
+// Only before any content is added to the element.
 void xmlelement_set_attribute(struct xmldoc *doc,
 			      struct xmlelement *element,
 			      const char *name,
 			      const char *value);
 
+// Add a complete <tagname>value</tagname> element.
 void add_value_element(struct xmldoc *doc,
                        struct xmlelement *parent,
                        const char *tagname, const char *value);
-
-// Find element in document. This returns a newly allocated struct.
-struct xmlelement *find_element_in_doc(struct xmldoc *doc,
-				       const char *key);
-// Find element in document. This returns a newly allocated struct.
-struct xmlelement *find_element_in_element(struct xmlelement *element,
-					   const char *key);
-
-// Returns a newly allocated string representing the element value.
-char *get_node_value(struct xmlelement *element);
-
-struct xmlelement *add_attributevalue_element(struct xmldoc *doc,
-					      struct xmlelement *parent,
-					      const char *tagname,
-					      const char *attribute_name,
-					      const char *value);
-
 void add_value_element_int(struct xmldoc *doc,
                            struct xmlelement *parent,
                            const char *tagname, int value);
@@ -77,6 +73,11 @@ void add_value_element_long(struct xmldoc *doc,
                             struct xmlelement *parent,
                             const char *tagname, long long value);
 
-
+// Add a complete <tagname attribute_name="value"/> element.
+void add_attributevalue_element(struct xmldoc *doc,
+				struct xmlelement *parent,
+				const char *tagname,
+				const char *attribute_name,
+				const char *value);
 
 #endif /* _XMLDOC_H */
@@ -28,64 +28,119 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
+
 #include "xmlescape.h"
 
+struct entity {
+	const char *text;
+	size_t len;
+};
 
-static void xmlescape_real(const char *str, char *target, int *length,
-                           int attribute)
+static struct entity entity_for(char c)
 {
-	if (target != NULL) {
-		int len = 0;
-
-		for (/**/; *str; str++) {
-			if (*str == '<') {
-				memcpy(target + len, "&lt;", 4);
-				len += 4;
-			} else if (attribute && (*str == '"')) {
-				memcpy(target + len, "%22", 3);
-				len += 3;
-			} else if (*str == '>') {
-				memcpy(target + len, "&gt;", 4);
-				len += 4;
-			} else if (*str == '&') {
-				memcpy(target + len, "&amp;", 5);
-				len += 5;
-			} else {
-				target[len++] = *str;
-			}
-		}
-		target[len] = '\0';
-
-		if (length != NULL)
-			*length = len;
-	} else if (length != NULL) {
-		int len = 0;
+	switch (c) {
+	case '<': return (struct entity) { "&lt;", 4 };
+	case '>': return (struct entity) { "&gt;", 4 };
+	case '&': return (struct entity) { "&amp;", 5 };
+	default:  return (struct entity) { "%22", 3 };  // '"' in attribute.
+	}
+}
 
-		for (/**/; *str; str++) {
-			if (*str == '<') {
-				len += 4;
-			} else if (attribute && (*str == '"')) {
-				len += 3;
-			} else if (*str == '>') {
-				len += 4;
-			} else if (*str == '&') {
-				len += 5;
-			} else {
-				len++;
-			}
-		}
+// Returns the offset of the first character in str[0..len) that needs
+// escaping, or len if there is none. Documents are mostly clean text with
+// the occasional markup character, so we look at 16 bytes at a time where
+// the CPU allows.
+static size_t find_special(const char *str, size_t len, int attribute)
+{
+	// Outside attributes, quotes are fine; just look for '<' twice.
+	const char quote = attribute ? '"' : '<';
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i qt = _mm_set1_epi8(quote);
+	for (/**/; i + 16 <= len; i += 16) {
+		const __m128i chunk = _mm_loadu_si128((const __m128i*)(str + i));
+		const __m128i hit =
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt),
+						  _mm_cmpeq_epi8(chunk, gt)),
+				     _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+						  _mm_cmpeq_epi8(chunk, qt)));
+		const int mask = _mm_movemask_epi8(hit);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const uint8x16_t lt = vdupq_n_u8('<');
+	const uint8x16_t gt = vdupq_n_u8('>');
+	const uint8x16_t amp = vdupq_n_u8('&');
+	const uint8x16_t qt = vdupq_n_u8(quote);
+	for (/**/; i + 16 <= len; i += 16) {
+		const uint8x16_t chunk = vld1q_u8((const uint8_t*)(str + i));
+		const uint8x16_t hit =
+			vorrq_u8(vorrq_u8(vceqq_u8(chunk, lt),
+					  vceqq_u8(chunk, gt)),
+				 vorrq_u8(vceqq_u8(chunk, amp),
+					  vceqq_u8(chunk, qt)));
+		// No movemask on NEON: narrowing shift leaves 4 bits per byte.
+		const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+		if (mask != 0)
+			return i + (__builtin_ctzll(mask) >> 2);
+	}
+#endif
+	for (/**/; i < len; ++i) {
+		const char c = str[i];
+		if (c == '<' || c == '>' || c == '&' || c == quote)
+			return i;
+	}
+	return len;
+}
 
-		*length = len;
+void xmlescape_append(GString *out, const char *str, size_t len,
+		      int attribute)
+{
+	for (;;) {
+		const size_t run = find_special(str, len, attribute);
+		g_string_append_len(out, str, run);
+		if (run == len)
+			break;
+		const struct entity entity = entity_for(str[run]);
+		g_string_append_len(out, entity.text, entity.len);
+		str += run + 1;
+		len -= run + 1;
 	}
 }
 
 char *xmlescape(const char *str, int attribute)
 {
-	int len;
-	char *out;
-
-	xmlescape_real(str, NULL, &len, attribute);
-	out = (char*)malloc(len + 1);
-	xmlescape_real(str, out, NULL, attribute);
+	size_t len = strlen(str);
+	size_t capacity = len + len / 8 + 16;  // Room for a few entities.
+	char *out = (char*)malloc(capacity);
+	size_t pos = 0;
+	for (;;) {
+		const size_t run = find_special(str, len, attribute);
+		const struct entity entity = (run < len)
+			? entity_for(str[run]) : (struct entity) { "", 0 };
+		if (pos + run + entity.len + 1 > capacity) {
+			capacity = 2 * capacity + run + entity.len;
+			out = (char*)realloc(out, capacity);
+		}
+		memcpy(out + pos, str, run);
+		pos += run;
+		if (run == len)
+			break;
+		memcpy(out + pos, entity.text, entity.len);
+		pos += entity.len;
+		str += run + 1;
+		len -= run + 1;
+	}
+	out[pos] = '\0';
 	return out;
 }
@@ -24,9 +24,17 @@
 #ifndef _XMLESCAPE_H
 #define _XMLESCAPE_H
 
+#include <stddef.h>
+#include <glib.h>
+
 // XML escape string "str". If "attribute" is 1, then this is considered
 // to be within an xml attribute (i.e. quotes are escaped as well).
 // Returns a malloc()ed string; caller needs to free().
 char *xmlescape(const char *str, int attribute);
 
+// Like xmlescape(), but appends the escaped first "len" bytes of "str" to
+// "out", so no intermediate string needs to be allocated.
+void xmlescape_append(GString *out, const char *str, size_t len,
+		      int attribute);
+
 #endif /* _XMLESCAPE_H */